@@ -1,541 +1,163 @@
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <chrono>
+#include <condition_variable>
 #include <conio.h>
+#include <cstring>
 #include <exception>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <iterator>
+#include <limits>
 #include <memory>
-#include <ranges>
+#include <mutex>
 #include <shellscalingapi.h>
+#include <span>
+#include <stop_token>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <utility>
+#include <vector>
+// NB: before windows.h, which includes the older winsock.h otherwise
+#include <winsock2.h>
 #include <windows.h>
-#include <winevt.h>
-#include <winrt/Windows.Data.Xml.Dom.h>
-#include <winrt/Windows.Foundation.h>
-#include <winrt/Windows.UI.Notifications.h>
-#include <winrt/base.h>
-#include <winrt/windows.foundation.collections.h>
-
-#pragma comment(lib, "runtimeobject.lib")
-#pragma comment(lib, "wevtapi.lib")
+
+#include "src/archive.hpp"
+#include "src/backfill.hpp"
+#include "src/benchmark.hpp"
+#include "src/bookmark.hpp"
+#include "src/bounded_queue.hpp"
+#include "src/coalescer.hpp"
+#include "src/console.hpp"
+#include "src/correlator.hpp"
+#include "src/event_filter.hpp"
+#include "src/event_format.hpp"
+#include "src/event_log.hpp"
+#include "src/event_output.hpp"
+#include "src/event_parser.hpp"
+#include "src/event_render.hpp"
+#include "src/event_source.hpp"
+#include "src/event_value.hpp"
+#include "src/forwarder.hpp"
+#include "src/history.hpp"
+#include "src/limiter.hpp"
+#include "src/mapped_file.hpp"
+#include "src/message_box_queue.hpp"
+#include "src/message_box_worker.hpp"
+#include "src/metrics.hpp"
+#include "src/module_index.hpp"
+#include "src/options.hpp"
+#include "src/pipeline.hpp"
+#include "src/rolling_log.hpp"
+#include "src/shell.hpp"
+#include "src/sinks.hpp"
+#include "src/stats_section.hpp"
+#include "src/subscription.hpp"
+#include "src/text.hpp"
+#include "src/toast_batcher.hpp"
+#include "src/toast_notifier.hpp"
+#include "src/utf8.hpp"
+
 #pragma comment(lib, "Shcore.lib")
 
+// NB: test/apperrnotitool_test.cpp includes this file and brings its own console entry point
+#ifndef APPERRNOTITOOL_TEST
 #pragma comment(linker, "/subsystem:windows /entry:wmainCRTStartup")
-
-namespace winrt
-{
-using namespace Windows::UI::Notifications;
-using namespace Windows::Foundation;
-using namespace Windows::Data::Xml::Dom;
-} // namespace winrt
+#endif
 
 namespace bizwen
 {
 
 using namespace std::literals;
 
-struct EventLog
+// Prints the events of the -history file counted by the -groupby fields, the -top groups largest first. With
+// -since only the events of the last S seconds are counted.
+void QueryHistory(const Options &options)
 {
-    // System
-    winrt::hstring systemTime;
-    winrt::hstring UserId;
-
-    // EventData
-    winrt::hstring appName;
-    winrt::hstring appVersion;
-    winrt::hstring appTimeStamp;
-    winrt::hstring moduleName;
-    winrt::hstring moduleVersion;
-    winrt::hstring moduleTimeStamp;
-    winrt::hstring exceptionCode;
-    winrt::hstring faultingOffset;
-    winrt::hstring processId;
-    winrt::hstring processCreationTime;
-    winrt::hstring appPath;
-    winrt::hstring modulePath;
-    winrt::hstring integratorReportId;
-    winrt::hstring packageFullName;
-    winrt::hstring packageRelativeAppId;
-};
-
-void RegisterAumidForToast()
-{
-    HKEY hKey{};
-    LONG result =
-        ::RegCreateKeyExW(HKEY_CURRENT_USER, L"Software\\Classes\\AppUserModelId\\Application_Error_Notification_Tool",
-                          0, nullptr, REG_OPTION_VOLATILE, KEY_WRITE, nullptr, &hKey, nullptr);
-
-    if (result != ERROR_SUCCESS)
-    {
-        std::terminate();
-    }
-
-    const wchar_t displayName[] = L"Application Error Notification";
-    result = ::RegSetValueExW(hKey, L"DisplayName", 0, REG_SZ, reinterpret_cast<const BYTE *>(displayName),
-                              sizeof(displayName));
-
-    if (result != ERROR_SUCCESS)
-    {
-        std::terminate();
-    }
-
-    if (RegCloseKey(hKey) != ERROR_SUCCESS)
+    if (options.historyFile.empty())
     {
-        std::terminate();
+        WriteContentConsole(L"No crash history was given with -history.\n"sv);
+        return;
     }
-}
-
-void SendToNotificationCenter(std::wstring_view content)
-{
-    // <toast duration="short"><visual><binding template="ToastGeneric"><text>)
-    // content
-    // </text></binding></visual></toast>
-
-    winrt::XmlDocument toastXml;
-
-    auto toastElement = toastXml.CreateElement(L"toast"sv);
-    toastElement.SetAttribute(L"duration"sv, L"short"sv);
-    toastXml.AppendChild(toastElement);
-
-    auto visualElement = toastXml.CreateElement(L"visual"sv);
-    toastElement.AppendChild(visualElement);
-
-    auto bindingElement = toastXml.CreateElement(L"binding"sv);
-    bindingElement.SetAttribute(L"template"sv, L"ToastGeneric"sv);
-    visualElement.AppendChild(bindingElement);
-
-    auto textElement = toastXml.CreateElement(L"text"sv);
-    textElement.InnerText(winrt::hstring(content));
-    bindingElement.AppendChild(textElement);
 
-    winrt::ToastNotification toast(toastXml);
-    toast.ExpiresOnReboot(true);
+    HistoryReader history(options.historyFile);
+    HistoryGroups groups;
+    auto since = options.sinceSeconds != 0 ? FileTimeNow() - options.sinceSeconds * 10'000'000ull : 0;
+    auto start = Clock::now();
+    AggregateHistory(history, options.groupBy, since, groups);
 
-    winrt::ToastNotificationManager::CreateToastNotifier(L"Application_Error_Notification_Tool"sv).Show(toast);
-}
-
-void CleanupRegistry()
-{
-    winrt::ToastNotificationManager::History().Clear(L"Application_Error_Notification_Tool"sv);
-
-    auto errorCode =
-        ::RegDeleteKeyW(HKEY_CURRENT_USER, L"Software\\Classes\\AppUserModelId\\Application_Error_Notification_Tool");
-    if (errorCode != ERROR_SUCCESS && errorCode != ERROR_FILE_NOT_FOUND)
-    {
-        std::terminate();
-    }
-}
-
-std::wstring FormatEventLog(const EventLog &eventLog, bool minimal)
-{
-    std::wstring output;
-    output.reserve(800);
-
-    auto appendIfNotEmpty = [&output, minimal](std::wstring_view fieldName, const winrt::hstring &fieldValue,
-                                               bool fieldMinimal = false) {
-        if (!fieldValue.empty() && !(minimal && !fieldMinimal))
-        {
-            output += fieldName;
-            output += L": "sv;
-            output += fieldValue;
-            output += L'\n';
-        }
+    std::vector<std::pair<std::wstring_view, std::uint64_t>> ranked(groups.counts.begin(), groups.counts.end());
+    auto order = [](auto &left, auto &right) {
+        return left.second != right.second ? left.second > right.second : left.first < right.first;
     };
-    appendIfNotEmpty(L"SystemTime"sv, eventLog.systemTime);
-    appendIfNotEmpty(L"UserID"sv, eventLog.UserId);
-    appendIfNotEmpty(L"AppName"sv, eventLog.appName, true);
-    appendIfNotEmpty(L"AppVersion"sv, eventLog.appVersion);
-    appendIfNotEmpty(L"AppTimeStamp"sv, eventLog.appTimeStamp);
-    appendIfNotEmpty(L"ModuleName"sv, eventLog.moduleName, true);
-    appendIfNotEmpty(L"ModuleVersion"sv, eventLog.moduleVersion);
-    appendIfNotEmpty(L"ModuleTimeStamp"sv, eventLog.moduleTimeStamp);
-    appendIfNotEmpty(L"ExceptionCode"sv, eventLog.exceptionCode, true);
-    appendIfNotEmpty(L"FaultingOffset"sv, eventLog.faultingOffset);
-    appendIfNotEmpty(L"ProcessId"sv, eventLog.processId);
-    appendIfNotEmpty(L"ProcessCreationTime"sv, eventLog.processCreationTime);
-    appendIfNotEmpty(L"AppPath"sv, eventLog.appPath);
-    appendIfNotEmpty(L"ModulePath"sv, eventLog.modulePath);
-    appendIfNotEmpty(L"IntegratorReportId"sv, eventLog.integratorReportId, true);
-    appendIfNotEmpty(L"PackageFullName"sv, eventLog.packageFullName);
-    appendIfNotEmpty(L"PackageRelativeAppId"sv, eventLog.packageRelativeAppId);
-
-    return output;
-}
-
-void ParseEventLog(winrt::hstring xmlString, EventLog &eventLog) noexcept
-{
-    auto toXmlElement = [](auto &&node) { return node.template as<typename winrt::XmlElement>(); };
-
-    winrt::XmlDocument doc;
-    doc.LoadXml(xmlString);
-    auto root = doc.DocumentElement();
-
-    for (auto &&child : root.ChildNodes())
-    {
-        auto nodeName = child.NodeName();
-
-        if (nodeName == L"System"sv)
-        {
-            for (auto &&element : child.ChildNodes() | std::views::transform(toXmlElement))
-            {
-                auto name = element.NodeName();
-
-                if (name == L"TimeCreated"sv)
-                {
-                    eventLog.systemTime = element.GetAttribute(L"SystemTime"sv);
-                }
-                else if (name == L"Security"sv)
-                {
-                    eventLog.UserId = element.GetAttribute(L"UserID"sv);
-                }
-            }
-        }
-        else if (nodeName == L"EventData"sv)
-        {
-            for (auto &&element : child.ChildNodes() | std::views::transform(toXmlElement))
-            {
-                if (element.NodeName() == L"Data"sv)
-                {
-                    auto name = element.GetAttribute(L"Name"sv);
-                    auto value = element.InnerText();
-
-                    if (name == L"AppName"sv)
-                        eventLog.appName = value;
-                    else if (name == L"AppVersion"sv)
-                        eventLog.appVersion = value;
-                    else if (name == L"AppTimeStamp"sv)
-                        eventLog.appTimeStamp = value;
-                    else if (name == L"ModuleName"sv)
-                        eventLog.moduleName = value;
-                    else if (name == L"ModuleVersion"sv)
-                        eventLog.moduleVersion = value;
-                    else if (name == L"ModuleTimeStamp"sv)
-                        eventLog.moduleTimeStamp = value;
-                    else if (name == L"ExceptionCode"sv)
-                        eventLog.exceptionCode = value;
-                    else if (name == L"FaultingOffset"sv)
-                        eventLog.faultingOffset = value;
-                    else if (name == L"ProcessId"sv)
-                        eventLog.processId = value;
-                    else if (name == L"ProcessCreationTime"sv)
-                        eventLog.processCreationTime = value;
-                    else if (name == L"AppPath"sv)
-                        eventLog.appPath = value;
-                    else if (name == L"ModulePath"sv)
-                        eventLog.modulePath = value;
-                    else if (name == L"IntegratorReportId"sv)
-                        eventLog.integratorReportId = value;
-                    else if (name == L"PackageFullName"sv)
-                        eventLog.packageFullName = value;
-                    else if (name == L"PackageRelativeAppId"sv)
-                        eventLog.packageRelativeAppId = value;
-                }
-            }
-        }
-    }
-}
-
-std::wstring WriteTempFile(std::wstring_view content)
-{
-    using namespace std::literals;
-    auto path = std::filesystem::temp_directory_path();
-    path /= std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
-    path += L".txt"sv;
-
-    std::wfstream fileStream(path.native(), std::ios::out | std::ios::binary);
-    if (fileStream.is_open())
-    {
-        fileStream.write(content.data(), static_cast<std::streamsize>(content.size()));
-    }
-    else
-    {
-        std::terminate();
-    }
-    return path.native();
-}
-
-DWORD WINAPI MessageBoxThread(LPVOID lpParam)
-{
-    auto pMessage = static_cast<std::wstring *>(lpParam);
-    if (::SetThreadDpiAwarenessContext(DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE_V2) == nullptr)
-    {
-        std::terminate();
-    }
-    if (::MessageBoxW(nullptr, pMessage->c_str(), L"Application Error", MB_TOPMOST | MB_OK | MB_ICONERROR) == 0)
-    {
-        std::terminate();
-    }
-    delete pMessage;
-    return 0;
-}
-
-void ShowMessageBoxAsync(std::wstring message)
-{
-    auto pMessage = new std::wstring(std::move(message));
-    HANDLE hThread = ::CreateThread(nullptr, 0, MessageBoxThread, pMessage, 0, nullptr);
-    if (!hThread)
-    {
-        std::terminate();
-    }
-
-    if (::CloseHandle(hThread) == 0)
-    {
-        std::terminate();
-    }
-}
-
-void OpenNotepadWithContent(std::wstring content)
-{
-    auto tempFile = WriteTempFile(content);
+    auto shown = options.top != 0 ? std::min<std::size_t>(options.top, ranked.size()) : ranked.size();
+    std::ranges::partial_sort(ranked, ranked.begin() + static_cast<std::ptrdiff_t>(shown), order);
+    auto elapsed = Clock::now() - start;
 
-    std::wstring parameter;
-    parameter.reserve(content.size() + 2);
-    parameter += L"\""sv;
-    parameter += tempFile;
-    parameter += L"\""sv;
-
-    HINSTANCE hInst = ::ShellExecuteW(nullptr, L"open", L"notepad.exe", parameter.c_str(), nullptr, SW_SHOWNORMAL);
-    if (reinterpret_cast<INT_PTR>(hInst) <= 32)
-    {
-        std::terminate();
-    }
-}
-
-void OpenPowerShellWithContent(std::wstring content)
-{
-    auto tempFile = WriteTempFile(content);
-    auto prefix = L"-NoExit Get-Content -Path \""sv;
-    auto postfix = L"\""sv;
-    std::wstring parameter;
-    parameter.reserve(content.size() + prefix.size() + postfix.size());
-    parameter += prefix;
-    parameter += tempFile;
-    parameter += postfix;
-
-    HINSTANCE hInst = ::ShellExecuteW(nullptr, L"open", L"powershell.exe", parameter.c_str(), nullptr, SW_SHOWNORMAL);
-    if (reinterpret_cast<INT_PTR>(hInst) <= 32)
-    {
-        std::terminate();
-    }
-}
-
-enum class PrintMethod
-{
-    console = 0b1,
-    messagebox = 0b10,
-    notepad = 0b100,
-    powershell = 0b1000,
-    notification = 0b10000
-};
-
-constexpr PrintMethod &operator|=(PrintMethod &a, PrintMethod b) noexcept
-{
-    return a = static_cast<PrintMethod>(std::to_underlying(a) | std::to_underlying(b));
-}
-
-constexpr bool operator&(PrintMethod a, PrintMethod b) noexcept
-{
-    return (std::to_underlying(a) & std::to_underlying(b)) != 0;
-}
-
-enum class PrintStyle
-{
-    text,
-    xml
-};
-
-enum class RunMode
-{
-    console,
-    silent,
-    kill,
-    help
-};
-
-void ParseArguments(std::wstring_view arg, PrintMethod &method, PrintStyle &style, RunMode &mode)
-{
-    if (arg == L"-messagebox"sv)
-    {
-        method |= PrintMethod::messagebox;
-    }
-    else if (arg == L"-notepad"sv)
-    {
-        method |= PrintMethod::notepad;
-    }
-    else if (arg == L"-powershell"sv)
-    {
-        method |= PrintMethod::powershell;
-    }
-    else if (arg == L"-notification"sv)
-    {
-        method |= PrintMethod::notification;
-    }
-    else if (arg == L"-text"sv)
-    {
-        style = PrintStyle::text;
-    }
-    else if (arg == L"-xml"sv)
-    {
-        style = PrintStyle::xml;
-    }
-    else if (arg == L"-console"sv)
-    {
-        mode = RunMode::console;
-    }
-    else if (arg == L"-silent"sv)
-    {
-        mode = RunMode::silent;
-    }
-    else if (arg == L"-kill")
-    {
-        mode = RunMode::kill;
-    }
-    else if (arg == L"-help")
-    {
-        mode = RunMode::help;
-    }
-    else
+    // text is one tab-separated line per group after a heading, -jsonl an object per group
+    std::wstring output;
+    if (options.style != PrintStyle::jsonl)
     {
-        std::terminate();
+        output += L"Count"sv;
     }
-}
-
-void WriteContentConsole(std::wstring_view str)
-{
-    if (auto handle = ::GetStdHandle(STD_OUTPUT_HANDLE))
+    for (std::size_t i = 0; i != std::size(eventFields); ++i)
     {
-        DWORD outSize;
-        if (!::WriteConsoleW(handle, str.data(), static_cast<DWORD>(str.size()), &outSize, nullptr))
+        if (options.style != PrintStyle::jsonl && (options.groupBy >> i & 1) != 0)
         {
-            std::terminate();
+            output += L'\t';
+            output += eventFields[i].name;
         }
     }
-}
-
-EVT_HANDLE SubscribeEvent(HANDLE event)
-{
-    auto hSubscription = ::EvtSubscribe(nullptr, event, L"Application", L"*[System[(Level=2)]]", nullptr, nullptr,
-                                        nullptr, EvtSubscribeToFutureEvents);
-    if (hSubscription == nullptr)
+    if (!output.empty())
     {
-        std::terminate();
+        output += L'\n';
     }
-    return hSubscription;
-}
-
-std::wstring PrintEvent(EVT_HANDLE hEvent)
-{
-    DWORD dwBufferSize = 0;
-    DWORD dwBufferUsed = 0;
-    DWORD dwPropertyCount = 0;
-
-    ::EvtRender(nullptr, hEvent, EvtRenderEventXml, dwBufferSize, nullptr, &dwBufferUsed, &dwPropertyCount);
 
-    if (::GetLastError() == ERROR_INSUFFICIENT_BUFFER)
+    for (std::size_t rank = 0; rank != shown; ++rank)
     {
-        dwBufferSize = dwBufferUsed;
-        std::wstring renderedContent;
-        renderedContent.resize_and_overwrite(dwBufferSize / sizeof(wchar_t), [&](wchar_t *data, size_t size) {
-            if (::EvtRender(nullptr, hEvent, EvtRenderEventXml, dwBufferSize, data, &dwBufferUsed, &dwPropertyCount))
+        auto [key, count] = ranked[rank];
+        output += options.style == PrintStyle::jsonl ? L"{\"Count\":"sv : L""sv;
+        AppendNumber(count, output);
+        for (std::size_t i = 0; i != std::size(eventFields); ++i)
+        {
+            if ((options.groupBy >> i & 1) == 0)
             {
-                return dwBufferUsed / sizeof(wchar_t) - 1; // NB: null terminator
+                continue;
             }
-            else
+            auto value = key.substr(0, key.find(L'\0'));
+            key.remove_prefix(std::min(key.size(), value.size() + 1));
+            if (options.style == PrintStyle::jsonl)
             {
-                std::terminate();
-            }
-        });
-        return renderedContent;
-    }
-    else
-    {
-        std::terminate();
-    }
-}
-
-void DispatchOutput(PrintMethod method, const std::wstring &content)
-{
-    if (method & PrintMethod::console)
-    {
-        WriteContentConsole(content);
-    }
-    if (method & PrintMethod::messagebox)
-    {
-        ShowMessageBoxAsync(content);
-    }
-    if (method & PrintMethod::notepad)
-    {
-        OpenNotepadWithContent(content);
-    }
-    if (method & PrintMethod::powershell)
-    {
-        OpenPowerShellWithContent(content);
-    }
-    if (method & PrintMethod::notification)
-    {
-        SendToNotificationCenter(content);
-    }
-}
-
-void DispatchOutput(PrintMethod method, const EventLog &eventLog)
-{
-    if (method & PrintMethod::console)
-    {
-        auto content = FormatEventLog(eventLog, false);
-        WriteContentConsole(content);
-    }
-    if (method & PrintMethod::messagebox)
-    {
-        auto content = FormatEventLog(eventLog, false);
-        ShowMessageBoxAsync(content);
-    }
-    if (method & PrintMethod::notepad)
-    {
-        auto content = FormatEventLog(eventLog, false);
-        OpenNotepadWithContent(content);
-    }
-    if (method & PrintMethod::powershell)
-    {
-        auto content = FormatEventLog(eventLog, false);
-        OpenPowerShellWithContent(content);
-    }
-    if (method & PrintMethod::notification)
-    {
-        auto content = FormatEventLog(eventLog, true);
-        SendToNotificationCenter(content);
-    }
-}
-
-void EnumerateResults(EVT_HANDLE hResults, PrintMethod method, PrintStyle style)
-{
-    while (true)
-    {
-        EVT_HANDLE hEvent;
-        DWORD dwReturned = 0;
-        if (EvtNext(hResults, 1, &hEvent, INFINITE, 0, &dwReturned))
-        {
-            auto xml = PrintEvent(hEvent);
-            if (style == PrintStyle::text)
-            {
-                EventLog eventLog;
-                ParseEventLog(winrt::hstring(xml), eventLog);
-                DispatchOutput(method, eventLog);
+                output += L",\""sv;
+                output += eventFields[i].name;
+                output += L"\":\""sv;
+                AppendJsonEscaped(value, output);
+                output += L'"';
             }
             else
             {
-                DispatchOutput(method, xml);
+                output += L'\t';
+                output += value;
             }
-            EvtClose(hEvent);
-        }
-        else if (GetLastError() == ERROR_NO_MORE_ITEMS)
-        {
-            return;
-        }
-        else
-        {
-            std::terminate();
         }
+        output += options.style == PrintStyle::jsonl ? L"}\n"sv : L"\n"sv;
+    }
+
+    if (options.style != PrintStyle::jsonl)
+    {
+        AppendNumber(groups.matched, output);
+        output += L" of "sv;
+        AppendNumber(groups.events, output);
+        output += L" events in "sv;
+        AppendNumber(ranked.size(), output);
+        output += L" groups, counted in "sv;
+        AppendDuration(static_cast<std::uint64_t>(std::chrono::nanoseconds(elapsed).count()), output);
+        output += L".\n"sv;
     }
+    WriteContentConsole(output);
 }
 
 bool IsKeyEvent(HANDLE hStdIn)
@@ -553,7 +175,7 @@ bool IsKeyEvent(HANDLE hStdIn)
     }
 }
 
-void WaitOnEvent(PrintMethod method, PrintStyle style)
+void WaitOnEvent(const Options &options)
 {
     HANDLE aWaitHandles[2];
 
@@ -564,18 +186,15 @@ void WaitOnEvent(PrintMethod method, PrintStyle style)
         std::terminate();
     }
 
-    aWaitHandles[1] = ::CreateEventW(nullptr, TRUE, TRUE, nullptr);
-
-    if (aWaitHandles[1] == nullptr)
-    {
-        std::terminate();
-    }
-
-    auto hSubscription = SubscribeEvent(aWaitHandles[1]);
+    auto metrics = options.stats ? std::make_unique<Metrics>() : nullptr;
+    Pipeline pipeline(options, DesktopSinks(options), metrics.get());
+    auto reporter = metrics ? std::make_unique<StatsReporter>(*metrics, pipeline, options, false) : nullptr;
+    SubscriptionSet subscriptions(options, pipeline, metrics.get());
+    aWaitHandles[1] = subscriptions.Ready();
 
     while (true)
     {
-        DWORD dwWait = WaitForMultipleObjects(2, aWaitHandles, FALSE, INFINITE);
+        DWORD dwWait = WaitForMultipleObjects(2, aWaitHandles, FALSE, CheckpointTimeout(options));
 
         if (dwWait == WAIT_OBJECT_0) // Kill event
         {
@@ -583,9 +202,11 @@ void WaitOnEvent(PrintMethod method, PrintStyle style)
         }
         else if (dwWait == WAIT_OBJECT_0 + 1) // Query results
         {
-            EnumerateResults(hSubscription, method, style);
-
-            ResetEvent(aWaitHandles[1]);
+            subscriptions.Collect();
+        }
+        else if (dwWait == WAIT_TIMEOUT)
+        {
+            subscriptions.Checkpoint();
         }
         else
         {
@@ -593,12 +214,10 @@ void WaitOnEvent(PrintMethod method, PrintStyle style)
         }
     }
 
-    EvtClose(hSubscription);
     CloseHandle(aWaitHandles[0]);
-    CloseHandle(aWaitHandles[1]);
 }
 
-void WaitOnConsole(PrintMethod method, PrintStyle style)
+void WaitOnConsole(const Options &options)
 {
     HANDLE aWaitHandles[2];
 
@@ -609,18 +228,16 @@ void WaitOnConsole(PrintMethod method, PrintStyle style)
         std::terminate();
     }
 
-    aWaitHandles[1] = CreateEventW(nullptr, TRUE, TRUE, nullptr);
-
-    if (aWaitHandles[1] == nullptr)
-    {
-        std::terminate();
-    }
-
-    auto hSubscription = SubscribeEvent(aWaitHandles[1]);
+    auto metrics = options.stats ? std::make_unique<Metrics>() : nullptr;
+    Pipeline pipeline(options, DesktopSinks(options), metrics.get());
+    auto reporter = metrics ? std::make_unique<StatsReporter>(*metrics, pipeline, options, true) : nullptr;
+    auto subscriptions = std::make_unique<SubscriptionSet>(options, pipeline, metrics.get());
+    // NB: the ready event belongs to the subscriptions, which close it
+    aWaitHandles[1] = subscriptions->Ready();
 
     while (true)
     {
-        DWORD dwWait = WaitForMultipleObjects(2, aWaitHandles, FALSE, INFINITE);
+        DWORD dwWait = WaitForMultipleObjects(2, aWaitHandles, FALSE, CheckpointTimeout(options));
 
         if (dwWait == WAIT_OBJECT_0) // Console input
         {
@@ -629,10 +246,15 @@ void WaitOnConsole(PrintMethod method, PrintStyle style)
         }
         else if (dwWait == WAIT_OBJECT_0 + 1) // Query results
         {
-            EnumerateResults(hSubscription, method, style);
-
-            ResetEvent(aWaitHandles[1]);
-            WriteContentConsole(L"Waiting, press any key to exit.\n"sv);
+            subscriptions->Collect();
+            if (!subscriptions->Backfilling())
+            {
+                WriteContentConsole(L"Waiting, press any key to exit.\n"sv);
+            }
+        }
+        else if (dwWait == WAIT_TIMEOUT)
+        {
+            subscriptions->Checkpoint();
         }
         else
         {
@@ -640,9 +262,85 @@ void WaitOnConsole(PrintMethod method, PrintStyle style)
         }
     }
 
-    EvtClose(hSubscription);
+    subscriptions.reset();
+    pipeline.Stop();
+    reporter.reset();
+
+    auto summary = SinkSummary(pipeline);
+    if (metrics)
+    {
+        FormatStats(*metrics, pipeline, options.method, summary);
+    }
+    WriteContentConsole(summary);
+}
+
+// Runs the files given with -ingest through the pipeline, or in parallel with -jobs, and reports the throughput.
+void IngestFiles(const Options &options)
+{
+    auto start = Clock::now();
+    std::wstring summary;
+    std::uint64_t events{};
+    std::uint64_t bytes{};
+    if (options.jobs > 1)
+    {
+        ParallelIngest ingest(options.style, options.fields, options.filters, options.jobs);
+        ingest.Run(options.ingestFiles);
+        events = ingest.Events();
+        bytes = ingest.Bytes();
+    }
+    else
+    {
+        ArchiveSource source(options.ingestFiles);
+        auto metrics = options.stats ? std::make_unique<Metrics>() : nullptr;
+        Pipeline pipeline(options, DesktopSinks(options), metrics.get());
+        pipeline.Collect(source);
+        pipeline.Stop();
+        summary = SinkSummary(pipeline);
+        if (metrics)
+        {
+            FormatStats(*metrics, pipeline, options.method, summary);
+        }
+        events = source.Events();
+        bytes = source.Bytes();
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+
+    summary += L"Ingested "sv;
+    AppendNumber(events, summary);
+    summary += L" events from "sv;
+    AppendNumber(bytes, summary);
+    summary += L" bytes in "sv;
+    AppendNumber(elapsed, summary);
+    summary += L" ms on "sv;
+    AppendNumber(options.jobs, summary);
+    summary += L" threads, "sv;
+    AppendNumber(events * 1000 / std::max<std::uint64_t>(elapsed, 1), summary);
+    summary += L" events/s.\n"sv;
+    WriteContentConsole(summary);
+}
+
+// Runs -benchmark, returns false if a stage regressed against -baseline.
+bool BenchmarkStages(const Options &options)
+{
+    auto results = RunBenchmark();
+    auto json = BenchmarkJson(results);
+    if (!options.benchmarkFile.empty())
+    {
+        std::ofstream file(std::filesystem::path(options.benchmarkFile), std::ios::binary | std::ios::trunc);
+        if (!file.write(json.data(), static_cast<std::streamsize>(json.size())))
+        {
+            std::terminate();
+        }
+    }
 
-    CloseHandle(aWaitHandles[1]);
+    std::wstring report(json.begin(), json.end());
+    bool passed = true;
+    if (!options.baselineFile.empty())
+    {
+        passed = CheckBaseline(results, options.baselineFile, report);
+    }
+    WriteContentConsole(report);
+    return passed;
 }
 
 bool TryAttachConsole()
@@ -670,6 +368,7 @@ bool TryAttachConsole()
 
 } // namespace bizwen
 
+#ifndef APPERRNOTITOOL_TEST
 int wmain(int argc, wchar_t **argv)
 {
 
@@ -683,34 +382,64 @@ options:
     -silent      : Start without attaching to the console
     -kill        : Kill the running service
     -help        : Print the help message
-    -messagebox  : Show info via MessageBox
+    -messagebox  : Show info via MessageBox, errors that come while it is open are shown together in the next
     -notepad     : Show info via Windows Notepad
     -powershell  : Show info via Windows PowerShell
-    -notification: Show info via Notification Center
+    -notification: Show info via Notification Center, errors that follow within 2 seconds are summarized in one toast
+    -forward=URL : Send events as syslog to tcp://host:port or udp://host:port, JSON lines with -jsonl, not -binary
+    -spool=F     : Spool -forward batches a TCP receiver did not take to F (default in the temp directory)
+    -compress    : Send -forward batches to a TCP receiver compressed with MSZIP, each behind its two sizes
     -text        : Output info as text
     -xml         : Output info as unformatted XML
+    -jsonl       : Output info as one JSON object per line
+    -binary      : Output info as length-prefixed binary records, meant for file output
+    -fields=A,B  : Only extract and output the named fields, such as AppName,ExceptionCode
+    -include=F:P : Only report events whose field F matches P, a glob when it has * or ?, repeatable
+    -exclude=F:P : Drop events whose field F matches P, F may also be Provider or EventID, repeatable
+    -batch=N     : Fetch up to N events per read (default 16)
+    -queue=N     : Buffer up to N events between reading and output (default 64)
+    -sinkqueue=N : Queue up to N events per output, then drop them (default 8)
+    -coalesce=S  : Summarize repeated faults of the same signature every S seconds
+    -coalescetable=N: Track up to N fault signatures for -coalesce (default 256)
+    -correlate=S : Report the fault, WER and .NET Runtime events of a crash within S seconds as one incident
+    -symbolize   : Resolve FaultingOffset to the nearest function the faulting module exports
+    -limit=O:N/S : Show at most N events per S seconds via output O, digest the rest
+    -channels=F  : Watch the channels of file F, one "Channel" or "Channel: XPath query" per line
+    -bookmark=F  : Keep the read position in file F and resume from it on start
+    -since=S     : Replay the errors of the last S seconds unless resuming from -bookmark
+    -ingest=F    : Process the exported events in file F instead of watching, repeatable
+    -jobs=N      : Parse -ingest files on N threads, console output only (default 1)
+    -benchmark[=F]: Measure the per-event cost of each stage as JSON, also written to F
+    -baseline=F  : Exit with 1 if a -benchmark stage is over 10% slower than in JSON file F
+    -stats[=S]   : Collect pipeline metrics, print them on exit and every S seconds
+    -query       : Print the metrics of the running service started with -stats
+    -log=F       : Append every event to a rolling log F, viewers open it instead of temp files
+    -logsize=N   : Start a new -log segment before one grows beyond N KiB (default 4096)
+    -logage=S    : Start a new -log segment once one is S seconds old (default 86400)
+    -history=F   : Append every event to the crash history F, not with -xml
+    -top=N       : Print the N largest groups of -history events, with -since only those of the last S seconds
+    -groupby=A,B : Group -history events by up to 4 fields for -top, such as ModuleName,FaultingOffset (default AppName)
 )"sv;
 
-    bizwen::PrintMethod method{};
-    bizwen::PrintStyle style{};
-    bizwen::RunMode mode{};
+    bizwen::Options options;
+    int exitCode = 0;
 
     for (int i = 1; i != argc; ++i)
     {
-        ParseArguments(argv[i], method, style, mode);
+        ParseArguments(argv[i], options);
     }
 
-    if (method & bizwen::PrintMethod::notification)
+    if (options.method & bizwen::PrintMethod::notification)
     {
         bizwen::RegisterAumidForToast();
     }
 
-    if (mode == bizwen::RunMode::help)
+    if (options.mode == bizwen::RunMode::help)
     {
         bizwen::TryAttachConsole();
         bizwen::WriteContentConsole(usage);
     }
-    else if (mode == bizwen::RunMode::kill)
+    else if (options.mode == bizwen::RunMode::kill)
     {
         if (auto hEvent = ::OpenEventW(EVENT_MODIFY_STATE, FALSE, L"Application_Error_Notification_Tool");
             hEvent != nullptr)
@@ -736,7 +465,31 @@ options:
             std::terminate();
         }
     }
-    else if (mode == bizwen::RunMode::silent)
+    else if (options.mode == bizwen::RunMode::query)
+    {
+        bizwen::TryAttachConsole();
+        bizwen::QueryStats();
+    }
+    else if (options.mode == bizwen::RunMode::history)
+    {
+        bizwen::TryAttachConsole();
+        bizwen::QueryHistory(options);
+    }
+    else if (options.mode == bizwen::RunMode::benchmark)
+    {
+        bizwen::TryAttachConsole();
+        if (!BenchmarkStages(options))
+        {
+            exitCode = 1;
+        }
+    }
+    else if (options.mode == bizwen::RunMode::ingest)
+    {
+        options.method |= bizwen::PrintMethod::console;
+        bizwen::TryAttachConsole();
+        IngestFiles(options);
+    }
+    else if (options.mode == bizwen::RunMode::silent)
     {
         if (auto hEvent = ::OpenEventW(EVENT_MODIFY_STATE, FALSE, L"Application_Error_Notification_Tool");
             hEvent != nullptr)
@@ -748,12 +501,12 @@ options:
         }
         else
         {
-            WaitOnEvent(method, style);
+            WaitOnEvent(options);
         }
     }
     else
     {
-        method |= bizwen::PrintMethod::console;
+        options.method |= bizwen::PrintMethod::console;
         if (auto hEvent = ::OpenEventW(EVENT_MODIFY_STATE, FALSE, L"Application_Error_Notification_Tool");
             hEvent != nullptr)
         {
@@ -769,7 +522,7 @@ options:
 			 // NB
             if (bizwen::TryAttachConsole())
             {
-                WaitOnConsole(method, style);
+                WaitOnConsole(options);
             }
             else
             {
@@ -778,10 +531,11 @@ options:
         }
     }
 
-    if (method & bizwen::PrintMethod::notification)
+    if (options.method & bizwen::PrintMethod::notification)
     {
         bizwen::CleanupRegistry();
     }
 
-    return 0;
+    return exitCode;
 }
+#endif
@@ -0,0 +1,393 @@
+#pragma once
+
+#include <exception>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "console.hpp"
+#include "event_filter.hpp"
+#include "event_format.hpp"
+#include "event_parser.hpp"
+#include "event_source.hpp"
+#include "mapped_file.hpp"
+
+namespace bizwen
+{
+
+using namespace std::literals;
+
+// Finds the next <Event> element at or after pos and moves pos past it, returns an empty view when there is
+// none. Exported events do not nest, so the records are split textually; a wrapping <Events> element is skipped.
+template <typename Char>
+std::basic_string_view<Char> NextEventRecord(std::basic_string_view<Char> text, std::size_t &pos) noexcept
+{
+    static constexpr Char open[] = {'<', 'E', 'v', 'e', 'n', 't'};
+    static constexpr Char close[] = {'<', '/', 'E', 'v', 'e', 'n', 't', '>'};
+    constexpr std::basic_string_view<Char> openTag(open, std::size(open));
+    constexpr std::basic_string_view<Char> closeTag(close, std::size(close));
+
+    while ((pos = text.find(openTag, pos)) != text.npos)
+    {
+        auto after = pos + openTag.size();
+        if (after != text.size() && (text[after] == ' ' || text[after] == '>' || text[after] == '\t' ||
+                                     text[after] == '\r' || text[after] == '\n'))
+        {
+            auto end = text.find(closeTag, after);
+            if (end == text.npos)
+            {
+                break;
+            }
+            auto begin = pos;
+            pos = end + closeTag.size();
+            return text.substr(begin, pos - begin);
+        }
+        pos = after;
+    }
+    pos = text.size();
+    return {};
+}
+
+// The text of an exported archive, UTF-8 or UTF-16 with a byte order mark. At most one of the views is set.
+struct ArchiveText
+{
+    std::string_view narrow;
+    std::u16string_view wide;
+};
+
+inline ArchiveText GetArchiveText(const MappedFile &file) noexcept
+{
+    auto bytes = std::string_view(static_cast<const char *>(file.Data()), file.Size());
+    if (bytes.starts_with("\xFF\xFE"sv))
+    {
+        return {{}, std::u16string_view(static_cast<const char16_t *>(file.Data()) + 1, bytes.size() / 2 - 1)};
+    }
+    if (bytes.starts_with("\xEF\xBB\xBF"sv))
+    {
+        bytes.remove_prefix(3);
+    }
+    return {bytes, {}};
+}
+
+// Copies a record into content as wide text.
+template <typename Char>
+void DecodeRecord(std::basic_string_view<Char> record, std::wstring &content)
+{
+    content.clear();
+    AppendWide(record, content);
+}
+
+// Reads files of concatenated <Event> records as exported by wevtutil or Get-WinEvent. Each file is mapped and
+// split in place; a record is copied once, into the arena, where it is decoded to wide text and then parsed like
+// a rendered event.
+class ArchiveSource final : public EventSource
+{
+  public:
+    explicit ArchiveSource(std::span<const std::wstring> files) noexcept : files_(files)
+    {
+    }
+
+    std::size_t Next(std::span<EventArena *const> batch) override
+    {
+        std::size_t count = 0;
+        while (count != batch.size())
+        {
+            if (!file_)
+            {
+                if (next_ == files_.size())
+                {
+                    break;
+                }
+                Open(files_[next_++]);
+            }
+
+            if (NextRecord(batch[count]->content))
+            {
+                ++count;
+            }
+            else
+            {
+                file_.reset();
+            }
+        }
+        events_ += count;
+        return count;
+    }
+
+    std::uint64_t Events() const noexcept
+    {
+        return events_;
+    }
+
+    std::uint64_t Bytes() const noexcept
+    {
+        return bytes_;
+    }
+
+  private:
+    void Open(const std::wstring &path)
+    {
+        file_ = std::make_unique<MappedFile>(path);
+        bytes_ += file_->Size();
+        text_ = GetArchiveText(*file_);
+        pos_ = 0;
+    }
+
+    bool NextRecord(std::wstring &content)
+    {
+        auto next = [this, &content](auto text) {
+            auto record = NextEventRecord(text, pos_);
+            DecodeRecord(record, content);
+            return !record.empty();
+        };
+        return text_.wide.empty() ? next(text_.narrow) : next(text_.wide);
+    }
+
+    std::span<const std::wstring> files_;
+    std::size_t next_{};
+    std::unique_ptr<MappedFile> file_;
+    ArchiveText text_;
+    std::size_t pos_{};
+    std::uint64_t events_{};
+    std::uint64_t bytes_{};
+};
+
+// Cuts the next chunk of about size code units off text at pos, ending at a record boundary.
+template <typename Char>
+std::basic_string_view<Char> NextChunk(std::basic_string_view<Char> text, std::size_t &pos, std::size_t size) noexcept
+{
+    static constexpr Char close[] = {'<', '/', 'E', 'v', 'e', 'n', 't', '>'};
+    constexpr std::basic_string_view<Char> closeTag(close, std::size(close));
+
+    auto begin = pos;
+    pos = text.size();
+    if (text.size() - begin > size)
+    {
+        auto end = text.find(closeTag, begin + size);
+        if (end != text.npos)
+        {
+            pos = end + closeTag.size();
+        }
+    }
+    return text.substr(begin, pos - begin);
+}
+
+// Runs task(index, thread) for every index below count on the given number of threads, the calling thread being
+// thread 0. Each thread owns a contiguous share of the indices and takes them from the front; once its share is
+// used up it steals from the back of another one, so uneven tasks even out while neighbouring indices mostly
+// stay on one thread.
+template <typename Task>
+void RunStealing(std::size_t count, std::size_t threads, Task &task)
+{
+    struct Share
+    {
+        std::mutex mutex;
+        std::size_t front;
+        std::size_t back;
+    };
+
+    auto shares = std::make_unique<Share[]>(threads);
+    for (std::size_t i = 0; i != threads; ++i)
+    {
+        shares[i].front = count * i / threads;
+        shares[i].back = count * (i + 1) / threads;
+    }
+
+    auto run = [&shares, &task, threads](std::size_t self) {
+        constexpr auto none = std::numeric_limits<std::size_t>::max();
+        while (true)
+        {
+            std::size_t index = none;
+            for (std::size_t k = 0; k != threads && index == none; ++k)
+            {
+                auto &share = shares[(self + k) % threads];
+                std::lock_guard lock(share.mutex);
+                if (share.front != share.back)
+                {
+                    index = k == 0 ? share.front++ : --share.back;
+                }
+            }
+            if (index == none)
+            {
+                return;
+            }
+            task(index, self);
+        }
+    };
+
+    std::vector<std::jthread> workers;
+    workers.reserve(threads - 1);
+    for (std::size_t i = 1; i < threads; ++i)
+    {
+        workers.emplace_back(run, i);
+    }
+    run(0);
+}
+
+// Parses and formats the -ingest files on several threads for -jobs, without coalescing and for the console
+// only. Files are cut into chunks at record boundaries and processed in rounds of a few chunks per thread. The
+// output of a round is written in file order while the next round is processed, so it is the same as with one
+// thread and memory stays bounded however large the files are. The output goes to write, the console unless
+// measured by -benchmark.
+class ParallelIngest
+{
+  public:
+    using Write = void (*)(std::wstring_view output, bool binary);
+
+    ParallelIngest(PrintStyle style, FieldMask fields, std::span<const FilterRule> filters, std::size_t threads,
+                   Write write = WriteContentConsole)
+        : style_(style), fields_(fields), filter_(filters), threads_(threads), write_(write),
+          workers_(std::make_unique<Worker[]>(threads))
+    {
+        for (auto &outputs : outputs_)
+        {
+            outputs.resize(threads_ * chunksPerThread);
+        }
+    }
+
+    void Run(std::span<const std::wstring> files)
+    {
+        for (auto &path : files)
+        {
+            MappedFile file(path);
+            bytes_ += file.Size();
+            Process(GetArchiveText(file));
+        }
+        WriteRound();
+    }
+
+    // The same for text already in memory.
+    void Run(ArchiveText text)
+    {
+        bytes_ += text.narrow.size() + text.wide.size() * sizeof(char16_t);
+        Process(text);
+        WriteRound();
+    }
+
+    std::uint64_t Events() const noexcept
+    {
+        std::uint64_t events{};
+        for (std::size_t i = 0; i != threads_; ++i)
+        {
+            events += workers_[i].events;
+        }
+        return events;
+    }
+
+    std::uint64_t Bytes() const noexcept
+    {
+        return bytes_;
+    }
+
+  private:
+    static constexpr std::size_t chunkSize = 1 << 20; // code units
+    static constexpr std::size_t chunksPerThread = 4;
+
+    struct alignas(64) Worker
+    {
+        EventArena arena;
+        std::uint64_t events{};
+    };
+
+    void Process(ArchiveText text)
+    {
+        if (text.wide.empty())
+        {
+            Process(text.narrow);
+        }
+        else
+        {
+            Process(text.wide);
+        }
+    }
+
+    template <typename Char>
+    void Process(std::basic_string_view<Char> text)
+    {
+        std::vector<std::basic_string_view<Char>> chunks;
+        chunks.reserve(threads_ * chunksPerThread);
+        for (std::size_t pos = 0; pos != text.size();)
+        {
+            chunks.clear();
+            // NB: not up to the capacity, which reserve may round up
+            while (pos != text.size() && chunks.size() != threads_ * chunksPerThread)
+            {
+                chunks.push_back(NextChunk(text, pos, chunkSize));
+            }
+
+            auto &outputs = outputs_[current_];
+            auto task = [this, &chunks, &outputs](std::size_t index, std::size_t thread) {
+                outputs[index].clear();
+                ProcessChunk(chunks[index], workers_[thread], outputs[index]);
+            };
+            {
+                // NB: the previous round goes out while this one is processed
+                std::jthread writer(&ParallelIngest::WriteRound, this);
+                RunStealing(chunks.size(), threads_, task);
+            }
+            pending_ = chunks.size();
+            current_ ^= 1;
+        }
+    }
+
+    template <typename Char>
+    void ProcessChunk(std::basic_string_view<Char> chunk, Worker &worker, std::wstring &output)
+    {
+        auto &arena = worker.arena;
+        std::size_t pos = 0;
+        for (auto record = NextEventRecord(chunk, pos); !record.empty(); record = NextEventRecord(chunk, pos))
+        {
+            arena.Reset();
+            DecodeRecord(record, arena.content);
+            ++worker.events;
+            if (style_ != PrintStyle::xml)
+            {
+                ParseEventLog(arena.content, arena.eventLog, fields_ | filter_.Fields());
+                if (filter_.Admit(arena.eventLog))
+                {
+                    FormatEvent(style_, arena.eventLog, fields_, output);
+                }
+                continue;
+            }
+            if (!filter_.Empty())
+            {
+                arena.text.assign(arena.content);
+                ParseEventLog(arena.text, arena.eventLog, filter_.Fields());
+                if (!filter_.Admit(arena.eventLog))
+                {
+                    continue;
+                }
+            }
+            output += arena.content;
+        }
+    }
+
+    // Writes the outputs of the last completed round.
+    void WriteRound()
+    {
+        auto &outputs = outputs_[current_ ^ 1];
+        for (std::size_t i = 0; i != pending_; ++i)
+        {
+            write_(outputs[i], style_ == PrintStyle::binary);
+        }
+        pending_ = 0;
+    }
+
+    PrintStyle style_;
+    FieldMask fields_;
+    EventFilter filter_;
+    std::size_t threads_;
+    Write write_;
+    std::unique_ptr<Worker[]> workers_;
+    std::vector<std::wstring> outputs_[2];
+    std::size_t current_{};
+    std::size_t pending_{};
+    std::uint64_t bytes_{};
+};
+
+} // namespace bizwen
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "bookmark.hpp"
+#include "bounded_queue.hpp"
+#include "event_filter.hpp"
+#include "event_source.hpp"
+#include "options.hpp"
+
+namespace bizwen
+{
+
+struct BackfillEvent
+{
+    EVT_HANDLE hEvent{};
+    std::wstring content; // rendered XML
+};
+
+// Replays history split into consecutive time slices that are read concurrently, one thread each. A reader
+// renders the events of its slice in order into the queue of the slice, Next drains the slices one after
+// another so that the events come out in the order of the log. A reader blocks once its queue is full, which
+// bounds what is held ahead of the slice being consumed.
+class BackfillSource final : public EventSource
+{
+  public:
+    // Produces the events of a slice, returning early once a stop is requested.
+    using SliceReader =
+        std::function<void(std::size_t slice, std::stop_token token, BoundedQueue<BackfillEvent> &queue)>;
+
+    BackfillSource(std::size_t slices, std::size_t capacity, SliceReader reader, BookmarkStore *bookmark = nullptr)
+        : bookmark_(bookmark)
+    {
+        slices_.reserve(slices);
+        for (std::size_t i = 0; i != slices; ++i)
+        {
+            auto &slice = *slices_.emplace_back(std::make_unique<Slice>(capacity));
+            slice.thread = std::jthread([&slice, reader, i](std::stop_token token) {
+                reader(i, token, slice.queue);
+                slice.queue.Close();
+            });
+        }
+    }
+
+    BackfillSource(const BackfillSource &) = delete;
+    BackfillSource &operator=(const BackfillSource &) = delete;
+
+    ~BackfillSource()
+    {
+        for (auto &slice : slices_)
+        {
+            slice->thread.request_stop();
+        }
+        // NB: draining makes room for readers blocked on a full queue, so they get to see the stop
+        for (auto &slice : slices_)
+        {
+            BackfillEvent event;
+            while (slice->queue.Pop(event))
+            {
+                if (event.hEvent != nullptr)
+                {
+                    ::EvtClose(event.hEvent);
+                }
+            }
+        }
+    }
+
+    std::size_t Next(std::span<EventArena *const> batch) override
+    {
+        std::size_t count = 0;
+        EVT_HANDLE hLast{};
+        BackfillEvent event;
+        while (count != batch.size() && current_ != slices_.size())
+        {
+            if (!slices_[current_]->queue.Pop(event))
+            {
+                ++current_;
+                continue;
+            }
+
+            batch[count++]->content.swap(event.content);
+            if (event.hEvent != nullptr)
+            {
+                if (hLast != nullptr)
+                {
+                    ::EvtClose(hLast);
+                }
+                hLast = event.hEvent;
+            }
+        }
+
+        if (hLast != nullptr)
+        {
+            if (bookmark_ != nullptr)
+            {
+                bookmark_->Update(hLast, count);
+            }
+            ::EvtClose(hLast);
+        }
+        return count;
+    }
+
+  private:
+    struct Slice
+    {
+        explicit Slice(std::size_t capacity) : queue(capacity)
+        {
+        }
+
+        BoundedQueue<BackfillEvent> queue;
+        std::jthread thread;
+    };
+
+    BookmarkStore *bookmark_;
+    std::vector<std::unique_ptr<Slice>> slices_;
+    std::size_t current_{};
+};
+
+// Reads the errors of the channel created in [from, to) oldest first, see ErrorQuery.
+inline void QueryErrors(LPCWSTR channel, std::uint64_t from, std::uint64_t to, std::span<const FilterRule> filters,
+                        bool related, std::stop_token token, BoundedQueue<BackfillEvent> &queue)
+{
+    auto hQuery = ::EvtQuery(nullptr, channel, ErrorQuery(from, to, filters, related).c_str(),
+                             EvtQueryChannelPath | EvtQueryForwardDirection);
+    if (hQuery == nullptr)
+    {
+        std::terminate();
+    }
+
+    EVT_HANDLE hEvents[16];
+    DWORD dwReturned = 0;
+    while (!token.stop_requested() &&
+           ::EvtNext(hQuery, static_cast<DWORD>(std::size(hEvents)), hEvents, INFINITE, 0, &dwReturned))
+    {
+        for (DWORD i = 0; i != dwReturned; ++i)
+        {
+            BackfillEvent event{hEvents[i], {}};
+            PrintEvent(event.hEvent, event.content);
+            queue.Push(std::move(event));
+        }
+    }
+    if (!token.stop_requested() && ::GetLastError() != ERROR_NO_MORE_ITEMS)
+    {
+        std::terminate();
+    }
+    ::EvtClose(hQuery);
+}
+
+// Starts replaying the errors of the last -since seconds unless the bookmark resumes an earlier run, returns
+// null when there is nothing to replay. since receives the start of the replay for SubscribeEvent. The backfill
+// moves the bookmark along as it is collected, so the subscription started once it is drained begins right
+// after the last replayed event and nothing is delivered twice. A channel with a query of its own is not replayed.
+inline std::unique_ptr<BackfillSource> StartBackfill(const ChannelQuery &channel, const Options &options,
+                                                     BookmarkStore &bookmark, std::uint64_t &since)
+{
+    since = 0;
+    if (options.sinceSeconds == 0 || !channel.query.empty() || bookmark.Positioned())
+    {
+        return nullptr;
+    }
+
+    auto now = FileTimeNow();
+    since = now - options.sinceSeconds * 10'000'000ull;
+    std::size_t slices = std::clamp(std::thread::hardware_concurrency(), 1u, 8u);
+    auto width = (now - since) / slices;
+    return std::make_unique<BackfillSource>(
+        slices, options.queueSize,
+        [since, slices, width, name = channel.channel.c_str(), filters = std::span(options.filters),
+         related = Correlating(options)](std::size_t slice, std::stop_token token,
+                                         BoundedQueue<BackfillEvent> &queue) {
+            // NB: the last slice is open so that it reaches up to the time of its query
+            auto from = since + slice * width;
+            QueryErrors(name, from, slice + 1 == slices ? 0 : from + width, filters, related, token, queue);
+        },
+        &bookmark);
+}
+
+} // namespace bizwen
@@ -0,0 +1,400 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "archive.hpp"
+#include "event_filter.hpp"
+#include "event_format.hpp"
+#include "event_output.hpp"
+#include "event_parser.hpp"
+#include "history.hpp"
+#include "toast_batcher.hpp"
+#include "utf8.hpp"
+
+namespace bizwen
+{
+
+using namespace std::literals;
+
+// Heap allocations made by the calling thread. Only the test and apperrnotitool_benchmark replace the global
+// operator new to count them and set allocationsCounted, the tool itself leaves the allocator alone and its
+// -benchmark reports no allocations.
+inline thread_local std::uint64_t allocations;
+inline thread_local std::uint64_t allocatedBytes;
+inline bool allocationsCounted{};
+
+// splitmix64, so that every -benchmark run measures the same corpus.
+class CorpusRandom
+{
+  public:
+    std::uint64_t Next() noexcept
+    {
+        auto z = (state_ += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        return z ^ (z >> 31);
+    }
+
+    std::size_t Below(std::size_t bound) noexcept
+    {
+        return static_cast<std::size_t>(Next() % bound);
+    }
+
+    template <typename T, std::size_t N>
+    const T &Pick(const T (&items)[N]) noexcept
+    {
+        return items[Below(N)];
+    }
+
+  private:
+    std::uint64_t state_{};
+};
+
+// Application Error events as EvtRenderEventXml renders them, with names and paths of varying length, non-ASCII
+// text, characters that need escaping and, for every fourth event, the fields of a packaged app.
+inline std::vector<std::wstring> GenerateCorpus(std::size_t count)
+{
+    constexpr std::wstring_view apps[]{L"explorer.exe"sv,           L"notepad++.exe"sv,
+                                       L"Tom & Jerry's Game.exe"sv, L"caf\u00e9-client.exe"sv,
+                                       L"\u30c6\u30b9\u30c8.exe"sv, L"\u0437\u0430\u043f\u0443\u0441\u043a.exe"sv};
+    constexpr std::wstring_view modules[]{L"ntdll.dll"sv, L"KERNELBASE.dll"sv, L"ucrtbase.dll"sv,
+                                          L"<unknown>.dll"sv, L"\u6a21\u5757.dll"sv};
+    constexpr std::wstring_view directories[]{L"C:\\Program Files\\"sv,
+                                              L"C:\\Users\\Jos\u00e9 M\u00fcller\\AppData\\"sv,
+                                              L"D:\\\u5de5\u5177\\\u6d4b\u8bd5 & \u8c03\u8bd5\\"sv,
+                                              L"C:\\Windows\\System32\\"sv};
+    constexpr std::wstring_view packages[]{L"Microsoft.WindowsCalculator_11.2307.4.0_x64__8wekyb3d8bbwe"sv,
+                                           L"Microsoft.WindowsTerminal_1.18.2822.0_x64__8wekyb3d8bbwe"sv};
+    constexpr std::wstring_view codes[]{L"c0000005"sv, L"c0000409"sv, L"80000003"sv, L"e0434352"sv};
+
+    CorpusRandom random;
+    std::vector<std::wstring> corpus(count);
+    std::wstring value;
+    for (std::size_t i = 0; i != count; ++i)
+    {
+        auto &xml = corpus[i];
+        auto data = [&xml](std::wstring_view name, std::wstring_view text) {
+            xml += L"<Data Name='"sv;
+            xml += name;
+            xml += L"'>"sv;
+            AppendXmlEscaped(text, xml);
+            xml += L"</Data>"sv;
+        };
+        auto number = [&value](std::uint64_t number, unsigned base = 10, std::wstring_view prefix = {}) {
+            value = prefix;
+            AppendNumber(number, value, base);
+            return std::wstring_view(value);
+        };
+
+        xml += L"<Event xmlns='http://schemas.microsoft.com/win/2004/08/events/event'><System><Provider "
+               L"Name='Application Error'/><EventID Qualifiers='0'>1000</EventID><Version>0</Version><Level>2</Level>"
+               L"<Task>100</Task><Opcode>0</Opcode><Keywords>0x80000000000000</Keywords><TimeCreated SystemTime='"sv;
+        AppendFileTime(133'800'000'000'000'000 + i * 10'000'000 + random.Below(10'000'000), xml);
+        xml += L"'/><EventRecordID>"sv;
+        AppendNumber(100'000 + i, xml);
+        xml += L"</EventRecordID><Correlation/><Execution ProcessID='0' ThreadID='0'/><Channel>Application</Channel>"
+               L"<Computer>workstation.corp.example.com</Computer><Security UserID='S-1-5-21-"sv;
+        AppendNumber(random.Next() % 4'000'000'000, xml);
+        xml += L"-1001'/></System><EventData>"sv;
+
+        // a random run of suffix characters varies the field sizes
+        auto app = random.Pick(apps);
+        value = app.substr(0, app.size() - 4);
+        value.append(random.Below(24), L'x');
+        value += app.substr(app.size() - 4);
+        auto appName = value;
+        data(L"AppName"sv, appName);
+        value = L"10.0."sv;
+        AppendNumber(random.Below(30'000), value);
+        value += L'.';
+        AppendNumber(random.Below(5'000), value);
+        data(L"AppVersion"sv, value);
+        data(L"AppTimeStamp"sv, number(random.Next() & 0xffffffff, 16));
+        auto moduleName = std::wstring(random.Pick(modules));
+        data(L"ModuleName"sv, moduleName);
+        data(L"ModuleVersion"sv, L"10.0.22621.3007"sv);
+        data(L"ModuleTimeStamp"sv, number(random.Next() & 0xffffffff, 16));
+        data(L"ExceptionCode"sv, random.Pick(codes));
+        data(L"FaultingOffset"sv, number(random.Next() & 0xffffffffff, 16, L"0x"sv));
+        data(L"ProcessId"sv, number(random.Below(65536), 16, L"0x"sv));
+        data(L"ProcessCreationTime"sv, number(random.Next() >> 8, 16, L"0x"sv));
+        value = random.Pick(directories);
+        value.append(random.Below(48), L'd');
+        value += L'\\';
+        value += appName;
+        data(L"AppPath"sv, value);
+        value = L"C:\\Windows\\System32\\"sv;
+        value += moduleName;
+        data(L"ModulePath"sv, value);
+        value = number(random.Next() & 0xffffffff, 16);
+        value += L"-4c1e-4f2d-9a3b-"sv;
+        AppendNumber(random.Next() & 0xffffffffffff, value, 16, 12);
+        data(L"IntegratorReportId"sv, value);
+        bool packaged = i % 4 == 0;
+        data(L"PackageFullName"sv, packaged ? random.Pick(packages) : L""sv);
+        data(L"PackageRelativeAppId"sv, packaged ? L"App"sv : L""sv);
+        xml += L"</EventData></Event>"sv;
+    }
+    return corpus;
+}
+
+struct BenchmarkResult
+{
+    std::wstring_view stage;
+    std::uint64_t nanoseconds; // per event, best round
+    std::uint64_t allocations; // per 1000 events, over all rounds
+    std::uint64_t allocatedBytes; // per event, over all rounds
+};
+
+// Times work(i) for every event of the corpus over several rounds and keeps the fastest round, allocations are
+// averaged over all rounds so that buffers growing in the first round show up as a fraction.
+template <typename Work>
+BenchmarkResult MeasureStage(std::wstring_view stage, std::size_t events, Work &&work)
+{
+    constexpr std::size_t rounds = 5;
+    auto best = Clock::duration::max();
+    auto allocationsBefore = allocations;
+    auto bytesBefore = allocatedBytes;
+    for (std::size_t round = 0; round != rounds; ++round)
+    {
+        auto start = Clock::now();
+        for (std::size_t i = 0; i != events; ++i)
+        {
+            work(i);
+        }
+        best = std::min(best, Clock::now() - start);
+    }
+
+    auto total = static_cast<std::uint64_t>(events * rounds);
+    return {stage, static_cast<std::uint64_t>(std::chrono::nanoseconds(best).count()) / events,
+            (allocations - allocationsBefore) * 1000 / total, (allocatedBytes - bytesBefore) / total};
+}
+
+// Per-event cost of the stages every event goes through: copying the rendered XML into the arena and parsing it,
+// formatting the full and the minimal text, and preparing the shared output for the console, MessageBox and
+// notification sinks, and filling the toast template; the cost of appending an event to the history and of
+// counting one row of it; and -ingest of the corpus as an export with -jobs=1, 2, 4 and so on up to the hardware
+// threads, which shows how it scales. The sinks themselves are left out since they block on the console and the
+// desktop.
+inline std::vector<BenchmarkResult> RunBenchmark()
+{
+    constexpr std::size_t events = 20'000;
+    auto corpus = GenerateCorpus(events);
+    auto arenas = std::make_unique<EventArena[]>(events);
+
+    std::vector<BenchmarkResult> results;
+    results.push_back(MeasureStage(L"parse"sv, events, [&](std::size_t i) {
+        auto &arena = arenas[i];
+        arena.Reset();
+        arena.content.assign(corpus[i]);
+        ParseEventLog(arena.content, arena.eventLog);
+    }));
+    results.push_back(MeasureStage(L"parseMinimal"sv, events, [&](std::size_t i) {
+        auto &arena = arenas[i];
+        arena.Reset();
+        arena.content.assign(corpus[i]);
+        ParseEventLog(arena.content, arena.eventLog, minimalFields);
+    }));
+    // NB: every later stage formats all fields, so they are parsed again
+    for (std::size_t i = 0; i != events; ++i)
+    {
+        arenas[i].Reset();
+        arenas[i].content.assign(corpus[i]);
+        ParseEventLog(arenas[i].content, arenas[i].eventLog);
+    }
+    results.push_back(MeasureStage(L"format"sv, events, [&](std::size_t i) {
+        arenas[i].text.clear();
+        FormatEventLog(arenas[i].eventLog, allFields, arenas[i].text);
+    }));
+    results.push_back(MeasureStage(L"formatMinimal"sv, events, [&](std::size_t i) {
+        arenas[i].minimalText.clear();
+        FormatEventLog(arenas[i].eventLog, minimalFields, arenas[i].minimalText);
+    }));
+    results.push_back(MeasureStage(L"formatJsonl"sv, events, [&](std::size_t i) {
+        arenas[i].text.clear();
+        FormatEventJson(arenas[i].eventLog, allFields, arenas[i].text);
+    }));
+    results.push_back(MeasureStage(L"formatBinary"sv, events, [&](std::size_t i) {
+        arenas[i].text.clear();
+        FormatEventBinary(arenas[i].eventLog, allFields, arenas[i].text);
+    }));
+
+    // NB: a contains, a prefix and a glob include and an exact exclude, about two events in five pass
+    std::vector<FilterRule> rules{{false, L"AppName"s, L"*client*"s},
+                                  {false, L"AppName"s, L"explorer*"s},
+                                  {false, L"AppName"s, L"notepad++*.exe"s},
+                                  {true, L"ModuleName"s, L"ntdll.dll"s}};
+    EventFilter filter(rules);
+    std::size_t admitted{};
+    results.push_back(MeasureStage(L"filter"sv, events, [&](std::size_t i) {
+        admitted += filter.Admit(arenas[i].eventLog);
+    }));
+
+    // NB: transcodes the whole XML, the largest payload any output writes
+    std::string bytes;
+    results.push_back(MeasureStage(L"utf8"sv, events, [&](std::size_t i) {
+        bytes.clear();
+        AppendUtf8(corpus[i], bytes);
+    }));
+    // NB: outside Windows this includes encoding the UTF-32 text as UTF-16 first
+    std::u16string units;
+    results.push_back(MeasureStage(L"utf8Scalar"sv, events, [&](std::size_t i) {
+        bytes.clear();
+        AppendUtf8(AsUtf16(corpus[i], units), bytes, TranscodeScalar);
+    }));
+
+    auto method = PrintMethod::console;
+    method |= PrintMethod::messagebox;
+    method |= PrintMethod::notification;
+    results.push_back(MeasureStage(L"dispatch"sv, events, [&](std::size_t i) {
+        auto &arena = arenas[i];
+        arena.text.clear();
+        arena.minimalText.clear();
+        EventOutput output(arena);
+        output.Reset(&arena.eventLog);
+        output.Prepare(method);
+    }));
+
+    // NB: the clock advances by a window per event, so each one is a burst of its own and fills the template
+    ToastBatcher toasts(toastWindow);
+    Clock::time_point now{};
+    std::size_t toastBytes{};
+    results.push_back(MeasureStage(L"toast"sv, events, [&](std::size_t i) {
+        now += toastWindow;
+        toasts.Add(arenas[i].minimalText, now, [&](std::wstring_view xml, std::wstring_view) {
+            toastBytes += xml.size();
+        });
+    }));
+
+    // NB: the history is a temporary file, the query counts every row appended over all rounds
+    auto historyFile = std::filesystem::temp_directory_path() / L"apperrnotitool-benchmark.history";
+    std::filesystem::remove(historyFile);
+    {
+        HistoryWriter writer(historyFile, allFields);
+        results.push_back(MeasureStage(L"historyAppend"sv, events, [&](std::size_t i) {
+            writer.Append(arenas[i].eventLog, ParseFileTime(arenas[i].eventLog.systemTime));
+        }));
+    }
+    {
+        HistoryReader history(historyFile);
+        HistoryGroups groups;
+        auto query = MeasureStage(L"historyQuery"sv, 1, [&](std::size_t) {
+            groups.counts.clear();
+            groups.events = groups.matched = 0;
+            AggregateHistory(history, FieldBit(L"AppName"sv) | FieldBit(L"ModuleName"sv), 0, groups);
+        });
+        // one query per round, reported per row like the other stages are per event
+        auto rows = std::max<std::uint64_t>(groups.events, 1);
+        query.nanoseconds /= rows;
+        query.allocations /= rows;
+        query.allocatedBytes /= rows;
+        results.push_back(query);
+    }
+    std::filesystem::remove(historyFile);
+
+    // NB: the output is dropped, writing it is the console sink's cost
+    std::string archive;
+    for (auto &xml : corpus)
+    {
+        AppendUtf8(xml, archive);
+        archive += "\r\n"sv;
+    }
+    constexpr std::wstring_view ingestStages[]{L"ingest1"sv,  L"ingest2"sv,  L"ingest4"sv, L"ingest8"sv,
+                                               L"ingest16"sv, L"ingest32"sv, L"ingest64"sv};
+    auto hardwareThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    for (std::size_t i = 0; i != std::size(ingestStages) && std::size_t{1} << i <= hardwareThreads; ++i)
+    {
+        ParallelIngest ingest(PrintStyle::text, allFields, {}, std::size_t{1} << i, [](std::wstring_view, bool) {});
+        auto stage = MeasureStage(ingestStages[i], 1, [&](std::size_t) { ingest.Run({archive, {}}); });
+        // one pass over the corpus per round, reported per event
+        stage.nanoseconds /= events;
+        stage.allocations /= events;
+        stage.allocatedBytes /= events;
+        results.push_back(stage);
+    }
+    return results;
+}
+
+inline std::string BenchmarkJson(std::span<const BenchmarkResult> results)
+{
+    std::wstring json = L"{\"stages\":["s;
+    for (auto &result : results)
+    {
+        if (&result != results.data())
+        {
+            json += L',';
+        }
+        json += L"\n{\"name\":\""sv;
+        json += result.stage;
+        json += L"\",\"nsPerEvent\":"sv;
+        AppendNumber(result.nanoseconds, json);
+        json += L",\"eventsPerSecond\":"sv;
+        AppendNumber(1'000'000'000 / std::max<std::uint64_t>(result.nanoseconds, 1), json);
+        if (allocationsCounted)
+        {
+            json += L",\"allocationsPer1000Events\":"sv;
+            AppendNumber(result.allocations, json);
+            json += L",\"bytesAllocatedPerEvent\":"sv;
+            AppendNumber(result.allocatedBytes, json);
+        }
+        json += L'}';
+    }
+    json += L"\n]}\n"sv;
+    // NB: ASCII only
+    return std::string(json.begin(), json.end());
+}
+
+// Compares with the nsPerEvent of the same stages in an earlier BenchmarkJson, a stage more than 10% slower is a
+// regression. Reports every stage and returns whether all of them passed.
+inline bool CheckBaseline(std::span<const BenchmarkResult> results, const std::filesystem::path &path,
+                          std::wstring &report)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        std::terminate();
+    }
+    std::string baseline((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    bool passed = true;
+    for (auto &result : results)
+    {
+        auto name = "\"name\":\""s;
+        name.append(result.stage.begin(), result.stage.end());
+        name += '"';
+        auto pos = baseline.find(name);
+        auto field = "\"nsPerEvent\":"sv;
+        if (pos == baseline.npos || (pos = baseline.find(field, pos)) == baseline.npos)
+        {
+            continue;
+        }
+
+        std::uint64_t before{};
+        for (pos += field.size(); pos != baseline.size() && baseline[pos] >= '0' && baseline[pos] <= '9'; ++pos)
+        {
+            before = before * 10 + static_cast<std::uint64_t>(baseline[pos] - '0');
+        }
+        bool regressed = result.nanoseconds * 10 > before * 11;
+        passed = passed && !regressed;
+
+        report += result.stage;
+        report += L": "sv;
+        AppendNumber(before, report);
+        report += L" -> "sv;
+        AppendNumber(result.nanoseconds, report);
+        report += regressed ? L" ns/event, regressed\n"sv : L" ns/event\n"sv;
+    }
+    return passed;
+}
+
+} // namespace bizwen
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <utility>
+
+#include "event_render.hpp"
+#include "text.hpp"
+
+namespace bizwen
+{
+
+using namespace std::literals;
+
+// The bookmark is written after this many events or this long after the oldest unwritten one, so that the disk
+// is touched once per batch rather than once per event.
+constexpr std::uint32_t checkpointEvents = 64;
+constexpr auto checkpointInterval = 5s;
+
+class CheckpointPolicy
+{
+  public:
+    CheckpointPolicy(std::uint32_t events, Clock::duration interval, Clock::time_point now) noexcept
+        : events_(events), interval_(interval), last_(now)
+    {
+    }
+
+    // Accounts for count more events and returns whether a checkpoint is due.
+    bool Advance(std::size_t count, Clock::time_point now) noexcept
+    {
+        pending_ += count;
+        return pending_ >= events_ || (pending_ != 0 && now - last_ >= interval_);
+    }
+
+    bool Pending() const noexcept
+    {
+        return pending_ != 0;
+    }
+
+    void Done(Clock::time_point now) noexcept
+    {
+        pending_ = 0;
+        last_ = now;
+    }
+
+  private:
+    std::uint64_t events_;
+    Clock::duration interval_;
+    Clock::time_point last_;
+    std::uint64_t pending_{};
+};
+
+// The position in the channel up to which events were handed to the pipeline. With a file it survives restarts,
+// events still queued in the pipeline when the process dies are not replayed. Without a file it only carries
+// the position from the backfill over to the subscription.
+class BookmarkStore
+{
+  public:
+    explicit BookmarkStore(std::filesystem::path path)
+        : path_(std::move(path)), policy_(checkpointEvents, checkpointInterval, Clock::now())
+    {
+        if (!path_.empty())
+        {
+            std::ifstream file(path_, std::ios::binary | std::ios::ate);
+            if (file.is_open())
+            {
+                xml_.resize(static_cast<std::size_t>(file.tellg()) / sizeof(wchar_t));
+                file.seekg(0);
+                file.read(reinterpret_cast<char *>(xml_.data()),
+                          static_cast<std::streamsize>(xml_.size() * sizeof(wchar_t)));
+            }
+        }
+
+        if (!xml_.empty())
+        {
+            hBookmark_ = ::EvtCreateBookmark(xml_.c_str());
+            positioned_ = hBookmark_ != nullptr;
+        }
+        // a damaged file starts over
+        if (hBookmark_ == nullptr)
+        {
+            hBookmark_ = ::EvtCreateBookmark(nullptr);
+        }
+        if (hBookmark_ == nullptr)
+        {
+            std::terminate();
+        }
+    }
+
+    BookmarkStore(const BookmarkStore &) = delete;
+    BookmarkStore &operator=(const BookmarkStore &) = delete;
+
+    ~BookmarkStore()
+    {
+        ::EvtClose(hBookmark_);
+    }
+
+    EVT_HANDLE Handle() const noexcept
+    {
+        return hBookmark_;
+    }
+
+    // Whether the bookmark refers to an event, either loaded from the file or updated since.
+    bool Positioned() const noexcept
+    {
+        return positioned_;
+    }
+
+    // Moves the bookmark to hEvent, the last of count events, and writes it when a checkpoint is due.
+    void Update(EVT_HANDLE hEvent, std::size_t count)
+    {
+        if (!::EvtUpdateBookmark(hBookmark_, hEvent))
+        {
+            std::terminate();
+        }
+        positioned_ = true;
+
+        auto now = Clock::now();
+        if (policy_.Advance(count, now))
+        {
+            Save(now);
+        }
+    }
+
+    // Writes the position if it moved since the last checkpoint, used when idle and on exit.
+    void Checkpoint()
+    {
+        if (policy_.Pending())
+        {
+            Save(Clock::now());
+        }
+    }
+
+  private:
+    void Save(Clock::time_point now)
+    {
+        policy_.Done(now);
+        if (path_.empty())
+        {
+            return;
+        }
+
+        PrintEvent(hBookmark_, xml_, EvtRenderBookmark);
+
+        // NB: written aside and renamed, so a crash never leaves a truncated bookmark behind
+        auto temp = path_;
+        temp += L".tmp"sv;
+        {
+            std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+            if (!file.write(reinterpret_cast<const char *>(xml_.data()),
+                            static_cast<std::streamsize>(xml_.size() * sizeof(wchar_t))))
+            {
+                std::terminate();
+            }
+        }
+        if (!::MoveFileExW(temp.c_str(), path_.c_str(), MOVEFILE_REPLACE_EXISTING))
+        {
+            std::terminate();
+        }
+    }
+
+    std::filesystem::path path_;
+    CheckpointPolicy policy_;
+    EVT_HANDLE hBookmark_{};
+    std::wstring xml_;
+    bool positioned_ = false;
+};
+
+} // namespace bizwen
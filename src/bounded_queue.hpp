@@ -0,0 +1,193 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <utility>
+
+namespace bizwen
+{
+
+// Bounded lock-free multi-producer multi-consumer queue after Dmitry Vyukov's design. Push blocks until there is
+// room, Pop blocks until an element arrives or the queue is closed.
+template <typename T>
+class BoundedQueue
+{
+  public:
+    explicit BoundedQueue(std::size_t capacity)
+        : mask_(std::bit_ceil(std::max<std::size_t>(capacity, 2)) - 1), cells_(std::make_unique<Cell[]>(mask_ + 1))
+    {
+        for (std::size_t i = 0; i <= mask_; ++i)
+        {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool TryPush(T value) noexcept
+    {
+        return TryMove(value);
+    }
+
+    bool TryPop(T &value) noexcept
+    {
+        auto pos = dequeuePos_.load(std::memory_order_relaxed);
+        while (true)
+        {
+            auto &cell = cells_[pos & mask_];
+            auto diff = static_cast<std::ptrdiff_t>(cell.sequence.load(std::memory_order_acquire) - (pos + 1));
+            if (diff == 0)
+            {
+                if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    value = std::move(cell.value);
+                    cell.sequence.store(pos + mask_ + 1, std::memory_order_release);
+                    room_.fetch_add(1, std::memory_order_release);
+                    room_.notify_one();
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false; // empty
+            }
+            else
+            {
+                pos = dequeuePos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void Push(T value) noexcept
+    {
+        while (true)
+        {
+            auto room = room_.load(std::memory_order_acquire);
+            if (TryMove(value))
+            {
+                return;
+            }
+            room_.wait(room, std::memory_order_acquire);
+        }
+    }
+
+    // Returns false once the queue is closed and drained.
+    bool Pop(T &value) noexcept
+    {
+        while (true)
+        {
+            auto signal = signal_.load(std::memory_order_acquire);
+            if (TryPop(value))
+            {
+                return true;
+            }
+            if (closed_.load(std::memory_order_acquire))
+            {
+                return TryPop(value);
+            }
+            signal_.wait(signal, std::memory_order_acquire);
+        }
+    }
+
+    void Close() noexcept
+    {
+        closed_.store(true, std::memory_order_release);
+        signal_.fetch_add(1, std::memory_order_release);
+        signal_.notify_all();
+    }
+
+  private:
+    // Moves value into the queue only when there is room, so a failed attempt can be retried with it.
+    bool TryMove(T &value) noexcept
+    {
+        auto pos = enqueuePos_.load(std::memory_order_relaxed);
+        while (true)
+        {
+            auto &cell = cells_[pos & mask_];
+            auto diff = static_cast<std::ptrdiff_t>(cell.sequence.load(std::memory_order_acquire) - pos);
+            if (diff == 0)
+            {
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.value = std::move(value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    signal_.fetch_add(1, std::memory_order_release);
+                    signal_.notify_one();
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false; // full
+            }
+            else
+            {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    struct Cell
+    {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    std::size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+    alignas(64) std::atomic<std::size_t> enqueuePos_{};
+    alignas(64) std::atomic<std::size_t> dequeuePos_{};
+    alignas(64) std::atomic<std::uint32_t> signal_{};
+    alignas(64) std::atomic<std::uint32_t> room_{};
+    std::atomic<bool> closed_{};
+};
+
+// Round-robin turns for the subscriptions whose events are signaled, from any thread. A subscription is queued
+// at most once, and one that still has events after its turn goes to the back, behind every subscription
+// signaled meanwhile, so a noisy channel delays each of the others by one turn at most.
+class ReadyQueue
+{
+  public:
+    explicit ReadyQueue(std::size_t count)
+        : count_(count), queued_(std::make_unique<std::atomic<bool>[]>(count)), ready_(count)
+    {
+    }
+
+    // Returns whether this call queued the subscription, in which case the collector must be woken.
+    bool Signal(std::size_t index) noexcept
+    {
+        if (queued_[index].exchange(true, std::memory_order_acq_rel))
+        {
+            return false;
+        }
+        // NB: cannot fail, there is a cell for every subscription
+        ready_.TryPush(index);
+        return true;
+    }
+
+    // Gives up to one turn to each subscription queued, turn(index) returns whether it has events left. Returns
+    // whether any subscription was queued again, the collector must then come back without waiting.
+    template <typename Turn>
+    bool Run(Turn &&turn)
+    {
+        bool requeued = false;
+        std::size_t index;
+        for (std::size_t i = 0; i != count_ && ready_.TryPop(index); ++i)
+        {
+            // NB: cleared before the turn, so a signal during it is not lost
+            queued_[index].store(false, std::memory_order_release);
+            if (turn(index))
+            {
+                requeued = Signal(index) || requeued;
+            }
+        }
+        return requeued;
+    }
+
+  private:
+    std::size_t count_;
+    std::unique_ptr<std::atomic<bool>[]> queued_;
+    BoundedQueue<std::size_t> ready_;
+};
+
+} // namespace bizwen
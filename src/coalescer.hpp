@@ -0,0 +1,270 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "event_log.hpp"
+#include "text.hpp"
+
+namespace bizwen
+{
+
+using namespace std::literals;
+
+// Folds repeated faults with the same AppName, ModuleName, ExceptionCode and FaultingOffset. The first fault of
+// a signature passes, later ones within the window are only counted and reported as one summary per window.
+// The table has a fixed number of entries, when it is full the signature with the oldest window is evicted
+// after emitting its pending summary, so memory stays bounded however many distinct signatures arrive.
+class FaultCoalescer
+{
+  public:
+    static constexpr FieldMask signatureFields = FieldBit(L"AppName"sv) | FieldBit(L"ModuleName"sv) |
+                                                 FieldBit(L"ExceptionCode"sv) | FieldBit(L"FaultingOffset"sv);
+
+    FaultCoalescer(std::size_t capacity, std::chrono::seconds window)
+        : window_(window), entries_(capacity), buckets_(std::bit_ceil(capacity * 2), none)
+    {
+    }
+
+    // Returns false when the event was folded into the pending summary of its signature. emit receives the
+    // text of a summary and returns false if it cannot be delivered right now.
+    template <typename Emit>
+    bool Admit(const EventLog &eventLog, Clock::time_point now, Emit &&emit)
+    {
+        key_.clear();
+        for (auto field : {eventLog.appName, eventLog.moduleName, eventLog.exceptionCode, eventLog.faultingOffset})
+        {
+            key_ += field;
+            key_ += L'\0';
+        }
+        auto hash = std::hash<std::wstring_view>{}(key_);
+        auto &bucket = buckets_[hash & (buckets_.size() - 1)];
+
+        for (auto index = bucket; index != none; index = entries_[index].chain)
+        {
+            auto &entry = entries_[index];
+            if (entry.hash == hash && entry.key == key_)
+            {
+                if (now - entry.windowStart >= window_)
+                {
+                    // an idle signature faults again, deliver it as a first occurrence
+                    if (entry.suppressed != 0 && !Summarize(entry, now, emit))
+                    {
+                        Suppress(entry, eventLog);
+                        return false;
+                    }
+                    Restart(index, now);
+                    return true;
+                }
+                Suppress(entry, eventLog);
+                return false;
+            }
+        }
+
+        std::uint32_t index;
+        if (free_ != none)
+        {
+            index = free_;
+            free_ = entries_[index].chain;
+        }
+        else if (size_ != entries_.size())
+        {
+            index = size_++;
+        }
+        else
+        {
+            index = head_;
+            auto &oldest = entries_[index];
+            if (oldest.suppressed != 0 && !Summarize(oldest, now, emit))
+            {
+                lost_ += oldest.suppressed;
+            }
+            Unlink(index);
+        }
+
+        auto &entry = entries_[index];
+        entry.key.assign(key_);
+        entry.hash = hash;
+        entry.suppressed = 0;
+        entry.pidCount = 0;
+        entry.morePids = false;
+        entry.chain = bucket;
+        bucket = index;
+        entry.windowStart = now;
+        Append(index);
+        return true;
+    }
+
+    // Emits the summaries of every signature whose window has elapsed and forgets the idle ones.
+    template <typename Emit>
+    void Flush(Clock::time_point now, Emit &&emit)
+    {
+        // entries are ordered by the start of their window and every expired one leaves the front, either to the
+        // tail with a new window or to the free list, so only the expired front is visited
+        while (head_ != none && now - entries_[head_].windowStart >= window_)
+        {
+            auto index = head_;
+            auto &entry = entries_[index];
+            if (entry.suppressed == 0)
+            {
+                // NB: the next fault of the signature is a first occurrence either way
+                Unlink(index);
+                entry.chain = free_;
+                free_ = index;
+                continue;
+            }
+            if (!Summarize(entry, now, emit))
+            {
+                return;
+            }
+            Restart(index, now);
+        }
+    }
+
+    // Suppressed faults whose summary could not be delivered before their signature was evicted.
+    std::uint64_t Lost() const noexcept
+    {
+        return lost_;
+    }
+
+  private:
+    static constexpr std::uint32_t none = std::numeric_limits<std::uint32_t>::max();
+
+    struct Entry
+    {
+        std::wstring key; // the signature fields, each terminated by L'\0'
+        std::size_t hash{};
+        std::uint32_t chain = none; // next entry in the same bucket, or in the free list
+        std::uint32_t prev = none;  // neighbours in window order
+        std::uint32_t next = none;
+        Clock::time_point windowStart;
+        std::uint64_t suppressed{};
+        std::uint32_t pids[8]{};
+        std::uint32_t pidCount{};
+        bool morePids{}; // a PID came that did not fit into pids
+    };
+
+    void Suppress(Entry &entry, const EventLog &eventLog) noexcept
+    {
+        ++entry.suppressed;
+        auto pid = static_cast<std::uint32_t>(ParseEventNumber(eventLog.processId));
+        if (std::find(entry.pids, entry.pids + entry.pidCount, pid) != entry.pids + entry.pidCount)
+        {
+            return;
+        }
+        if (entry.pidCount != std::size(entry.pids))
+        {
+            entry.pids[entry.pidCount++] = pid;
+        }
+        else
+        {
+            entry.morePids = true;
+        }
+    }
+
+    template <typename Emit>
+    bool Summarize(Entry &entry, Clock::time_point now, Emit &emit)
+    {
+        // AppName: ...\nModuleName: ...\nExceptionCode: ...\nFaultingOffset: ...\nN more in last T seconds, PIDs ...
+        constexpr std::wstring_view names[]{L"AppName"sv, L"ModuleName"sv, L"ExceptionCode"sv, L"FaultingOffset"sv};
+
+        summary_.clear();
+        std::wstring_view key = entry.key;
+        for (auto name : names)
+        {
+            auto end = key.find(L'\0');
+            if (end != 0)
+            {
+                summary_ += name;
+                summary_ += L": "sv;
+                summary_ += key.substr(0, end);
+                summary_ += L'\n';
+            }
+            key.remove_prefix(end + 1);
+        }
+        AppendNumber(entry.suppressed, summary_);
+        summary_ += L" more in last "sv;
+        AppendNumber(std::chrono::round<std::chrono::seconds>(now - entry.windowStart).count(), summary_);
+        summary_ += L" seconds, PIDs "sv;
+        for (std::uint32_t i = 0; i != entry.pidCount; ++i)
+        {
+            if (i != 0)
+            {
+                summary_ += L", "sv;
+            }
+            summary_ += L"0x"sv;
+            AppendNumber(entry.pids[i], summary_, 16);
+        }
+        if (entry.morePids)
+        {
+            summary_ += L" ..."sv;
+        }
+        summary_ += L'\n';
+
+        if (!emit(std::wstring_view(summary_)))
+        {
+            return false;
+        }
+        entry.suppressed = 0;
+        entry.pidCount = 0;
+        entry.morePids = false;
+        return true;
+    }
+
+    void Restart(std::uint32_t index, Clock::time_point now) noexcept
+    {
+        entries_[index].windowStart = now;
+        Detach(index);
+        Append(index);
+    }
+
+    void Append(std::uint32_t index) noexcept
+    {
+        auto &entry = entries_[index];
+        entry.prev = tail_;
+        entry.next = none;
+        (tail_ == none ? head_ : entries_[tail_].next) = index;
+        tail_ = index;
+    }
+
+    void Detach(std::uint32_t index) noexcept
+    {
+        auto &entry = entries_[index];
+        (entry.prev == none ? head_ : entries_[entry.prev].next) = entry.next;
+        (entry.next == none ? tail_ : entries_[entry.next].prev) = entry.prev;
+    }
+
+    // removes the entry from both its bucket and the window order
+    void Unlink(std::uint32_t index) noexcept
+    {
+        Detach(index);
+        for (auto *link = &buckets_[entries_[index].hash & (buckets_.size() - 1)]; *link != none;
+             link = &entries_[*link].chain)
+        {
+            if (*link == index)
+            {
+                *link = entries_[index].chain;
+                break;
+            }
+        }
+    }
+
+    std::chrono::seconds window_;
+    std::vector<Entry> entries_;
+    std::vector<std::uint32_t> buckets_;
+    std::uint32_t size_{};
+    std::uint32_t free_ = none;
+    std::uint32_t head_ = none;
+    std::uint32_t tail_ = none;
+    std::uint64_t lost_{};
+    std::wstring key_;
+    std::wstring summary_;
+};
+
+} // namespace bizwen
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <algorithm>
+#include <exception>
+#include <string>
+#ifdef _WIN32
+#include <winsock2.h>
+#include <windows.h>
+#else
+#include <cstdio>
+#endif
+
+#include "utf8.hpp"
+
+namespace bizwen
+{
+
+// Writes to the console, or when standard output is redirected to a file or a pipe writes UTF-8, or the raw
+// units of -binary records. Outside Windows standard output always gets the bytes.
+inline void WriteContentConsole(std::wstring_view str, bool binary = false)
+{
+#ifdef _WIN32
+    auto handle = ::GetStdHandle(STD_OUTPUT_HANDLE);
+    if (handle == nullptr || handle == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    DWORD outSize;
+    DWORD consoleMode;
+    if (::GetConsoleMode(handle, &consoleMode))
+    {
+        if (!::WriteConsoleW(handle, str.data(), static_cast<DWORD>(str.size()), &outSize, nullptr))
+        {
+            std::terminate();
+        }
+        return;
+    }
+#endif
+
+    // NB: called from the sink workers, each keeps its own buffer
+    thread_local std::string buffer;
+    std::string_view bytes;
+    if (binary)
+    {
+        bytes = {reinterpret_cast<const char *>(str.data()), str.size() * sizeof(wchar_t)};
+    }
+    else
+    {
+        buffer.clear();
+        AppendUtf8(str, buffer);
+        bytes = buffer;
+    }
+#ifdef _WIN32
+    while (!bytes.empty())
+    {
+        auto size = static_cast<DWORD>(std::min<std::size_t>(bytes.size(), 1u << 30));
+        if (!::WriteFile(handle, bytes.data(), size, &outSize, nullptr))
+        {
+            std::terminate();
+        }
+        bytes.remove_prefix(outSize);
+    }
+#else
+    if (std::fwrite(bytes.data(), 1, bytes.size(), stdout) != bytes.size() || std::fflush(stdout) != 0)
+    {
+        std::terminate();
+    }
+#endif
+}
+
+} // namespace bizwen
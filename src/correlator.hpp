@@ -0,0 +1,370 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <limits>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "event_log.hpp"
+#include "event_parser.hpp"
+#include "text.hpp"
+
+namespace bizwen
+{
+
+using namespace std::literals;
+
+// Joins the events one crash leaves in the Application channel into one incident: the Application Error fault
+// (1000), the .NET Runtime event that managed code logs just before it (1026) and the Windows Error Reporting
+// event of its report (1001). Only the fault names the process by ID, creation time and path, the runtime event
+// knows the ID and image name alone and the report neither, so faults and runtime events meet on the process ID
+// and image name and a report joins the fault with its report ID, or with its image name if none matches.
+// An incident goes out once it has a fault and a report or when its window has elapsed, whichever comes first,
+// and reports that join no fault are dropped. The table has a fixed number of entries and the oldest incident
+// goes out early when it is full, so a storm of crashes costs latency, never memory.
+class IncidentCorrelator
+{
+  public:
+    static constexpr FieldMask keyFields =
+        FieldBit(L"AppName"sv) | FieldBit(L"ProcessId"sv) | FieldBit(L"IntegratorReportId"sv);
+
+    IncidentCorrelator(std::size_t capacity, std::chrono::seconds window)
+        : window_(window), entries_(capacity), buckets_(std::bit_ceil(capacity * 2), none)
+    {
+    }
+
+    // Takes over the fault parsed into arena, which gets an empty buffer in exchange. emit receives a function
+    // that fills an arena with an incident and returns false if it cannot be delivered right now.
+    template <typename Emit>
+    void AddFault(EventArena &arena, Clock::time_point now, Emit &&emit)
+    {
+        auto &eventLog = arena.eventLog;
+        auto processId = static_cast<std::uint32_t>(ParseEventNumber(eventLog.processId));
+        auto index = Find(processId, eventLog.appName, &Entry::fault);
+        if (index == none)
+        {
+            index = Open(processId, eventLog.appName, now, emit);
+        }
+
+        auto &entry = entries_[index];
+        entry.fault = true;
+        auto from = arena.content.data();
+        entry.content.swap(arena.content);
+        entry.eventLog = eventLog;
+        RebaseEventLog(entry.eventLog, from, entry.content.data());
+    }
+
+    // Joins the .NET Runtime event, whose only Data is the text of the unhandled exception.
+    template <typename Emit>
+    void AddRuntime(const EventHeader &header, std::wstring_view text, Clock::time_point now, Emit &&emit)
+    {
+        auto appName = TextLine(text, L"Application: "sv);
+        auto index = Find(header.processId, appName, &Entry::runtime);
+        if (index == none)
+        {
+            index = Open(header.processId, appName, now, emit);
+        }
+
+        auto &entry = entries_[index];
+        entry.runtime = true;
+        entry.exception.assign(TextLine(text, L"Exception Info: "sv));
+        entry.systemTime.assign(header.systemTime);
+    }
+
+    // Joins the Windows Error Reporting event given its Data values, returns false when no fault waits for it.
+    template <typename Emit>
+    bool AddReport(std::span<const std::wstring_view> data, Emit &&emit)
+    {
+        auto value = [data](std::size_t i) { return i < data.size() ? data[i] : std::wstring_view{}; };
+        auto reportId = value(reportIdData);
+        auto appName = value(appNameData);
+
+        auto index = none;
+        for (auto i = head_; i != none; i = entries_[i].next)
+        {
+            auto &entry = entries_[i];
+            if (!entry.fault || entry.report)
+            {
+                continue;
+            }
+            if (!reportId.empty() && entry.eventLog.integratorReportId == reportId)
+            {
+                index = i;
+                break;
+            }
+            if (index == none && EqualsIgnoringCase(entry.eventLog.appName, appName))
+            {
+                index = i;
+            }
+        }
+        if (index == none)
+        {
+            ++unmatched_;
+            return false;
+        }
+
+        auto &entry = entries_[index];
+        entry.report = true;
+        entry.eventName.assign(value(eventNameData));
+        entry.bucket.assign(value(bucketData));
+        // NB: a complete incident that cannot be delivered now goes out with the next flush after its window
+        Send(index, emit);
+        return true;
+    }
+
+    // Emits the incidents whose window has elapsed.
+    template <typename Emit>
+    void Flush(Clock::time_point now, Emit &&emit)
+    {
+        // entries are ordered by the time they were opened, so only the expired front is visited
+        while (head_ != none && now - entries_[head_].opened >= window_)
+        {
+            if (!Send(head_, emit))
+            {
+                return;
+            }
+        }
+    }
+
+    // Emits every incident, emit must not fail.
+    template <typename Emit>
+    void Drain(Emit &&emit)
+    {
+        while (head_ != none)
+        {
+            Send(head_, emit);
+        }
+    }
+
+    // Reports that joined no fault, and incidents that could not be delivered before they were evicted.
+    std::uint64_t Unmatched() const noexcept
+    {
+        return unmatched_;
+    }
+
+    std::uint64_t Lost() const noexcept
+    {
+        return lost_;
+    }
+
+  private:
+    static constexpr std::uint32_t none = std::numeric_limits<std::uint32_t>::max();
+
+    // positions of the unnamed Data of a Windows Error Reporting 1001 event
+    static constexpr std::size_t bucketData = 0;
+    static constexpr std::size_t eventNameData = 2;
+    static constexpr std::size_t appNameData = 5; // P1
+    static constexpr std::size_t reportIdData = 19;
+
+    struct Entry
+    {
+        std::uint32_t processId{};
+        std::wstring appName;
+        std::size_t hash{};
+        std::uint32_t chain = none; // next entry in the same bucket, or in the free list
+        std::uint32_t prev = none;  // neighbours in the order the entries were opened
+        std::uint32_t next = none;
+        Clock::time_point opened;
+        bool fault{};
+        bool runtime{};
+        bool report{};
+
+        std::wstring content; // the fault, parsed into eventLog
+        EventLog eventLog;
+        std::wstring systemTime;
+        std::wstring exception;
+        std::wstring eventName;
+        std::wstring bucket;
+    };
+
+    static constexpr wchar_t FoldCase(wchar_t ch) noexcept
+    {
+        return ch >= L'A' && ch <= L'Z' ? static_cast<wchar_t>(ch - L'A' + L'a') : ch;
+    }
+
+    static bool EqualsIgnoringCase(std::wstring_view left, std::wstring_view right) noexcept
+    {
+        return std::ranges::equal(left, right, {}, FoldCase, FoldCase);
+    }
+
+    static std::size_t Hash(std::uint32_t processId, std::wstring_view appName) noexcept
+    {
+        std::uint64_t hash = 0xcbf29ce484222325 ^ processId;
+        for (auto ch : appName)
+        {
+            hash = (hash ^ static_cast<std::uint64_t>(FoldCase(ch))) * 0x100000001b3;
+        }
+        return static_cast<std::size_t>(hash);
+    }
+
+    // The rest of the line that starts with label, such as "Application: " in the text of a runtime event.
+    static std::wstring_view TextLine(std::wstring_view text, std::wstring_view label) noexcept
+    {
+        for (std::size_t pos = 0; pos < text.size();)
+        {
+            auto end = std::min(text.find(L'\n', pos), text.size());
+            auto line = text.substr(pos, end - pos);
+            if (line.starts_with(label))
+            {
+                // NB: a CR written as a character reference survives the decoding
+                return line.substr(label.size(), line.size() - label.size() - line.ends_with(L'\r'));
+            }
+            pos = end + 1;
+        }
+        return {};
+    }
+
+    // The open incident of the process that has no event of the kind given by member yet.
+    std::uint32_t Find(std::uint32_t processId, std::wstring_view appName, bool Entry::*member) const noexcept
+    {
+        auto hash = Hash(processId, appName);
+        for (auto index = buckets_[hash & (buckets_.size() - 1)]; index != none; index = entries_[index].chain)
+        {
+            auto &entry = entries_[index];
+            if (entry.hash == hash && entry.processId == processId && !(entry.*member) &&
+                EqualsIgnoringCase(entry.appName, appName))
+            {
+                return index;
+            }
+        }
+        return none;
+    }
+
+    template <typename Emit>
+    std::uint32_t Open(std::uint32_t processId, std::wstring_view appName, Clock::time_point now, Emit &emit)
+    {
+        if (free_ == none && size_ == entries_.size())
+        {
+            auto oldest = head_;
+            if (!Send(oldest, emit))
+            {
+                ++lost_;
+                Remove(oldest);
+            }
+        }
+
+        std::uint32_t index;
+        if (free_ != none)
+        {
+            index = free_;
+            free_ = entries_[index].chain;
+        }
+        else
+        {
+            index = size_++;
+        }
+
+        auto &entry = entries_[index];
+        entry.processId = processId;
+        entry.appName.assign(appName);
+        entry.hash = Hash(processId, appName);
+        entry.opened = now;
+        entry.fault = entry.runtime = entry.report = false;
+        entry.content.clear();
+        entry.eventLog = {};
+        entry.systemTime.clear();
+        entry.exception.clear();
+        entry.eventName.clear();
+        entry.bucket.clear();
+
+        auto &bucket = buckets_[entry.hash & (buckets_.size() - 1)];
+        entry.chain = bucket;
+        bucket = index;
+        entry.prev = tail_;
+        entry.next = none;
+        (tail_ == none ? head_ : entries_[tail_].next) = index;
+        tail_ = index;
+        return index;
+    }
+
+    template <typename Emit>
+    bool Send(std::uint32_t index, Emit &emit)
+    {
+        if (!emit([this, index](EventArena &arena) { Fill(entries_[index], arena); }))
+        {
+            return false;
+        }
+        Remove(index);
+        return true;
+    }
+
+    // Moves the incident into arena, whose content is empty: the fault first, then the values of the related
+    // events. Without a fault, the runtime event stands in for it with the process and time it knows.
+    void Fill(Entry &entry, EventArena &arena)
+    {
+        auto &content = arena.content;
+        auto from = entry.content.data();
+        content.swap(entry.content);
+
+        std::size_t offsets[7]{content.size()};
+        std::size_t count = 0;
+        auto append = [&](std::wstring_view value) {
+            content += value;
+            offsets[++count] = content.size();
+        };
+        append(entry.eventName);
+        append(entry.bucket);
+        append(entry.exception);
+        if (!entry.fault)
+        {
+            append(entry.systemTime);
+            append(entry.appName);
+            content += L"0x"sv;
+            AppendNumber(entry.processId, content, 16);
+            offsets[++count] = content.size();
+        }
+
+        // NB: views are taken last since appending may reallocate the buffer
+        std::wstring_view view = content;
+        auto field = [&](std::size_t i) { return view.substr(offsets[i], offsets[i + 1] - offsets[i]); };
+        auto &eventLog = arena.eventLog;
+        if (entry.fault)
+        {
+            eventLog = entry.eventLog;
+            RebaseEventLog(eventLog, from, content.data());
+        }
+        else
+        {
+            eventLog = {};
+            eventLog.systemTime = field(3);
+            eventLog.appName = field(4);
+            eventLog.processId = field(5);
+        }
+        eventLog.werEventName = field(0);
+        eventLog.werBucket = field(1);
+        eventLog.clrException = field(2);
+    }
+
+    // removes the entry from its bucket and the open order, and frees it
+    void Remove(std::uint32_t index) noexcept
+    {
+        auto &entry = entries_[index];
+        (entry.prev == none ? head_ : entries_[entry.prev].next) = entry.next;
+        (entry.next == none ? tail_ : entries_[entry.next].prev) = entry.prev;
+        for (auto *link = &buckets_[entry.hash & (buckets_.size() - 1)]; *link != none; link = &entries_[*link].chain)
+        {
+            if (*link == index)
+            {
+                *link = entry.chain;
+                break;
+            }
+        }
+        entry.chain = free_;
+        free_ = index;
+    }
+
+    std::chrono::seconds window_;
+    std::vector<Entry> entries_;
+    std::vector<std::uint32_t> buckets_;
+    std::uint32_t size_{};
+    std::uint32_t free_ = none;
+    std::uint32_t head_ = none;
+    std::uint32_t tail_ = none;
+    std::uint64_t unmatched_{};
+    std::uint64_t lost_{};
+};
+
+} // namespace bizwen
@@ -0,0 +1,455 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "event_log.hpp"
+#include "text.hpp"
+#include "utf8.hpp"
+
+namespace bizwen
+{
+
+using namespace std::literals;
+
+// One -include or -exclude rule, field is Provider, EventID or the label of a field of EventLog.
+struct FilterRule
+{
+    bool exclude{};
+    std::wstring field;
+    std::wstring pattern;
+};
+
+// Fields of EventLog that the rules test, Provider and EventID rules are left to the event log service.
+inline FieldMask FilterFields(std::span<const FilterRule> rules) noexcept
+{
+    FieldMask fields{};
+    for (auto &rule : rules)
+    {
+        fields |= FieldBit(rule.field);
+    }
+    return fields;
+}
+
+inline bool IsGlob(std::wstring_view pattern) noexcept
+{
+    return pattern.find_first_of(L"*?"sv) != std::wstring_view::npos;
+}
+
+// Appends value as an XPath string literal, fails when it contains both kinds of quotes.
+inline bool AppendXPathLiteral(std::wstring_view value, std::wstring &query)
+{
+    auto quote = value.find(L'\'') == std::wstring_view::npos ? L'\'' : L'"';
+    if (value.find(quote) != std::wstring_view::npos)
+    {
+        return false;
+    }
+    query += quote;
+    query += value;
+    query += quote;
+    return true;
+}
+
+// The System[] condition of the events -correlate joins to faults: Windows Error Reporting reports and .NET
+// Runtime errors. The filters do not apply to them.
+constexpr std::wstring_view relatedEventsQuery = L"EventID=1001 and Provider[@Name='Windows Error Reporting'] or "
+                                                 L"EventID=1026 and Provider[@Name='.NET Runtime']"sv;
+
+// Appends what the event log service can evaluate of the rules to a query, system goes into System[] and data
+// after it: every Provider and EventID rule, and the include rules of an EventData field when all of them are
+// exact. Exact values are pushed down as a prefilter only, EventFilter still matches them on the client. Events
+// matching the System[] condition exempt pass every condition pushed into System[].
+inline void AppendFilterQuery(std::span<const FilterRule> rules, std::wstring &system, std::wstring &data,
+                              std::wstring_view exempt = {})
+{
+    auto appendSystem = [&system, exempt](std::wstring_view condition) {
+        system += L" and ("sv;
+        system += condition;
+        if (!exempt.empty())
+        {
+            system += L" or "sv;
+            system += exempt;
+        }
+        system += L')';
+    };
+
+    for (std::size_t i = 0; i != rules.size(); ++i)
+    {
+        auto &field = rules[i].field;
+        if (std::ranges::any_of(rules.first(i), [&field](auto &rule) { return rule.field == field; }))
+        {
+            continue;
+        }
+
+        // NB: SystemTime and UserID are attributes of System, of the fields of EventLog only EventData ones are pushed
+        bool includes = false;
+        bool pushable = field == L"EventID"sv || field == L"Provider"sv || FieldBit(field) >> firstDataField != 0;
+        std::wstring condition;
+        std::wstring exclusion;
+        for (auto &rule : rules.subspan(i))
+        {
+            if (rule.field != field)
+            {
+                continue;
+            }
+            if (field == L"EventID"sv)
+            {
+                if (rule.exclude)
+                {
+                    exclusion.assign(L"EventID!="sv);
+                    exclusion += rule.pattern;
+                    appendSystem(exclusion);
+                    continue;
+                }
+                condition += includes ? L" or EventID="sv : L"EventID="sv;
+                condition += rule.pattern;
+            }
+            else if (field == L"Provider"sv)
+            {
+                // NB: the patterns were checked to be quotable when the rules were parsed
+                if (rule.exclude)
+                {
+                    exclusion.assign(L"Provider[@Name!="sv);
+                    AppendXPathLiteral(rule.pattern, exclusion);
+                    exclusion += L']';
+                    appendSystem(exclusion);
+                    continue;
+                }
+                condition += includes ? L" or Provider[@Name="sv : L"Provider[@Name="sv;
+                AppendXPathLiteral(rule.pattern, condition);
+                condition += L']';
+            }
+            else
+            {
+                if (rule.exclude)
+                {
+                    continue;
+                }
+                condition += includes ? L" or Data[@Name='"sv : L"Data[@Name='"sv;
+                condition += field;
+                condition += L"']="sv;
+                pushable = pushable && !IsGlob(rule.pattern) && AppendXPathLiteral(rule.pattern, condition);
+            }
+            includes = true;
+        }
+
+        if (!includes || !pushable)
+        {
+            continue;
+        }
+        if (field == L"EventID"sv || field == L"Provider"sv)
+        {
+            appendSystem(condition);
+        }
+        else
+        {
+            data += L" and *[EventData[("sv;
+            data += condition;
+            data += L")]]"sv;
+        }
+    }
+}
+
+// The -include and -exclude rules on fields of EventLog, compiled once and tested on the parsed fields of every
+// event before it is coalesced or formatted. Rules on one field include an event if any of them matches, rules
+// on different fields must all do, and a matching exclude rule drops the event. A pattern with * or ? is a
+// glob that ignores ASCII case, any other pattern must match exactly, just like in the query.
+class EventFilter
+{
+  public:
+    explicit EventFilter(std::span<const FilterRule> rules)
+    {
+        for (auto &rule : rules)
+        {
+            auto bit = FieldBit(rule.field);
+            if (bit == 0)
+            {
+                continue;
+            }
+            auto field = static_cast<std::size_t>(std::countr_zero(bit));
+            if (rule.exclude)
+            {
+                excludes_.push_back({field, Pattern(rule.pattern)});
+                continue;
+            }
+            auto group = std::ranges::find(includes_, field, &Group::field);
+            if (group == includes_.end())
+            {
+                group = includes_.insert(group, {field, {}});
+            }
+            group->patterns.emplace_back(rule.pattern);
+        }
+        fields_ = FilterFields(rules);
+    }
+
+    bool Empty() const noexcept
+    {
+        return fields_ == 0;
+    }
+
+    FieldMask Fields() const noexcept
+    {
+        return fields_;
+    }
+
+    // Needs the fields in Fields to be parsed.
+    bool Admit(const EventLog &eventLog) const noexcept
+    {
+        for (auto &group : includes_)
+        {
+            auto value = eventLog.*eventFields[group.field].member;
+            if (std::ranges::none_of(group.patterns, [value](auto &pattern) { return pattern.Match(value); }))
+            {
+                return false;
+            }
+        }
+        return std::ranges::none_of(excludes_, [&eventLog](auto &rule) {
+            return rule.pattern.Match(eventLog.*eventFields[rule.field].member);
+        });
+    }
+
+  private:
+    // Globs that are a literal with a * on one or both ends are matched without backtracking.
+    class Pattern
+    {
+      public:
+        explicit Pattern(std::wstring_view pattern) : text_(pattern)
+        {
+            if (!IsGlob(pattern))
+            {
+                return;
+            }
+            for (auto &ch : text_)
+            {
+                ch = FoldCase(ch);
+            }
+            auto literal = std::wstring_view(text_);
+            bool leading = literal.starts_with(L'*');
+            bool trailing = literal.size() > 1 && literal.ends_with(L'*');
+            literal = literal.substr(leading, literal.size() - leading - trailing);
+            if (IsGlob(literal))
+            {
+                kind_ = Kind::glob;
+                return;
+            }
+            kind_ = leading ? (trailing ? Kind::contains : Kind::suffix) : Kind::prefix;
+            text_ = literal;
+        }
+
+        bool Match(std::wstring_view value) const noexcept
+        {
+            std::wstring_view text = text_;
+            switch (kind_)
+            {
+            case Kind::exact:
+                return value == text;
+            case Kind::prefix:
+                return value.size() >= text.size() && EqualFolded(value.substr(0, text.size()), text);
+            case Kind::suffix:
+                return value.size() >= text.size() && EqualFolded(value.substr(value.size() - text.size()), text);
+            case Kind::contains:
+                for (std::size_t i = 0; i + text.size() <= value.size(); ++i)
+                {
+                    if (EqualFolded(value.substr(i, text.size()), text))
+                    {
+                        return true;
+                    }
+                }
+                return false;
+            default:
+                return MatchGlob(value, text);
+            }
+        }
+
+      private:
+        enum class Kind
+        {
+            exact,
+            prefix,
+            suffix,
+            contains,
+            glob
+        };
+
+        static constexpr wchar_t FoldCase(wchar_t ch) noexcept
+        {
+            return ch >= L'A' && ch <= L'Z' ? static_cast<wchar_t>(ch - L'A' + L'a') : ch;
+        }
+
+        // text is already folded
+        static bool EqualFolded(std::wstring_view value, std::wstring_view text) noexcept
+        {
+            for (std::size_t i = 0; i != text.size(); ++i)
+            {
+                if (FoldCase(value[i]) != text[i])
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Backtracks to the last * only, which is enough since a later * can match anything an earlier one could.
+        static bool MatchGlob(std::wstring_view value, std::wstring_view glob) noexcept
+        {
+            std::size_t v = 0;
+            std::size_t g = 0;
+            auto star = std::wstring_view::npos;
+            std::size_t resume = 0;
+            while (v != value.size())
+            {
+                if (g != glob.size() && glob[g] == L'*')
+                {
+                    star = g++;
+                    resume = v;
+                }
+                else if (g != glob.size() && (glob[g] == L'?' || glob[g] == FoldCase(value[v])))
+                {
+                    ++g;
+                    ++v;
+                }
+                else if (star != std::wstring_view::npos)
+                {
+                    g = star + 1;
+                    v = ++resume;
+                }
+                else
+                {
+                    return false;
+                }
+            }
+            while (g != glob.size() && glob[g] == L'*')
+            {
+                ++g;
+            }
+            return g == glob.size();
+        }
+
+        std::wstring text_;
+        Kind kind_ = Kind::exact;
+    };
+
+    struct Group
+    {
+        std::size_t field;
+        std::vector<Pattern> patterns;
+    };
+
+    struct Exclude
+    {
+        std::size_t field;
+        Pattern pattern;
+    };
+
+    std::vector<Group> includes_;
+    std::vector<Exclude> excludes_;
+    FieldMask fields_{};
+};
+
+// A channel watched and the XPath query of its events, an empty query selects the errors like ErrorQuery.
+struct ChannelQuery
+{
+    std::wstring channel;
+    std::wstring query;
+};
+
+// The XPath of the errors created in [from, to), times count 100ns like FILETIME and 0 leaves that end open.
+// With related, the events -correlate joins are selected as well whatever the filters, the reports of Windows
+// Error Reporting among them are informational.
+inline std::wstring ErrorQuery(std::uint64_t from, std::uint64_t to, std::span<const FilterRule> filters = {},
+                               bool related = false)
+{
+    std::wstring query = L"*[System[(Level=2"s;
+    if (related)
+    {
+        query += L" or "sv;
+        query += relatedEventsQuery;
+    }
+    query += L')';
+    std::wstring data;
+    AppendFilterQuery(filters, query, data, related ? relatedEventsQuery : std::wstring_view{});
+    if (from != 0 || to != 0)
+    {
+        query += L" and TimeCreated["sv;
+        if (from != 0)
+        {
+            query += L"@SystemTime>='"sv;
+            AppendFileTime(from, query);
+            query += L'\'';
+        }
+        if (from != 0 && to != 0)
+        {
+            query += L" and "sv;
+        }
+        if (to != 0)
+        {
+            query += L"@SystemTime<'"sv;
+            AppendFileTime(to, query);
+            query += L'\'';
+        }
+        query += L']';
+    }
+    query += L"]]"sv;
+    // NB: the related events have no named Data, conditions on them are left to the client
+    if (!related)
+    {
+        query += data;
+    }
+    return query;
+}
+
+// Reads the -channels file: UTF-8 lines of a channel name, optionally followed by a colon and the XPath query
+// of its events. Blank lines and lines starting with # are skipped, a channel may be listed with several queries.
+inline std::vector<ChannelQuery> ReadChannels(const std::filesystem::path &file)
+{
+    std::ifstream stream(file, std::ios::binary);
+    if (!stream.is_open())
+    {
+        std::terminate();
+    }
+    std::string bytes((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    std::wstring text;
+    AppendWide(std::string_view(bytes).substr(bytes.starts_with("\xEF\xBB\xBF"sv) ? 3 : 0), text);
+
+    auto trim = [](std::wstring_view text) {
+        auto begin = text.find_first_not_of(L" \t\r"sv);
+        return begin == std::wstring_view::npos ? std::wstring_view{}
+                                                : text.substr(begin, text.find_last_not_of(L" \t\r"sv) + 1 - begin);
+    };
+    std::vector<ChannelQuery> channels;
+    for (std::size_t pos = 0; pos < text.size();)
+    {
+        auto end = std::min(text.find(L'\n', pos), text.size());
+        auto line = trim(std::wstring_view(text).substr(pos, end - pos));
+        pos = end + 1;
+        if (line.empty() || line.starts_with(L'#'))
+        {
+            continue;
+        }
+        // NB: channel names never contain a colon, queries may
+        auto colon = line.find(L':');
+        auto &channel = channels.emplace_back(std::wstring(trim(line.substr(0, colon))), std::wstring());
+        if (colon != std::wstring_view::npos)
+        {
+            channel.query = trim(line.substr(colon + 1));
+        }
+        if (channel.channel.empty())
+        {
+            std::terminate();
+        }
+    }
+    if (channels.empty())
+    {
+        std::terminate();
+    }
+    return channels;
+}
+
+} // namespace bizwen
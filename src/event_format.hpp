@@ -0,0 +1,303 @@
+#pragma once
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+
+#include "event_log.hpp"
+#include "text.hpp"
+#include "utf8.hpp"
+
+namespace bizwen
+{
+
+using namespace std::literals;
+
+inline void FormatEventLog(const EventLog &eventLog, FieldMask fields, std::wstring &output)
+{
+    for (std::size_t i = 0; i != std::size(eventFields); ++i)
+    {
+        auto fieldValue = eventLog.*eventFields[i].member;
+        if (!fieldValue.empty() && (fields >> i & 1) != 0)
+        {
+            output += eventFields[i].name;
+            output += L": "sv;
+            output += fieldValue;
+            output += L'\n';
+        }
+    }
+}
+
+// Appends text as the body of a JSON string. Runs that need no escaping are copied at once, and everything
+// goes into the caller's buffer so a warm buffer makes this allocation-free.
+inline void AppendJsonEscaped(std::wstring_view text, std::wstring &output)
+{
+    std::size_t begin = 0;
+    for (std::size_t i = 0; i != text.size(); ++i)
+    {
+        auto ch = text[i];
+        if (ch >= L' ' && ch != L'"' && ch != L'\\')
+        {
+            continue;
+        }
+        output.append(text.substr(begin, i - begin));
+        begin = i + 1;
+        switch (ch)
+        {
+        case L'"':
+            output += L"\\\""sv;
+            break;
+        case L'\\':
+            output += L"\\\\"sv;
+            break;
+        case L'\n':
+            output += L"\\n"sv;
+            break;
+        case L'\r':
+            output += L"\\r"sv;
+            break;
+        case L'\t':
+            output += L"\\t"sv;
+            break;
+        default:
+            output += L"\\u00"sv;
+            output += L"0123456789abcdef"[ch >> 4];
+            output += L"0123456789abcdef"[ch & 0xf];
+            break;
+        }
+    }
+    output.append(text.substr(begin));
+}
+
+// One JSON object per line, keys as in -text and empty fields left out.
+inline void FormatEventJson(const EventLog &eventLog, FieldMask fields, std::wstring &output)
+{
+    auto separator = L'{';
+    for (std::size_t i = 0; i != std::size(eventFields); ++i)
+    {
+        auto fieldValue = eventLog.*eventFields[i].member;
+        if (!fieldValue.empty() && (fields >> i & 1) != 0)
+        {
+            output += separator;
+            output += L'"';
+            output += eventFields[i].name;
+            output += L"\":\""sv;
+            AppendJsonEscaped(fieldValue, output);
+            output += L'"';
+            separator = L',';
+        }
+    }
+    if (separator == L'{')
+    {
+        output += L'{';
+    }
+    output += L"}\n"sv;
+}
+
+// -binary record, made of 16-bit little-endian units so it passes through the wide output path unchanged:
+//
+//     record = size:u32 mask:u32 field*
+//     field  = length:u16 unit[length]
+//
+// u32 values are stored low unit first and size counts the units of the whole record. Bit i of mask is set
+// when eventFields[i] is present, present fields follow in that order. Bit 31 marks a note instead, such
+// as a coalescing summary, whose text is the only field. Values are cut at 65535 units.
+class BinaryRecordWriter
+{
+  public:
+    explicit BinaryRecordWriter(std::wstring &output) : output_(output), start_(output.size())
+    {
+        output_.append(4, L'\0');
+    }
+
+    void Append(std::size_t bit, std::wstring_view value)
+    {
+        auto length = std::min<std::size_t>(value.size(), 0xffff);
+        mask_ |= std::uint32_t{1} << bit;
+        output_ += static_cast<wchar_t>(length);
+        output_.append(value.substr(0, length));
+    }
+
+    ~BinaryRecordWriter()
+    {
+        auto size = output_.size() - start_;
+        output_[start_] = static_cast<wchar_t>(size & 0xffff);
+        output_[start_ + 1] = static_cast<wchar_t>(size >> 16 & 0xffff);
+        output_[start_ + 2] = static_cast<wchar_t>(mask_ & 0xffff);
+        output_[start_ + 3] = static_cast<wchar_t>(mask_ >> 16);
+    }
+
+  private:
+    std::wstring &output_;
+    std::size_t start_;
+    std::uint32_t mask_{};
+};
+
+inline void FormatEventBinary(const EventLog &eventLog, FieldMask fields, std::wstring &output)
+{
+    BinaryRecordWriter record(output);
+    for (std::size_t i = 0; i != std::size(eventFields); ++i)
+    {
+        auto fieldValue = eventLog.*eventFields[i].member;
+        if (!fieldValue.empty() && (fields >> i & 1) != 0)
+        {
+            record.Append(i, fieldValue);
+        }
+    }
+}
+
+enum class PrintStyle
+{
+    text,
+    xml,
+    jsonl,
+    binary
+};
+
+// Formats the given fields of a parsed event in any style but xml, which is always passed through verbatim.
+inline void FormatEvent(PrintStyle style, const EventLog &eventLog, FieldMask fields, std::wstring &output)
+{
+    switch (style)
+    {
+    case PrintStyle::jsonl:
+        FormatEventJson(eventLog, fields, output);
+        break;
+    case PrintStyle::binary:
+        FormatEventBinary(eventLog, fields, output);
+        break;
+    default:
+        FormatEventLog(eventLog, fields, output);
+        break;
+    }
+}
+
+// Formats text produced by the tool itself, such as coalescing summaries and limiter digests, so that it
+// stays parseable alongside the events of a -jsonl or -binary stream.
+inline void FormatNote(PrintStyle style, std::wstring_view text, std::wstring &output)
+{
+    switch (style)
+    {
+    case PrintStyle::jsonl:
+        output += L"{\"Note\":\""sv;
+        AppendJsonEscaped(text, output);
+        output += L"\"}\n"sv;
+        break;
+    case PrintStyle::binary:
+        BinaryRecordWriter(output).Append(31, text);
+        break;
+    default:
+        output += text;
+        break;
+    }
+}
+
+// Escapes text for an element or an attribute value in either quotes. Characters that XML 1.0 does not allow,
+// such as the control characters of a garbled event, become U+FFFD so that the result always loads.
+inline void AppendXmlEscaped(std::wstring_view text, std::wstring &output)
+{
+    for (auto ch : text)
+    {
+        switch (ch)
+        {
+        case L'&':
+            output += L"&amp;"sv;
+            break;
+        case L'<':
+            output += L"&lt;"sv;
+            break;
+        case L'>':
+            output += L"&gt;"sv;
+            break;
+        case L'"':
+            output += L"&quot;"sv;
+            break;
+        case L'\'':
+            output += L"&apos;"sv;
+            break;
+        case L'\t':
+        case L'\n':
+        case L'\r':
+            output += ch;
+            break;
+        default:
+            output += ch < L' ' || ch == L'\xfffe' || ch == L'\xffff' ? L'\xfffd' : ch;
+        }
+    }
+}
+
+// Formats an RFC 5424 syslog message: facility user, severity error, the time of the event, the host, the fields
+// as the structured data element event@32473, whose enterprise number RFC 5612 sets aside for documentation, and
+// text as MSG with its line breaks turned into "; ". eventLog is null for a note, which has no fields.
+inline void FormatSyslog(const EventLog *eventLog, FieldMask fields, std::wstring_view text, std::wstring_view host,
+                         std::wstring &output)
+{
+    output += L"<11>1 "sv;
+    // NB: TIME-SECFRAC has at most 6 digits, SystemTime has 7
+    auto time = eventLog != nullptr ? eventLog->systemTime : std::wstring_view{};
+    auto dot = time.find(L'.');
+    if (time.empty())
+    {
+        output += L'-';
+    }
+    else if (dot == std::wstring_view::npos)
+    {
+        output += time;
+    }
+    else
+    {
+        auto end = std::min(time.find_first_not_of(L"0123456789"sv, dot + 1), time.size());
+        output += time.substr(0, end == dot + 1 ? dot : std::min(end, dot + 7));
+        output += time.substr(end);
+    }
+    output += L' ';
+    output += host.empty() ? L"-"sv : host;
+    output += L" apperrnotitool - - "sv;
+
+    auto structured = false;
+    for (std::size_t i = 0; eventLog != nullptr && i != std::size(eventFields); ++i)
+    {
+        auto fieldValue = eventLog->*eventFields[i].member;
+        if (fieldValue.empty() || (fields >> i & 1) == 0)
+        {
+            continue;
+        }
+        output += structured ? L" "sv : L"[event@32473 "sv;
+        structured = true;
+        output += eventFields[i].name;
+        output += L"=\""sv;
+        for (auto ch : fieldValue)
+        {
+            if (ch == L'"' || ch == L'\\' || ch == L']')
+            {
+                output += L'\\';
+            }
+            output += ch;
+        }
+        output += L'"';
+    }
+    output += structured ? L"]"sv : L"-"sv;
+
+    while (text.ends_with(L'\n') || text.ends_with(L'\r'))
+    {
+        text.remove_suffix(1);
+    }
+    if (text.empty())
+    {
+        return;
+    }
+    // MSG in UTF-8 starts with a BOM
+    output += L" \xfeff"sv;
+    for (auto ch : text)
+    {
+        if (ch == L'\n')
+        {
+            output += L"; "sv;
+        }
+        else if (ch != L'\r')
+        {
+            output += ch;
+        }
+    }
+}
+
+} // namespace bizwen
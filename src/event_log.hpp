@@ -0,0 +1,250 @@
+#pragma once
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+
+namespace bizwen
+{
+
+using namespace std::literals;
+
+// Fields are views into the rendered event, they are valid until the owning EventArena is reset.
+struct EventLog
+{
+    // System
+    std::wstring_view systemTime;
+    std::wstring_view UserId;
+
+    // EventData
+    std::wstring_view appName;
+    std::wstring_view appVersion;
+    std::wstring_view appTimeStamp;
+    std::wstring_view moduleName;
+    std::wstring_view moduleVersion;
+    std::wstring_view moduleTimeStamp;
+    std::wstring_view exceptionCode;
+    std::wstring_view faultingOffset;
+    std::wstring_view processId;
+    std::wstring_view processCreationTime;
+    std::wstring_view appPath;
+    std::wstring_view modulePath;
+    std::wstring_view integratorReportId;
+    std::wstring_view packageFullName;
+    std::wstring_view packageRelativeAppId;
+
+    // Related events, joined by -correlate
+    std::wstring_view werEventName;
+    std::wstring_view werBucket;
+    std::wstring_view clrException;
+
+    // Resolved by -symbolize
+    std::wstring_view faultingSymbol;
+};
+
+// A field of EventLog: its label in -text, -jsonl and -fields, the path the values render context selects it
+// with, null for fields not rendered from the event, and whether the minimal text of notifications keeps it.
+// Field i is bit i of a FieldMask.
+struct EventField
+{
+    std::wstring_view name;
+    std::wstring_view EventLog::*member;
+    const wchar_t *valuePath;
+    bool minimal;
+};
+
+constexpr EventField eventFields[]{
+    {L"SystemTime"sv, &EventLog::systemTime, L"Event/System/TimeCreated/@SystemTime", false},
+    {L"UserID"sv, &EventLog::UserId, L"Event/System/Security/@UserID", false},
+    {L"AppName"sv, &EventLog::appName, L"Event/EventData/Data[@Name='AppName']", true},
+    {L"AppVersion"sv, &EventLog::appVersion, L"Event/EventData/Data[@Name='AppVersion']", false},
+    {L"AppTimeStamp"sv, &EventLog::appTimeStamp, L"Event/EventData/Data[@Name='AppTimeStamp']", false},
+    {L"ModuleName"sv, &EventLog::moduleName, L"Event/EventData/Data[@Name='ModuleName']", true},
+    {L"ModuleVersion"sv, &EventLog::moduleVersion, L"Event/EventData/Data[@Name='ModuleVersion']", false},
+    {L"ModuleTimeStamp"sv, &EventLog::moduleTimeStamp, L"Event/EventData/Data[@Name='ModuleTimeStamp']", false},
+    {L"ExceptionCode"sv, &EventLog::exceptionCode, L"Event/EventData/Data[@Name='ExceptionCode']", true},
+    {L"FaultingOffset"sv, &EventLog::faultingOffset, L"Event/EventData/Data[@Name='FaultingOffset']", false},
+    {L"ProcessId"sv, &EventLog::processId, L"Event/EventData/Data[@Name='ProcessId']", false},
+    {L"ProcessCreationTime"sv, &EventLog::processCreationTime,
+     L"Event/EventData/Data[@Name='ProcessCreationTime']", false},
+    {L"AppPath"sv, &EventLog::appPath, L"Event/EventData/Data[@Name='AppPath']", false},
+    {L"ModulePath"sv, &EventLog::modulePath, L"Event/EventData/Data[@Name='ModulePath']", false},
+    {L"IntegratorReportId"sv, &EventLog::integratorReportId, L"Event/EventData/Data[@Name='IntegratorReportId']",
+     true},
+    {L"PackageFullName"sv, &EventLog::packageFullName, L"Event/EventData/Data[@Name='PackageFullName']", false},
+    {L"PackageRelativeAppId"sv, &EventLog::packageRelativeAppId,
+     L"Event/EventData/Data[@Name='PackageRelativeAppId']", false},
+    {L"WerEventName"sv, &EventLog::werEventName, nullptr, false},
+    {L"WerBucket"sv, &EventLog::werBucket, nullptr, false},
+    {L"ClrException"sv, &EventLog::clrException, nullptr, false},
+    {L"FaultingSymbol"sv, &EventLog::faultingSymbol, nullptr, false},
+};
+
+// Fields from this one on are the EventData children, named by their Data Name attribute.
+constexpr std::size_t firstDataField = 2;
+// Fields from this one on are never rendered from the event itself, they come from the related events of the
+// fault or are derived from its fields.
+constexpr std::size_t firstRelatedField = 17;
+
+static_assert(eventFields[firstRelatedField - 1].valuePath != nullptr &&
+              eventFields[firstRelatedField].valuePath == nullptr);
+
+using FieldMask = std::uint32_t;
+
+// NB: bit 31 is left for the note records of -binary
+static_assert(std::size(eventFields) < 31);
+
+constexpr FieldMask allFields = (FieldMask{1} << std::size(eventFields)) - 1;
+
+constexpr FieldMask relatedFields = allFields & ~((FieldMask{1} << firstRelatedField) - 1);
+
+// The field with the given label, 0 if there is none.
+constexpr FieldMask FieldBit(std::wstring_view name) noexcept
+{
+    for (std::size_t i = 0; i != std::size(eventFields); ++i)
+    {
+        if (eventFields[i].name == name)
+        {
+            return FieldMask{1} << i;
+        }
+    }
+    return 0;
+}
+
+constexpr FieldMask minimalFields = [] {
+    FieldMask mask{};
+    for (std::size_t i = 0; i != std::size(eventFields); ++i)
+    {
+        if (eventFields[i].minimal)
+        {
+            mask |= FieldMask{1} << i;
+        }
+    }
+    return mask;
+}();
+
+// The fields of the minimal text among those selected, all of them when none of the minimal ones is.
+constexpr FieldMask MinimalFields(FieldMask fields) noexcept
+{
+    return (fields & minimalFields) != 0 ? fields & minimalFields : fields;
+}
+
+// Perfect hash of the Data Name attributes. The key takes the length and three characters of a name, and
+// multipliers drawn from splitmix64 are tried at compile time until every EventData field has a slot of its
+// own, so a lookup is a multiplication and one comparison.
+constexpr std::uint64_t DataNameKey(std::wstring_view name) noexcept
+{
+    return name.size() ^ static_cast<std::uint64_t>(name.front()) << 16 ^
+           static_cast<std::uint64_t>(name[name.size() / 2]) << 32 ^ static_cast<std::uint64_t>(name.back()) << 48;
+}
+
+constexpr std::uint64_t SplitMix64(std::uint64_t state) noexcept
+{
+    state += 0x9e3779b97f4a7c15;
+    state = (state ^ state >> 30) * 0xbf58476d1ce4e5b9;
+    state = (state ^ state >> 27) * 0x94d049bb133111eb;
+    return state ^ state >> 31;
+}
+
+constexpr unsigned dataNameBits = 5;
+
+struct DataNameTable
+{
+    std::uint64_t multiplier;
+    std::uint8_t fields[1u << dataNameBits];
+
+    constexpr std::size_t Slot(std::wstring_view name) const noexcept
+    {
+        return static_cast<std::size_t>(DataNameKey(name) * multiplier >> (64 - dataNameBits));
+    }
+};
+
+constexpr std::uint8_t noDataField = 0xff;
+
+constexpr DataNameTable dataNameTable = [] {
+    for (std::uint64_t attempt = 1;; ++attempt)
+    {
+        DataNameTable table{SplitMix64(attempt) | 1, {}};
+        std::ranges::fill(table.fields, noDataField);
+        auto i = firstDataField;
+        for (; i != firstRelatedField; ++i)
+        {
+            auto &slot = table.fields[table.Slot(eventFields[i].name)];
+            if (slot != noDataField)
+            {
+                break;
+            }
+            slot = static_cast<std::uint8_t>(i);
+        }
+        if (i == firstRelatedField)
+        {
+            return table;
+        }
+    }
+}();
+
+// The index of the EventData field with the given Data Name, noDataField for any other name.
+constexpr std::size_t FindDataField(std::wstring_view name) noexcept
+{
+    if (name.empty())
+    {
+        return noDataField;
+    }
+    auto field = dataNameTable.fields[dataNameTable.Slot(name)];
+    return field != noDataField && eventFields[field].name == name ? field : noDataField;
+}
+
+// Every Data Name finds its own field, and the names of the other fields find none.
+static_assert([] {
+    for (std::size_t i = 0; i != std::size(eventFields); ++i)
+    {
+        auto expected = i >= firstDataField && i < firstRelatedField ? i : noDataField;
+        if (FindDataField(eventFields[i].name) != expected)
+        {
+            return false;
+        }
+    }
+    return true;
+}());
+
+// Per-event storage. The buffers keep their capacity across Reset, so once every buffer has grown to fit
+// the largest event seen so far no further heap allocation happens for rendering, parsing and formatting.
+struct EventArena
+{
+    std::wstring content;     // rendered event, XML or decoded values
+    std::wstring text;        // formatted output
+    std::wstring minimalText; // formatted output for size-constrained sinks
+    std::wstring tempFile;    // path of the file holding text
+
+    EventLog eventLog;
+    // eventLog was filled by the source from rendered values, content is not XML
+    bool decoded = false;
+    // TimeCreated as FILETIME ticks for -stats, 0 when unknown
+    std::uint64_t created{};
+
+    void Reset() noexcept
+    {
+        content.clear();
+        text.clear();
+        minimalText.clear();
+        tempFile.clear();
+        eventLog = {};
+        decoded = false;
+        created = 0;
+    }
+};
+
+// Points the fields of eventLog at a copy of the content they were parsed from.
+inline void RebaseEventLog(EventLog &eventLog, const wchar_t *from, const wchar_t *to) noexcept
+{
+    for (auto &field : eventFields)
+    {
+        auto &value = eventLog.*field.member;
+        if (!value.empty())
+        {
+            value = {to + (value.data() - from), value.size()};
+        }
+    }
+}
+
+} // namespace bizwen
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "event_format.hpp"
+#include "options.hpp"
+#include "rolling_log.hpp"
+#include "utf8.hpp"
+
+namespace bizwen
+{
+
+// Writes content as UTF-8 with a BOM, which both Notepad and Windows PowerShell recognize, or as the raw
+// units of -binary records.
+inline std::wstring WriteTempFile(std::wstring_view content, bool binary = false)
+{
+    using namespace std::literals;
+    auto path = std::filesystem::temp_directory_path();
+    path /= std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+    path += L".txt"sv;
+
+    std::ofstream fileStream(path, std::ios::out | std::ios::binary);
+    if (!fileStream.is_open())
+    {
+        std::terminate();
+    }
+    if (binary)
+    {
+        fileStream.write(reinterpret_cast<const char *>(content.data()),
+                         static_cast<std::streamsize>(content.size() * sizeof(wchar_t)));
+    }
+    else
+    {
+        std::string bytes = "\xef\xbb\xbf";
+        AppendUtf8(content, bytes);
+        fileStream.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    }
+    return path.wstring();
+}
+
+// The representations of one event shared by all sinks, each is produced at most once and only when some
+// sink asks for it. The results live in the arena.
+class EventOutput
+{
+  public:
+    explicit EventOutput(EventArena &arena) noexcept : arena_(arena)
+    {
+    }
+
+    // Starts a new event with the given fields formatted in style, eventLog is null when the sinks receive the
+    // rendered content verbatim.
+    void Reset(const EventLog *eventLog, PrintStyle style = PrintStyle::text, FieldMask fields = allFields) noexcept
+    {
+        eventLog_ = eventLog;
+        style_ = style;
+        fields_ = fields;
+        hasText_ = false;
+        hasMinimalText_ = false;
+        hasTempFile_ = false;
+        logEntry_ = {};
+    }
+
+    // Appends every event to log, viewers then open its segment instead of a temp file.
+    void UseLog(RollingLog *log) noexcept
+    {
+        log_ = log;
+    }
+
+    // Produces everything the sinks in method read in DispatchOutput, so that afterwards they can share the
+    // results from several threads without synchronization.
+    void Prepare(PrintMethod method)
+    {
+        if (method & PrintMethod::console || method & PrintMethod::messagebox)
+        {
+            Text();
+        }
+        if (log_ != nullptr)
+        {
+            Log();
+        }
+        else if (method & PrintMethod::notepad || method & PrintMethod::powershell)
+        {
+            TempFile();
+        }
+        if (method & PrintMethod::notification)
+        {
+            MinimalText();
+        }
+        if (method & PrintMethod::forward)
+        {
+            // -forward sends JSON lines as they are, or syslog messages of the fields and the minimal text
+            if (style_ == PrintStyle::jsonl)
+            {
+                Text();
+            }
+            else
+            {
+                MinimalText();
+            }
+        }
+    }
+
+    std::wstring_view Text()
+    {
+        if (eventLog_ == nullptr)
+        {
+            return arena_.content;
+        }
+        if (!hasText_)
+        {
+            FormatEvent(style_, *eventLog_, fields_, arena_.text);
+            hasText_ = true;
+        }
+        return arena_.text;
+    }
+
+    // The event whose fields are formatted, null for rendered content output verbatim.
+    const EventLog *Event() const noexcept
+    {
+        return eventLog_;
+    }
+
+    FieldMask Fields() const noexcept
+    {
+        return fields_;
+    }
+
+    // Whether the output holds -binary records rather than text.
+    bool Binary() const noexcept
+    {
+        return style_ == PrintStyle::binary;
+    }
+
+    std::wstring_view MinimalText()
+    {
+        if (eventLog_ == nullptr)
+        {
+            return arena_.content;
+        }
+        if (!hasMinimalText_)
+        {
+            FormatEvent(style_, *eventLog_, MinimalFields(fields_), arena_.minimalText);
+            hasMinimalText_ = true;
+        }
+        return arena_.minimalText;
+    }
+
+    std::wstring_view TempFile()
+    {
+        if (log_ != nullptr)
+        {
+            // NB: Prepare appended the event, the viewer only waits until it is written
+            Log();
+            log_->Sync(logEntry_.end);
+            return arena_.tempFile;
+        }
+        if (!hasTempFile_)
+        {
+            arena_.tempFile = WriteTempFile(Text(), Binary());
+            hasTempFile_ = true;
+        }
+        return arena_.tempFile;
+    }
+
+    // The lines of the event within TempFile, none when the viewer shows the whole file.
+    std::uint64_t FirstLine() const noexcept
+    {
+        return logEntry_.firstLine;
+    }
+
+    std::uint64_t Lines() const noexcept
+    {
+        return logEntry_.lines;
+    }
+
+  private:
+    void Log()
+    {
+        if (!hasTempFile_)
+        {
+            logEntry_ = log_->Append(Text(), arena_.tempFile);
+            hasTempFile_ = true;
+        }
+    }
+
+    const EventLog *eventLog_{};
+    PrintStyle style_{};
+    FieldMask fields_ = allFields;
+    EventArena &arena_;
+    RollingLog *log_{};
+    RollingLog::Entry logEntry_;
+    bool hasText_ = false;
+    bool hasMinimalText_ = false;
+    bool hasTempFile_ = false;
+};
+
+} // namespace bizwen
@@ -0,0 +1,361 @@
+#pragma once
+
+#include <span>
+#include <string>
+
+#include "event_log.hpp"
+#include "text.hpp"
+
+namespace bizwen
+{
+
+using namespace std::literals;
+
+// The character a numeric reference stands for, digits being what follows "&#" like x41 or 65. A reference
+// without digits, with a stray character or to something that is not a character stands for U+FFFD.
+inline char32_t DecodeCharacterReference(std::wstring_view digits) noexcept
+{
+    bool hex = digits.starts_with(L'x');
+    if (hex)
+    {
+        digits.remove_prefix(1);
+    }
+    if (digits.empty())
+    {
+        return 0xFFFD;
+    }
+
+    char32_t code{};
+    for (auto digit : digits)
+    {
+        char32_t value;
+        if (digit >= L'0' && digit <= L'9')
+        {
+            value = digit - L'0';
+        }
+        else if (hex && digit >= L'a' && digit <= L'f')
+        {
+            value = digit - L'a' + 10;
+        }
+        else if (hex && digit >= L'A' && digit <= L'F')
+        {
+            value = digit - L'A' + 10;
+        }
+        else
+        {
+            return 0xFFFD;
+        }
+        code = code * (hex ? 16 : 10) + value;
+        // NB: gives up before a long run of digits can overflow
+        if (code > 0x10FFFF)
+        {
+            return 0xFFFD;
+        }
+    }
+    if (code == 0 || (code >= 0xD800 && code <= 0xDFFF))
+    {
+        return 0xFFFD;
+    }
+    return code;
+}
+
+inline std::wstring_view DecodeXmlText(std::span<wchar_t> text) noexcept
+{
+    // Decodes in place, every escape sequence is at least as long as what it stands for.
+    // Fast path: most values contain neither entities nor carriage returns.
+    auto special = std::wstring_view(text.data(), text.size()).find_first_of(L"&\r"sv);
+    if (special == std::wstring_view::npos)
+    {
+        return {text.data(), text.size()};
+    }
+
+    auto out = special;
+    for (auto i = special; i != text.size(); ++i)
+    {
+        auto ch = text[i];
+        if (ch == L'\r')
+        {
+            // NB: XML normalizes both CRLF and lone CR to LF
+            text[out++] = L'\n';
+            if (i + 1 != text.size() && text[i + 1] == L'\n')
+            {
+                ++i;
+            }
+            continue;
+        }
+        if (ch != L'&')
+        {
+            text[out++] = ch;
+            continue;
+        }
+
+        auto semicolon = std::wstring_view(text.data(), text.size()).find(L';', i);
+        if (semicolon == std::wstring_view::npos)
+        {
+            while (i != text.size())
+            {
+                text[out++] = text[i++];
+            }
+            break;
+        }
+
+        auto entity = std::wstring_view(text.data() + i + 1, semicolon - i - 1);
+        if (entity == L"lt"sv)
+        {
+            text[out++] = L'<';
+        }
+        else if (entity == L"gt"sv)
+        {
+            text[out++] = L'>';
+        }
+        else if (entity == L"amp"sv)
+        {
+            text[out++] = L'&';
+        }
+        else if (entity == L"quot"sv)
+        {
+            text[out++] = L'"';
+        }
+        else if (entity == L"apos"sv)
+        {
+            text[out++] = L'\'';
+        }
+        else if (entity.starts_with(L'#'))
+        {
+            auto code = DecodeCharacterReference(entity.substr(1));
+            if constexpr (sizeof(wchar_t) == 2)
+            {
+                if (code > 0xFFFF)
+                {
+                    code -= 0x10000;
+                    text[out++] = static_cast<wchar_t>(0xD800 + (code >> 10));
+                    text[out++] = static_cast<wchar_t>(0xDC00 + (code & 0x3FF));
+                }
+                else
+                {
+                    text[out++] = static_cast<wchar_t>(code);
+                }
+            }
+            else
+            {
+                text[out++] = static_cast<wchar_t>(code);
+            }
+        }
+        else
+        {
+            // unknown entity, keep it verbatim
+            for (auto j = i; j <= semicolon; ++j)
+            {
+                text[out++] = text[j];
+            }
+        }
+        i = semicolon;
+    }
+    return {text.data(), out};
+}
+
+inline std::wstring_view GetXmlAttribute(std::wstring_view tag, std::wstring_view name) noexcept
+{
+    // tag is the content between '<' and '>', starting with the element name
+    auto pos = tag.find_first_of(L" \t\r\n"sv);
+    while (pos != tag.npos)
+    {
+        pos = tag.find_first_not_of(L" \t\r\n"sv, pos);
+        if (pos == tag.npos)
+        {
+            break;
+        }
+
+        auto equal = tag.find(L'=', pos);
+        if (equal == tag.npos)
+        {
+            break;
+        }
+        auto attrName = tag.substr(pos, equal - pos);
+        attrName = attrName.substr(0, attrName.find_last_not_of(L" \t\r\n"sv) + 1);
+
+        auto open = tag.find_first_of(L"\"'"sv, equal + 1);
+        if (open == tag.npos)
+        {
+            break;
+        }
+        auto close = tag.find(tag[open], open + 1);
+        if (close == tag.npos)
+        {
+            break;
+        }
+
+        if (attrName == name)
+        {
+            return tag.substr(open + 1, close - open - 1);
+        }
+        pos = close + 1;
+    }
+    return {};
+}
+
+inline void ParseEventLog(std::wstring &content, EventLog &eventLog, FieldMask fields = allFields) noexcept
+{
+    // Single pass over the rendered event, only the System and EventData children are of interest.
+    // The input is produced by EvtRender so it is assumed to be well-formed. Values are decoded in place,
+    // so the content is no longer valid XML afterwards and eventLog refers into it. Fields outside of
+    // fields are left empty and their values are never decoded.
+    std::wstring_view xml = content;
+    auto decode = [&content](std::wstring_view text) noexcept {
+        return DecodeXmlText(std::span(content.data() + (text.data() - content.data()), text.size()));
+    };
+
+    enum class Section
+    {
+        none,
+        system,
+        eventData
+    } section{};
+
+    for (std::size_t pos = 0; (pos = xml.find(L'<', pos)) != xml.npos;)
+    {
+        auto end = xml.find(L'>', pos);
+        if (end == xml.npos)
+        {
+            break;
+        }
+
+        auto tag = xml.substr(pos + 1, end - pos - 1);
+        pos = end + 1;
+
+        if (tag.starts_with(L'/'))
+        {
+            tag.remove_prefix(1);
+            if (tag == L"System"sv || tag == L"EventData"sv)
+            {
+                section = Section::none;
+            }
+            continue;
+        }
+        if (tag.starts_with(L'?') || tag.starts_with(L'!'))
+        {
+            continue;
+        }
+
+        bool empty = tag.ends_with(L'/');
+        auto name = tag.substr(0, tag.find_first_of(L" \t\r\n/"sv));
+
+        if (section == Section::none)
+        {
+            if (empty)
+            {
+                continue;
+            }
+            if (name == L"System"sv)
+            {
+                section = Section::system;
+            }
+            else if (name == L"EventData"sv)
+            {
+                section = Section::eventData;
+            }
+        }
+        else if (section == Section::system)
+        {
+            if (name == L"TimeCreated"sv && (fields & 1) != 0)
+            {
+                eventLog.systemTime = decode(GetXmlAttribute(tag, L"SystemTime"sv));
+            }
+            else if (name == L"Security"sv && (fields & 2) != 0)
+            {
+                eventLog.UserId = decode(GetXmlAttribute(tag, L"UserID"sv));
+            }
+        }
+        else if (name == L"Data"sv)
+        {
+            auto field = FindDataField(GetXmlAttribute(tag, L"Name"sv));
+            if (empty || field == noDataField || (fields >> field & 1) == 0)
+            {
+                continue;
+            }
+
+            auto valueEnd = xml.find(L'<', pos);
+            if (valueEnd == xml.npos)
+            {
+                break;
+            }
+            eventLog.*eventFields[field].member = decode(xml.substr(pos, valueEnd - pos));
+            pos = valueEnd;
+        }
+    }
+}
+
+// The System children -correlate tells the events of one crash apart by. Views into the rendered event like
+// EventLog, and valid until it is parsed in place.
+struct EventHeader
+{
+    std::wstring_view provider;
+    std::uint32_t eventId{};
+    std::uint32_t processId{}; // of the process that logged the event, not necessarily the faulting one
+    std::wstring_view systemTime;
+};
+
+inline EventHeader ParseEventHeader(std::wstring_view xml) noexcept
+{
+    EventHeader header;
+    xml = xml.substr(0, xml.find(L"</System>"sv));
+    for (std::size_t pos = 0; (pos = xml.find(L'<', pos)) != xml.npos;)
+    {
+        auto end = xml.find(L'>', pos);
+        if (end == xml.npos)
+        {
+            break;
+        }
+
+        auto tag = xml.substr(pos + 1, end - pos - 1);
+        pos = end + 1;
+        auto name = tag.substr(0, tag.find_first_of(L" \t\r\n/"sv));
+        if (name == L"Provider"sv)
+        {
+            header.provider = GetXmlAttribute(tag, L"Name"sv);
+        }
+        else if (name == L"EventID"sv)
+        {
+            header.eventId = static_cast<std::uint32_t>(ParseEventNumber(xml.substr(pos, xml.find(L'<', pos) - pos)));
+        }
+        else if (name == L"Execution"sv)
+        {
+            header.processId = static_cast<std::uint32_t>(ParseEventNumber(GetXmlAttribute(tag, L"ProcessID"sv)));
+        }
+        else if (name == L"TimeCreated"sv)
+        {
+            header.systemTime = GetXmlAttribute(tag, L"SystemTime"sv);
+        }
+    }
+    return header;
+}
+
+// Decodes the Data children of EventData in place and in order, for events whose Data have no Name. Returns
+// the number of values stored, at most values.size().
+inline std::size_t ParseEventData(std::wstring &content, std::span<std::wstring_view> values) noexcept
+{
+    std::wstring_view xml = content;
+    std::size_t count = 0;
+    for (auto pos = xml.find(L"<EventData"sv); pos != xml.npos && count != values.size();)
+    {
+        pos = xml.find(L"<Data"sv, pos + 1);
+        auto end = xml.find(L'>', pos);
+        if (pos == xml.npos || end == xml.npos)
+        {
+            break;
+        }
+
+        auto empty = xml[end - 1] == L'/';
+        pos = end + 1;
+        auto valueEnd = empty ? pos : xml.find(L'<', pos);
+        if (valueEnd == xml.npos)
+        {
+            break;
+        }
+        values[count++] = DecodeXmlText(std::span(content.data() + pos, valueEnd - pos));
+        pos = valueEnd;
+    }
+    return count;
+}
+
+} // namespace bizwen
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <exception>
+#include <string>
+#include <vector>
+// NB: before windows.h, which includes the older winsock.h otherwise
+#include <winsock2.h>
+#include <windows.h>
+#include <winevt.h>
+
+#include "event_value.hpp"
+
+#pragma comment(lib, "wevtapi.lib")
+
+namespace bizwen
+{
+
+inline void PrintEvent(EVT_HANDLE hEvent, std::wstring &content, EVT_RENDER_FLAGS flags = EvtRenderEventXml)
+{
+    DWORD dwBufferUsed = 0;
+    DWORD dwPropertyCount = 0;
+    bool rendered = false;
+
+    auto render = [&](wchar_t *data, std::size_t size) -> std::size_t {
+        rendered = ::EvtRender(nullptr, hEvent, flags, static_cast<DWORD>(size * sizeof(wchar_t)), data,
+                               &dwBufferUsed, &dwPropertyCount);
+        if (rendered)
+        {
+            return dwBufferUsed / sizeof(wchar_t) - 1; // NB: null terminator
+        }
+        else if (::GetLastError() == ERROR_INSUFFICIENT_BUFFER)
+        {
+            return 0;
+        }
+        else
+        {
+            std::terminate();
+        }
+    };
+
+    // the buffer only grows, so once it fits the event is rendered with a single call
+    content.resize_and_overwrite(content.capacity(), render);
+    if (!rendered)
+    {
+        content.resize_and_overwrite(dwBufferUsed / sizeof(wchar_t), render);
+        if (!rendered)
+        {
+            std::terminate();
+        }
+    }
+}
+
+inline DWORD RenderEventValues(EVT_HANDLE hContext, EVT_HANDLE hEvent, std::vector<EVT_VARIANT> &values)
+{
+    DWORD dwBufferUsed = 0;
+    DWORD dwPropertyCount = 0;
+
+    auto render = [&] {
+        return ::EvtRender(hContext, hEvent, EvtRenderEventValues,
+                           static_cast<DWORD>(values.size() * sizeof(EVT_VARIANT)), values.data(), &dwBufferUsed,
+                           &dwPropertyCount);
+    };
+
+    // the buffer only grows, so once it fits the event is rendered with a single call
+    if (!render())
+    {
+        if (::GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+        {
+            std::terminate();
+        }
+        values.resize((dwBufferUsed + sizeof(EVT_VARIANT) - 1) / sizeof(EVT_VARIANT));
+        if (!render())
+        {
+            std::terminate();
+        }
+    }
+    return dwPropertyCount;
+}
+
+} // namespace bizwen
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <span>
+
+#include "event_log.hpp"
+
+namespace bizwen
+{
+
+class EventSource
+{
+  public:
+    virtual ~EventSource() = default;
+
+    // Renders up to batch.size() events into the front of the batch and returns the number filled,
+    // 0 means there are no more events for now.
+    virtual std::size_t Next(std::span<EventArena *const> batch) = 0;
+};
+
+} // namespace bizwen
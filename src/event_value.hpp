@@ -0,0 +1,258 @@
+#pragma once
+
+#include <chrono>
+#include <iterator>
+#include <span>
+#include <string>
+#ifdef _WIN32
+// NB: before windows.h, which includes the older winsock.h otherwise
+#include <winsock2.h>
+#include <windows.h>
+#include <winevt.h>
+#endif
+
+#include "event_log.hpp"
+#include "text.hpp"
+
+namespace bizwen
+{
+
+using namespace std::literals;
+
+#ifndef _WIN32
+// What the values are formatted from, declared like winevt.h does so that the formatting builds and is tested
+// outside Windows as well.
+struct SYSTEMTIME
+{
+    std::uint16_t wYear;
+    std::uint16_t wMonth;
+    std::uint16_t wDayOfWeek;
+    std::uint16_t wDay;
+    std::uint16_t wHour;
+    std::uint16_t wMinute;
+    std::uint16_t wSecond;
+    std::uint16_t wMilliseconds;
+};
+
+struct GUID
+{
+    std::uint32_t Data1;
+    std::uint16_t Data2;
+    std::uint16_t Data3;
+    unsigned char Data4[8];
+};
+
+enum EVT_VARIANT_TYPE
+{
+    EvtVarTypeNull = 0,
+    EvtVarTypeString = 1,
+    EvtVarTypeAnsiString = 2,
+    EvtVarTypeSByte = 3,
+    EvtVarTypeByte = 4,
+    EvtVarTypeInt16 = 5,
+    EvtVarTypeUInt16 = 6,
+    EvtVarTypeInt32 = 7,
+    EvtVarTypeUInt32 = 8,
+    EvtVarTypeInt64 = 9,
+    EvtVarTypeUInt64 = 10,
+    EvtVarTypeSingle = 11,
+    EvtVarTypeDouble = 12,
+    EvtVarTypeBoolean = 13,
+    EvtVarTypeBinary = 14,
+    EvtVarTypeGuid = 15,
+    EvtVarTypeSizeT = 16,
+    EvtVarTypeFileTime = 17,
+    EvtVarTypeSysTime = 18,
+    EvtVarTypeSid = 19,
+    EvtVarTypeHexInt32 = 20,
+    EvtVarTypeHexInt64 = 21
+};
+
+struct EVT_VARIANT
+{
+    union {
+        int BooleanVal;
+        signed char SByteVal;
+        std::int16_t Int16Val;
+        std::int32_t Int32Val;
+        std::int64_t Int64Val;
+        unsigned char ByteVal;
+        std::uint16_t UInt16Val;
+        std::uint32_t UInt32Val;
+        std::uint64_t UInt64Val;
+        float SingleVal;
+        double DoubleVal;
+        std::uint64_t FileTimeVal;
+        SYSTEMTIME *SysTimeVal;
+        GUID *GuidVal;
+        const wchar_t *StringVal;
+        const char *AnsiStringVal;
+        unsigned char *BinaryVal;
+        void *SidVal;
+        std::size_t SizeTVal;
+    };
+    std::uint32_t Count;
+    std::uint32_t Type;
+};
+#endif
+
+// Appends the same text EvtRenderEventXml would produce for the value.
+inline void AppendEventValue(const EVT_VARIANT &value, std::wstring &output)
+{
+    switch (value.Type)
+    {
+    case EvtVarTypeString:
+        output += value.StringVal;
+        break;
+    case EvtVarTypeAnsiString:
+        for (auto p = value.AnsiStringVal; *p != '\0'; ++p)
+        {
+            output += static_cast<wchar_t>(static_cast<unsigned char>(*p));
+        }
+        break;
+    case EvtVarTypeSByte:
+    case EvtVarTypeInt16:
+    case EvtVarTypeInt32:
+    case EvtVarTypeInt64: {
+        auto number = value.Type == EvtVarTypeSByte   ? value.SByteVal
+                      : value.Type == EvtVarTypeInt16 ? value.Int16Val
+                      : value.Type == EvtVarTypeInt32 ? value.Int32Val
+                                                      : value.Int64Val;
+        if (number < 0)
+        {
+            output += L'-';
+        }
+        AppendNumber(number < 0 ? 0 - static_cast<std::uint64_t>(number) : static_cast<std::uint64_t>(number),
+                     output);
+        break;
+    }
+    case EvtVarTypeByte:
+        AppendNumber(value.ByteVal, output);
+        break;
+    case EvtVarTypeUInt16:
+        AppendNumber(value.UInt16Val, output);
+        break;
+    case EvtVarTypeUInt32:
+        AppendNumber(value.UInt32Val, output);
+        break;
+    case EvtVarTypeUInt64:
+        AppendNumber(value.UInt64Val, output);
+        break;
+    case EvtVarTypeSizeT:
+        AppendNumber(value.SizeTVal, output);
+        break;
+    case EvtVarTypeHexInt32:
+        output += L"0x"sv;
+        AppendNumber(value.UInt32Val, output, 16);
+        break;
+    case EvtVarTypeHexInt64:
+        output += L"0x"sv;
+        AppendNumber(value.UInt64Val, output, 16);
+        break;
+    case EvtVarTypeBoolean:
+        output += value.BooleanVal ? L"true"sv : L"false"sv;
+        break;
+    case EvtVarTypeFileTime:
+    case EvtVarTypeSysTime: {
+        std::uint64_t ticks{};
+        if (value.Type == EvtVarTypeFileTime)
+        {
+            ticks = value.FileTimeVal;
+        }
+        else
+        {
+            auto &st = *value.SysTimeVal;
+            auto days = std::chrono::sys_days(std::chrono::year(st.wYear) / st.wMonth / st.wDay) -
+                        std::chrono::sys_days(std::chrono::year(1601) / 1 / 1);
+            ticks = static_cast<std::uint64_t>(days.count()) * 864'000'000'000 +
+                    ((st.wHour * 60ull + st.wMinute) * 60ull + st.wSecond) * 10'000'000ull +
+                    st.wMilliseconds * 10'000ull;
+        }
+        AppendFileTime(ticks, output);
+        break;
+    }
+    case EvtVarTypeSid: {
+        // S-Revision-IdentifierAuthority-SubAuthority...
+        auto sid = reinterpret_cast<const unsigned char *>(value.SidVal);
+        std::uint64_t authority{};
+        for (int i = 2; i != 8; ++i)
+        {
+            authority = authority << 8 | sid[i];
+        }
+        output += L"S-"sv;
+        AppendNumber(sid[0], output);
+        output += L'-';
+        AppendNumber(authority, output);
+        for (int i = 0; i != sid[1]; ++i)
+        {
+            auto p = sid + 8 + i * 4;
+            output += L'-';
+            AppendNumber(p[0] | p[1] << 8 | p[2] << 16 | static_cast<std::uint32_t>(p[3]) << 24, output);
+        }
+        break;
+    }
+    case EvtVarTypeGuid: {
+        auto &guid = *value.GuidVal;
+        auto upper = output.size();
+        output += L'{';
+        AppendNumber(guid.Data1, output, 16, 8);
+        output += L'-';
+        AppendNumber(guid.Data2, output, 16, 4);
+        output += L'-';
+        AppendNumber(guid.Data3, output, 16, 4);
+        output += L'-';
+        for (int i = 0; i != 8; ++i)
+        {
+            if (i == 2)
+            {
+                output += L'-';
+            }
+            AppendNumber(guid.Data4[i], output, 16, 2);
+        }
+        output += L'}';
+        for (auto &ch : std::span(output).subspan(upper))
+        {
+            if (ch >= L'a' && ch <= L'f')
+            {
+                ch -= L'a' - L'A';
+            }
+        }
+        break;
+    }
+    default:
+        // EvtVarTypeNull, arrays and binary values are not used by the fields of EventLog
+        break;
+    }
+}
+
+// Decodes the values of a render context created for fields into arena.content and points arena.eventLog at
+// them, the value of each selected field follows the one of the previous.
+inline void DecodeEventValues(std::span<const EVT_VARIANT> values, EventArena &arena, FieldMask fields = allFields)
+{
+    std::size_t offsets[std::size(eventFields) + 1]{};
+    std::size_t value = 0;
+    for (std::size_t i = 0; i != std::size(eventFields); ++i)
+    {
+        offsets[i] = arena.content.size();
+        if ((fields >> i & 1) != 0 && value < values.size())
+        {
+            AppendEventValue(values[value++], arena.content);
+        }
+    }
+    offsets[std::size(eventFields)] = arena.content.size();
+
+    // NB: views are taken last since appending may reallocate the buffer
+    std::wstring_view content = arena.content;
+    for (std::size_t i = 0; i != std::size(eventFields); ++i)
+    {
+        arena.eventLog.*eventFields[i].member = content.substr(offsets[i], offsets[i + 1] - offsets[i]);
+    }
+    arena.decoded = true;
+    // the first path is TimeCreated when it is selected
+    if ((fields & 1) != 0 && !values.empty() && values[0].Type == EvtVarTypeFileTime)
+    {
+        arena.created = values[0].FileTimeVal;
+    }
+}
+
+} // namespace bizwen
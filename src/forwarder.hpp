@@ -0,0 +1,402 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+// NB: before windows.h, which includes the older winsock.h otherwise
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#include <compressapi.h>
+
+#include "event_format.hpp"
+#include "event_output.hpp"
+#include "options.hpp"
+#include "text.hpp"
+#include "utf8.hpp"
+
+#pragma comment(lib, "ws2_32.lib")
+#pragma comment(lib, "cabinet.lib")
+
+namespace bizwen
+{
+
+using namespace std::literals;
+
+// A -forward batch goes out with the next tick, or right away once it holds this many bytes.
+constexpr std::size_t forwardBatchBytes = 64 * 1024;
+
+// Batches wait in the spool up to this many bytes, further ones are dropped until the receiver takes them again.
+constexpr std::uintmax_t forwardSpoolBytes = 64ull * 1024 * 1024;
+
+// Connecting is retried after a second, then after twice as long each time up to this.
+constexpr std::chrono::seconds forwardMaxBackoff = 60s;
+
+// Connecting to one address of the receiver gives up after this.
+constexpr std::chrono::seconds forwardConnectTimeout = 5s;
+
+// The -forward sink. Events are framed as UTF-8 into a batch that goes out with the next tick: over UDP each in a
+// datagram of its own (RFC 5426), over TCP the whole batch on one connection that is kept open, framed by octet
+// counting (RFC 6587) for syslog and by line breaks for JSON lines. When a TCP receiver cannot be reached or
+// stops taking data, batches go to a spool file of bounded size that is sent ahead of any new batch once a
+// connection succeeds again, including one left over from an earlier run. Delivery is at least once: a batch that
+// fails midway is sent again whole. UDP cannot tell whether anyone receives, so its batches are never spooled.
+// Messages that are neither sent nor spooled count as dropped for the sink. With -compress every TCP batch, the
+// spooled ones too, goes out as compressedSize:u32 size:u32 followed by the batch compressed by the Compression
+// API as raw MSZIP, the sizes little-endian. The spool holds batches as they are.
+class Forwarder
+{
+  public:
+    Forwarder(const ForwardTarget &target, bool json, bool compress, std::filesystem::path spool,
+              std::atomic<std::uint64_t> &dropped)
+        : target_(target), json_(json), spool_(std::move(spool)), dropped_(dropped)
+    {
+        WSADATA data;
+        if (::WSAStartup(MAKEWORD(2, 2), &data) != 0)
+        {
+            std::terminate();
+        }
+        if (compress && target_.tcp && !::CreateCompressor(COMPRESS_ALGORITHM_MSZIP | COMPRESS_RAW, nullptr,
+                                                           &compressor_))
+        {
+            std::terminate();
+        }
+        wchar_t name[256];
+        auto size = static_cast<DWORD>(std::size(name));
+        if (::GetComputerNameExW(ComputerNameDnsHostname, name, &size))
+        {
+            host_.assign(name, size);
+        }
+        if (target_.tcp)
+        {
+            std::error_code error;
+            auto bytes = std::filesystem::file_size(spool_, error);
+            spooled_ = error ? 0 : bytes;
+        }
+    }
+
+    Forwarder(const Forwarder &) = delete;
+    Forwarder &operator=(const Forwarder &) = delete;
+
+    ~Forwarder()
+    {
+        Disconnect();
+        if (compressor_ != nullptr)
+        {
+            ::CloseCompressor(compressor_);
+        }
+        ::WSACleanup();
+    }
+
+    void Add(EventOutput &output, Clock::time_point now)
+    {
+        message_.clear();
+        if (json_)
+        {
+            message_ += output.Text();
+        }
+        else
+        {
+            FormatSyslog(output.Event(), output.Fields(), output.MinimalText(), host_, message_);
+        }
+        bytes_.clear();
+        AppendUtf8(message_, bytes_);
+        if (target_.tcp && !json_)
+        {
+            batch_ += std::to_string(bytes_.size());
+            batch_ += ' ';
+        }
+        batch_ += bytes_;
+        ends_.push_back(batch_.size());
+
+        if (batch_.size() >= forwardBatchBytes)
+        {
+            Flush(now);
+        }
+    }
+
+    // Sends the batch and what waits in the spool, or spools the batch when the receiver cannot take it.
+    void Flush(Clock::time_point now)
+    {
+        if (!target_.tcp)
+        {
+            SendDatagrams();
+            return;
+        }
+        if (batch_.empty() && spooled_ == 0)
+        {
+            return;
+        }
+        // NB: while backing off batches are spooled right away, so that they keep their order
+        if (now < retry_)
+        {
+            Spool();
+            return;
+        }
+        if ((socket_ != INVALID_SOCKET || Connect()) && SendSpool() && SendBatch(batch_))
+        {
+            Clear();
+            backoff_ = {};
+            return;
+        }
+
+        Disconnect();
+        backoff_ = std::min<std::chrono::seconds>(backoff_ == std::chrono::seconds{} ? 1s : backoff_ * 2,
+                                                  forwardMaxBackoff);
+        retry_ = now + backoff_;
+        Spool();
+    }
+
+  private:
+    bool Connect()
+    {
+        ADDRINFOW hints{};
+        hints.ai_socktype = target_.tcp ? SOCK_STREAM : SOCK_DGRAM;
+        hints.ai_protocol = target_.tcp ? IPPROTO_TCP : IPPROTO_UDP;
+        ADDRINFOW *addresses{};
+        if (::GetAddrInfoW(target_.host.c_str(), target_.port.c_str(), &hints, &addresses) != 0)
+        {
+            return false;
+        }
+        for (auto address = addresses; address != nullptr && socket_ == INVALID_SOCKET; address = address->ai_next)
+        {
+            socket_ = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+            if (socket_ != INVALID_SOCKET && !ConnectWithin(address->ai_addr, static_cast<int>(address->ai_addrlen)))
+            {
+                Disconnect();
+            }
+        }
+        ::FreeAddrInfoW(addresses);
+
+        if (socket_ != INVALID_SOCKET && target_.tcp)
+        {
+            // NB: a receiver that stops reading fails the send instead of blocking the sink for good
+            DWORD timeout = 10'000;
+            ::setsockopt(socket_, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char *>(&timeout),
+                         sizeof(timeout));
+        }
+        return socket_ != INVALID_SOCKET;
+    }
+
+    // Connects without blocking for longer than forwardConnectTimeout, since a receiver that drops the SYN would
+    // stall the sink for the system timeout of about 21 seconds otherwise.
+    bool ConnectWithin(const sockaddr *address, int length) noexcept
+    {
+        u_long nonBlocking = 1;
+        if (::ioctlsocket(socket_, FIONBIO, &nonBlocking) != 0)
+        {
+            return false;
+        }
+        if (::connect(socket_, address, length) != 0)
+        {
+            if (::WSAGetLastError() != WSAEWOULDBLOCK)
+            {
+                return false;
+            }
+            // NB: a failed connect is reported in the except set, not the write set
+            fd_set writable;
+            fd_set failed;
+            FD_ZERO(&writable);
+            FD_ZERO(&failed);
+            FD_SET(socket_, &writable);
+            FD_SET(socket_, &failed);
+            timeval timeout{static_cast<long>(forwardConnectTimeout.count()), 0};
+            if (::select(0, nullptr, &writable, &failed, &timeout) != 1 || !FD_ISSET(socket_, &writable))
+            {
+                return false;
+            }
+            int error{};
+            int size = sizeof(error);
+            if (::getsockopt(socket_, SOL_SOCKET, SO_ERROR, reinterpret_cast<char *>(&error), &size) != 0 ||
+                error != 0)
+            {
+                return false;
+            }
+        }
+        nonBlocking = 0;
+        return ::ioctlsocket(socket_, FIONBIO, &nonBlocking) == 0;
+    }
+
+    void Disconnect() noexcept
+    {
+        if (socket_ != INVALID_SOCKET)
+        {
+            ::closesocket(socket_);
+            socket_ = INVALID_SOCKET;
+        }
+    }
+
+    bool Send(std::string_view data) noexcept
+    {
+        while (!data.empty())
+        {
+            auto sent = ::send(socket_, data.data(), static_cast<int>(std::min<std::size_t>(data.size(), 1 << 30)), 0);
+            if (sent <= 0)
+            {
+                return false;
+            }
+            data.remove_prefix(static_cast<std::size_t>(sent));
+        }
+        return true;
+    }
+
+    // Sends a batch over TCP, compressed with -compress.
+    bool SendBatch(std::string_view batch)
+    {
+        if (compressor_ == nullptr || batch.empty())
+        {
+            return Send(batch);
+        }
+
+        constexpr std::size_t header = 8;
+        // NB: enough for data that does not compress, so that a second pass is rare
+        compressed_.resize(header + batch.size() + batch.size() / 8 + 1024);
+        SIZE_T size{};
+        if (!::Compress(compressor_, batch.data(), batch.size(), compressed_.data() + header,
+                        compressed_.size() - header, &size))
+        {
+            if (::GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+            {
+                std::terminate();
+            }
+            compressed_.resize(header + size);
+            if (!::Compress(compressor_, batch.data(), batch.size(), compressed_.data() + header, size, &size))
+            {
+                std::terminate();
+            }
+        }
+        compressed_.resize(header + size);
+        for (std::size_t i = 0; i != 4; ++i)
+        {
+            compressed_[i] = static_cast<char>(size >> i * 8);
+            compressed_[4 + i] = static_cast<char>(batch.size() >> i * 8);
+        }
+        return Send(compressed_);
+    }
+
+    void SendDatagrams()
+    {
+        if (batch_.empty())
+        {
+            return;
+        }
+        if (socket_ == INVALID_SOCKET && !Connect())
+        {
+            dropped_.fetch_add(ends_.size(), std::memory_order_relaxed);
+            Clear();
+            return;
+        }
+        std::size_t begin = 0;
+        for (auto end : ends_)
+        {
+            if (::send(socket_, batch_.data() + begin, static_cast<int>(end - begin), 0) <= 0)
+            {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+            }
+            begin = end;
+        }
+        Clear();
+    }
+
+    // The spool holds batches as size:u32 bytes[size], sent from the oldest and removed once all went out.
+    void Spool()
+    {
+        if (batch_.empty())
+        {
+            return;
+        }
+        auto size = static_cast<std::uint32_t>(batch_.size());
+        if (spooled_ + sizeof(size) + size > forwardSpoolBytes)
+        {
+            dropped_.fetch_add(ends_.size(), std::memory_order_relaxed);
+            Clear();
+            return;
+        }
+
+        std::ofstream file(spool_, std::ios::binary | std::ios::app);
+        file.write(reinterpret_cast<const char *>(&size), sizeof(size));
+        file.write(batch_.data(), size);
+        file.close();
+        auto end = spooled_ + sizeof(size) + size;
+        std::error_code error;
+        if (file && std::filesystem::file_size(spool_, error) == end)
+        {
+            spooled_ = end;
+        }
+        else
+        {
+            // NB: a short write, such as on a full disk, is cut off so that later records stay readable
+            std::filesystem::resize_file(spool_, spooled_, error);
+            dropped_.fetch_add(ends_.size(), std::memory_order_relaxed);
+        }
+        Clear();
+    }
+
+    bool SendSpool()
+    {
+        if (spooled_ == 0)
+        {
+            return true;
+        }
+
+        std::ifstream file(spool_, std::ios::binary);
+        file.seekg(static_cast<std::streamoff>(spoolSent_));
+        std::uint32_t size;
+        // NB: a torn or damaged record ends the spool
+        while (spoolSent_ + sizeof(size) <= spooled_ && file.read(reinterpret_cast<char *>(&size), sizeof(size)) &&
+               size <= spooled_ - spoolSent_ - sizeof(size))
+        {
+            record_.resize(size);
+            if (!file.read(record_.data(), size))
+            {
+                break;
+            }
+            if (!SendBatch(record_))
+            {
+                return false;
+            }
+            spoolSent_ += sizeof(size) + size;
+        }
+        file.close();
+
+        std::error_code error;
+        std::filesystem::remove(spool_, error);
+        spooled_ = 0;
+        spoolSent_ = 0;
+        return true;
+    }
+
+    void Clear() noexcept
+    {
+        batch_.clear();
+        ends_.clear();
+    }
+
+    ForwardTarget target_;
+    bool json_;
+    std::filesystem::path spool_;
+    std::atomic<std::uint64_t> &dropped_;
+    std::wstring host_;
+    COMPRESSOR_HANDLE compressor_{};
+    SOCKET socket_ = INVALID_SOCKET;
+    std::chrono::seconds backoff_{};
+    Clock::time_point retry_;
+
+    std::wstring message_;
+    std::string bytes_;
+    std::string batch_;
+    std::vector<std::size_t> ends_; // where each message of batch_ ends
+    std::string record_;
+    std::string compressed_;
+    std::uintmax_t spooled_{};   // bytes in the spool file
+    std::uintmax_t spoolSent_{}; // of them already sent
+};
+
+} // namespace bizwen
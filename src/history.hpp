@@ -0,0 +1,504 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "event_log.hpp"
+#include "mapped_file.hpp"
+#include "options.hpp"
+#include "text.hpp"
+
+namespace bizwen
+{
+
+using namespace std::literals;
+
+constexpr std::uint32_t historyMagic = 0x31484541; // AEH1
+constexpr std::size_t historyBlockRows = 4096;
+constexpr std::size_t historyBlockBytes = 16 * 1024 * 1024;
+constexpr auto historyFlushInterval = 5s;
+
+// -history file, an append-only sequence of column blocks:
+//
+//     block  = magic:u32 size:u32 rows:u32 columns:u32 minTime:u64 maxTime:u64 column[columns] time:u64[rows] ...
+//     column = dictionary:u32 count:u32 codes:u32 width:u32
+//
+// size counts the bytes of the whole block. Column i holds eventFields[i] as a dictionary of its count distinct
+// values at offset dictionary, u32 end offsets in units followed by the units, and a code per row of width
+// bytes at offset codes, no codes when every row has code 0. A field that was not stored has count 0 and is
+// empty in every row. SystemTime is the time column instead, FILETIME ticks or 0 when unknown, and minTime and
+// maxTime bound it so that a query skips the blocks out of its range. Values are native like -binary and every
+// part starts on a multiple of 8, so a mapped block is read in place.
+struct HistoryColumn
+{
+    const std::uint32_t *ends;
+    const wchar_t *units;
+    std::uint32_t count;
+    const std::byte *codes;
+    std::uint32_t width;
+
+    // Adds the code of each row times radix to the group of the row, a column at a time so the loop is tight.
+    void AddCodes(std::uint64_t radix, std::span<std::uint64_t> groups) const noexcept
+    {
+        auto add = [this, radix, groups](const auto *typed) {
+            for (std::size_t row = 0; row != groups.size(); ++row)
+            {
+                std::uint32_t code = typed[row];
+                // NB: codes are not validated when the block is read, a corrupt one reads as the first value
+                groups[row] += (code < count ? code : 0) * radix;
+            }
+        };
+        switch (width)
+        {
+        case 1:
+            add(reinterpret_cast<const std::uint8_t *>(codes));
+            break;
+        case 2:
+            add(reinterpret_cast<const std::uint16_t *>(codes));
+            break;
+        case 4:
+            add(reinterpret_cast<const std::uint32_t *>(codes));
+            break;
+        }
+    }
+
+    std::wstring_view Value(std::uint32_t code) const noexcept
+    {
+        if (code >= count)
+        {
+            return {};
+        }
+        // NB: only the last end is validated when the block is read
+        auto begin = code == 0 ? 0 : ends[code - 1];
+        auto end = ends[code];
+        return begin <= end && end <= ends[count - 1] ? std::wstring_view(units + begin, end - begin)
+                                                      : std::wstring_view{};
+    }
+};
+
+struct HistoryBlock
+{
+    std::uint32_t rows;
+    std::uint64_t minTime;
+    std::uint64_t maxTime;
+    const std::uint64_t *times;
+    HistoryColumn columns[std::size(eventFields)];
+};
+
+// A mapped -history file, its blocks are read in place.
+class HistoryReader
+{
+  public:
+    explicit HistoryReader(const std::filesystem::path &file) : file_(file, false)
+    {
+    }
+
+    // Reads the block at offset and moves offset past it. Returns false at the end of the file and at a block
+    // that is not whole, which an append cut short by a crash leaves behind. Only the columns of fields are
+    // read, the others are left empty so that their pages are not touched.
+    bool Next(std::size_t &offset, HistoryBlock &block, FieldMask fields = allFields) const noexcept
+    {
+        auto data = static_cast<const std::byte *>(file_.Data());
+        auto size = file_.Size();
+        if (offset > size || size - offset < headerSize)
+        {
+            return false;
+        }
+
+        auto begin = data + offset;
+        auto header = reinterpret_cast<const std::uint32_t *>(begin);
+        auto blockSize = header[1];
+        auto rows = header[2];
+        auto columns = header[3];
+        if (header[0] != historyMagic || blockSize % 8 != 0 || blockSize > size - offset ||
+            headerSize + columns * std::uint64_t{16} + rows * std::uint64_t{8} > blockSize)
+        {
+            return false;
+        }
+
+        block.rows = rows;
+        block.minTime = reinterpret_cast<const std::uint64_t *>(begin)[2];
+        block.maxTime = reinterpret_cast<const std::uint64_t *>(begin)[3];
+        auto table = header + headerSize / 4;
+        block.times = reinterpret_cast<const std::uint64_t *>(table + columns * 4);
+        for (std::size_t i = 0; i != std::size(eventFields); ++i)
+        {
+            auto &column = block.columns[i];
+            column = {};
+            if (i >= columns || (fields >> i & 1) == 0)
+            {
+                continue;
+            }
+            // NB: a field added after the block was written reads as empty, a field it does not know is skipped
+            auto entry = table + i * 4;
+            std::uint64_t dictionary = entry[0], count = entry[1], codes = entry[2], width = entry[3];
+            if (count == 0)
+            {
+                continue;
+            }
+            auto units = dictionary + count * 4;
+            if (dictionary % 4 != 0 || units > blockSize || (width != 0 && width != 1 && width != 2 && width != 4) ||
+                codes % 4 != 0 || codes + width * rows > blockSize)
+            {
+                return false;
+            }
+            auto ends = reinterpret_cast<const std::uint32_t *>(begin + dictionary);
+            if (units + ends[count - 1] * std::uint64_t{sizeof(wchar_t)} > blockSize)
+            {
+                return false;
+            }
+            column = {ends, reinterpret_cast<const wchar_t *>(begin + units), static_cast<std::uint32_t>(count),
+                      begin + codes, static_cast<std::uint32_t>(width)};
+        }
+        offset += blockSize;
+        return true;
+    }
+
+    static constexpr std::size_t headerSize = 32;
+
+  private:
+    MappedFile file_;
+};
+
+// Appends events to a -history file, called by the parser only. The rows of a block are buffered with a
+// dictionary per field, a block is written once it is full or holds rows older than historyFlushInterval. The
+// buffers keep their capacity, so once the first block is written appending no longer allocates.
+class HistoryWriter
+{
+  public:
+    // Opens the history, a block an earlier crash cut short is dropped first. Only the given fields are stored.
+    HistoryWriter(const std::filesystem::path &file, FieldMask fields) : fields_(fields & ~FieldBit(L"SystemTime"sv))
+    {
+        std::size_t end = 0;
+        {
+            HistoryReader reader(file);
+            HistoryBlock block;
+            while (reader.Next(end, block, 0))
+            {
+            }
+        }
+        std::error_code error;
+        if (std::filesystem::file_size(file, error) > end && !error)
+        {
+            std::filesystem::resize_file(file, end);
+        }
+
+        stream_.open(file, std::ios::binary | std::ios::app);
+        if (!stream_)
+        {
+            std::terminate();
+        }
+    }
+
+    HistoryWriter(const HistoryWriter &) = delete;
+    HistoryWriter &operator=(const HistoryWriter &) = delete;
+
+    ~HistoryWriter()
+    {
+        Flush();
+    }
+
+    // time is the TimeCreated of the event in FILETIME ticks, 0 when unknown.
+    void Append(const EventLog &eventLog, std::uint64_t time)
+    {
+        if (times_.empty())
+        {
+            started_ = Clock::now();
+            minTime_ = maxTime_ = time;
+        }
+        minTime_ = std::min(minTime_, time);
+        maxTime_ = std::max(maxTime_, time);
+        times_.push_back(time);
+
+        for (std::size_t i = 0; i != std::size(eventFields); ++i)
+        {
+            if ((fields_ >> i & 1) == 0)
+            {
+                continue;
+            }
+            auto &column = columns_[i];
+            if (column.slots.empty())
+            {
+                column.slots.resize(historyBlockRows * 2);
+            }
+            auto value = eventLog.*eventFields[i].member;
+            auto mask = column.slots.size() - 1;
+            for (auto slot = std::hash<std::wstring_view>{}(value) & mask;; slot = (slot + 1) & mask)
+            {
+                auto &entry = column.slots[slot];
+                if (entry == 0)
+                {
+                    column.codes.push_back(static_cast<std::uint32_t>(column.ends.size()));
+                    column.units += value;
+                    column.ends.push_back(static_cast<std::uint32_t>(column.units.size()));
+                    entry = static_cast<std::uint32_t>(column.ends.size());
+                    bytes_ += value.size() * sizeof(wchar_t);
+                    break;
+                }
+                auto code = entry - 1;
+                auto begin = code == 0 ? 0 : column.ends[code - 1];
+                if (std::wstring_view(column.units).substr(begin, column.ends[code] - begin) == value)
+                {
+                    column.codes.push_back(code);
+                    break;
+                }
+            }
+        }
+
+        if (times_.size() == historyBlockRows || bytes_ >= historyBlockBytes)
+        {
+            Flush();
+        }
+    }
+
+    // Writes the block once its oldest row has waited for the interval, called whenever the parser wakes.
+    void Flush(Clock::time_point now)
+    {
+        if (!times_.empty() && now - started_ >= historyFlushInterval)
+        {
+            Flush();
+        }
+    }
+
+    void Flush()
+    {
+        if (times_.empty())
+        {
+            return;
+        }
+
+        auto rows = static_cast<std::uint32_t>(times_.size());
+        constexpr auto columns = static_cast<std::uint32_t>(std::size(eventFields));
+        block_.clear();
+        for (auto value : {historyMagic, std::uint32_t{}, rows, columns})
+        {
+            Put(value);
+        }
+        Put(minTime_);
+        Put(maxTime_);
+        auto table = block_.size();
+        block_.resize(table + columns * 16);
+        Put(times_.data(), times_.size());
+
+        for (std::size_t i = 0; i != columns; ++i)
+        {
+            auto &column = columns_[i];
+            std::uint32_t entry[4]{};
+            if (!column.ends.empty())
+            {
+                auto count = column.ends.size();
+                entry[0] = static_cast<std::uint32_t>(block_.size());
+                entry[1] = static_cast<std::uint32_t>(count);
+                Put(column.ends.data(), count);
+                Put(column.units.data(), column.units.size());
+                Pad();
+
+                entry[2] = static_cast<std::uint32_t>(block_.size());
+                entry[3] = count <= 1 ? 0 : count <= 0x100 ? 1 : count <= 0x10000 ? 2 : 4;
+                for (auto code : column.codes)
+                {
+                    if (entry[3] == 1)
+                    {
+                        Put(static_cast<std::uint8_t>(code));
+                    }
+                    else if (entry[3] == 2)
+                    {
+                        Put(static_cast<std::uint16_t>(code));
+                    }
+                    else if (entry[3] == 4)
+                    {
+                        Put(code);
+                    }
+                }
+                Pad();
+            }
+            std::memcpy(block_.data() + table + i * 16, entry, sizeof(entry));
+            std::ranges::fill(column.slots, 0);
+            column.ends.clear();
+            column.units.clear();
+            column.codes.clear();
+        }
+        auto size = static_cast<std::uint32_t>(block_.size());
+        std::memcpy(block_.data() + 4, &size, sizeof(size));
+
+        stream_.write(block_.data(), static_cast<std::streamsize>(block_.size()));
+        stream_.flush();
+        if (!stream_)
+        {
+            std::terminate();
+        }
+        times_.clear();
+        bytes_ = 0;
+    }
+
+  private:
+    // The dictionary of a field as it is written, with an open-addressing index over it. A block holds at most
+    // historyBlockRows values of a field, so the index stays at most half full and never grows.
+    struct Column
+    {
+        std::vector<std::uint32_t> slots; // code + 1 of the value hashed there, 0 when free
+        std::vector<std::uint32_t> ends;
+        std::wstring units;
+        std::vector<std::uint32_t> codes;
+    };
+
+    template <typename T>
+    void Put(const T *values, std::size_t count)
+    {
+        block_.append(reinterpret_cast<const char *>(values), count * sizeof(T));
+    }
+
+    template <typename T>
+    void Put(T value)
+    {
+        Put(&value, 1);
+    }
+
+    void Pad()
+    {
+        block_.resize((block_.size() + 7) & ~std::size_t{7});
+    }
+
+    FieldMask fields_;
+    std::ofstream stream_;
+    Column columns_[std::size(eventFields)];
+    std::vector<std::uint64_t> times_;
+    std::uint64_t minTime_{};
+    std::uint64_t maxTime_{};
+    std::size_t bytes_{};
+    Clock::time_point started_;
+    std::string block_;
+};
+
+// Event counts of a -history file by the values of up to maxGroupFields fields, keyed by the values joined by
+// L'\0'. Within a block the codes of the fields make one mixed-radix number, so that a row is counted with an
+// array or a hash of integers and only each distinct group of the block is looked up by its values.
+struct HistoryGroups
+{
+    std::unordered_map<std::wstring, std::uint64_t> counts;
+    std::uint64_t events{};  // in the history
+    std::uint64_t matched{}; // at or after since
+};
+
+inline void AggregateHistory(const HistoryReader &history, FieldMask fields, std::uint64_t since, HistoryGroups &groups)
+{
+    // groups of a block counted in an array when there are at most this many combinations
+    constexpr std::uint64_t denseGroups = 0x10000;
+
+    std::size_t indexes[maxGroupFields];
+    std::size_t count = 0;
+    for (std::size_t i = 0; i != std::size(eventFields) && count != maxGroupFields; ++i)
+    {
+        if ((fields >> i & 1) != 0)
+        {
+            indexes[count++] = i;
+        }
+    }
+
+    std::vector<std::uint64_t> rowGroups;
+    std::vector<std::uint32_t> dense;
+    std::unordered_map<std::uint64_t, std::uint32_t> sparse;
+    std::wstring key;
+    HistoryBlock block;
+    for (std::size_t offset = 0; history.Next(offset, block, fields);)
+    {
+        groups.events += block.rows;
+        if (block.maxTime < since)
+        {
+            continue;
+        }
+
+        // NB: each field has at most as many values as the block has rows, so the product fits in 64 bits
+        const HistoryColumn *columns[maxGroupFields];
+        std::uint64_t radixes[maxGroupFields];
+        std::uint64_t combinations = 1;
+        for (std::size_t j = 0; j != count; ++j)
+        {
+            columns[j] = &block.columns[indexes[j]];
+            radixes[j] = combinations;
+            combinations *= std::max(columns[j]->count, 1u);
+        }
+
+        // rows before since go to the extra group past the combinations, which is not counted
+        rowGroups.assign(block.rows, 0);
+        for (std::size_t j = 0; j != count; ++j)
+        {
+            columns[j]->AddCodes(radixes[j], rowGroups);
+        }
+        if (block.minTime < since)
+        {
+            for (std::size_t row = 0; row != block.rows; ++row)
+            {
+                if (block.times[row] < since)
+                {
+                    rowGroups[row] = combinations;
+                }
+            }
+        }
+
+        auto useDense = combinations <= denseGroups;
+        if (useDense)
+        {
+            dense.assign(combinations + 1, 0);
+            for (auto group : rowGroups)
+            {
+                ++dense[group];
+            }
+            dense.pop_back();
+        }
+        else
+        {
+            sparse.clear();
+            for (auto group : rowGroups)
+            {
+                if (group != combinations)
+                {
+                    ++sparse[group];
+                }
+            }
+        }
+
+        auto add = [&](std::uint64_t group, std::uint32_t rows) {
+            key.clear();
+            for (std::size_t j = 0; j != count; ++j)
+            {
+                auto column = columns[j];
+                if (j != 0)
+                {
+                    key += L'\0';
+                }
+                key += column->Value(static_cast<std::uint32_t>(group / radixes[j] % std::max(column->count, 1u)));
+            }
+            groups.counts[key] += rows;
+            groups.matched += rows;
+        };
+        if (useDense)
+        {
+            for (std::size_t group = 0; group != dense.size(); ++group)
+            {
+                if (dense[group] != 0)
+                {
+                    add(group, dense[group]);
+                }
+            }
+        }
+        else
+        {
+            for (auto [group, rows] : sparse)
+            {
+                add(group, rows);
+            }
+        }
+    }
+}
+
+} // namespace bizwen
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+#include "event_output.hpp"
+#include "text.hpp"
+
+namespace bizwen
+{
+
+using namespace std::literals;
+
+// Token bucket holding up to capacity tokens, refilled evenly so that capacity tokens accrue per period.
+// The caller passes the time so that the bucket does not depend on a particular clock.
+class TokenBucket
+{
+  public:
+    TokenBucket(std::uint32_t capacity, std::chrono::seconds period, Clock::time_point now) noexcept
+        : capacity_(capacity), tokens_(capacity), rate_(capacity / std::chrono::duration<double>(period).count()),
+          last_(now)
+    {
+    }
+
+    bool Available(Clock::time_point now) noexcept
+    {
+        tokens_ = std::min<double>(capacity_, tokens_ + std::chrono::duration<double>(now - last_).count() * rate_);
+        last_ = now;
+        return tokens_ >= 1;
+    }
+
+    bool TryTake(Clock::time_point now) noexcept
+    {
+        if (!Available(now))
+        {
+            return false;
+        }
+        tokens_ -= 1;
+        return true;
+    }
+
+  private:
+    double capacity_;
+    double tokens_;
+    double rate_; // tokens per second
+    Clock::time_point last_;
+};
+
+// Admission control for one sink. Events within the budget pass unchanged. Over budget the sink degrades: the
+// minimal text of each event is collected into a digest of bounded size, events beyond that are only counted,
+// and the sink later receives the digest as one message as soon as the budget allows.
+class SinkLimiter
+{
+  public:
+    SinkLimiter(SinkLimit limit, Clock::time_point now) noexcept
+        : bucket_(limit.count, std::chrono::seconds(limit.seconds), now)
+    {
+    }
+
+    // Returns false when the event was deferred into the digest.
+    bool Admit(EventOutput &output, Clock::time_point now)
+    {
+        // NB: while a digest is pending new events join it, so that the output keeps its order
+        if (deferred_ == 0 && bucket_.TryTake(now))
+        {
+            return true;
+        }
+
+        ++deferred_;
+        ++totalDeferred_;
+        auto text = output.MinimalText();
+        if (digest_.size() + text.size() + 1 <= digestLimit)
+        {
+            digest_ += text;
+            digest_ += L'\n';
+        }
+        else
+        {
+            ++omitted_;
+            ++totalOmitted_;
+        }
+        return false;
+    }
+
+    bool DigestReady(Clock::time_point now) noexcept
+    {
+        return deferred_ != 0 && bucket_.Available(now);
+    }
+
+    // Writes the digest to output and consumes a token, call only after DigestReady returned true.
+    void TakeDigest(std::wstring &output, Clock::time_point now)
+    {
+        bucket_.TryTake(now);
+        AppendNumber(deferred_, output);
+        output += L" application errors were held back by the output limit:\n\n"sv;
+        output += digest_;
+        if (omitted_ != 0)
+        {
+            AppendNumber(omitted_, output);
+            output += L" more not shown.\n"sv;
+        }
+        digest_.clear();
+        deferred_ = 0;
+        omitted_ = 0;
+    }
+
+    // Events folded into digests, and those of them that did not fit into their digest.
+    std::uint64_t Deferred() const noexcept
+    {
+        return totalDeferred_;
+    }
+
+    std::uint64_t Omitted() const noexcept
+    {
+        return totalOmitted_;
+    }
+
+  private:
+    static constexpr std::size_t digestLimit = 4096;
+
+    TokenBucket bucket_;
+    std::wstring digest_;
+    std::uint64_t deferred_{};
+    std::uint64_t omitted_{};
+    std::uint64_t totalDeferred_{};
+    std::uint64_t totalOmitted_{};
+};
+
+} // namespace bizwen
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <exception>
+#include <filesystem>
+#ifdef _WIN32
+#include <winsock2.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace bizwen
+{
+
+// A read-only view of a whole file. A file that is not required may fail to open or map, it is then empty.
+class MappedFile
+{
+  public:
+    explicit MappedFile(const std::filesystem::path &path, bool required = true)
+    {
+        if (!Map(path) && required)
+        {
+            std::terminate();
+        }
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if (data_ != nullptr)
+        {
+            ::UnmapViewOfFile(data_);
+        }
+        if (hMapping_ != nullptr)
+        {
+            ::CloseHandle(hMapping_);
+        }
+        if (hFile_ != INVALID_HANDLE_VALUE)
+        {
+            ::CloseHandle(hFile_);
+        }
+#else
+        if (data_ != nullptr)
+        {
+            ::munmap(data_, size_);
+        }
+#endif
+    }
+
+    // NB: the view is page aligned, so it can be read as UTF-16 as well
+    const void *Data() const noexcept
+    {
+        return data_;
+    }
+
+    std::size_t Size() const noexcept
+    {
+        return size_;
+    }
+
+  private:
+#ifdef _WIN32
+    bool Map(const std::filesystem::path &path) noexcept
+    {
+        // NB: shared for writing, as -top reads the history the running instance appends to
+        hFile_ = ::CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (hFile_ == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+
+        LARGE_INTEGER size;
+        if (!::GetFileSizeEx(hFile_, &size))
+        {
+            return false;
+        }
+        // NB: an empty file cannot be mapped
+        if (size.QuadPart == 0)
+        {
+            return true;
+        }
+
+        hMapping_ = ::CreateFileMappingW(hFile_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (hMapping_ == nullptr)
+        {
+            return false;
+        }
+        data_ = ::MapViewOfFile(hMapping_, FILE_MAP_READ, 0, 0, 0);
+        if (data_ == nullptr)
+        {
+            return false;
+        }
+        size_ = static_cast<std::size_t>(size.QuadPart);
+        return true;
+    }
+
+    HANDLE hFile_ = INVALID_HANDLE_VALUE;
+    HANDLE hMapping_{};
+#else
+    bool Map(const std::filesystem::path &path) noexcept
+    {
+        // NB: the mapping stays valid once the descriptor is closed
+        auto file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (file == -1)
+        {
+            return false;
+        }
+
+        struct stat status;
+        if (::fstat(file, &status) != 0)
+        {
+            ::close(file);
+            return false;
+        }
+        // NB: an empty file cannot be mapped
+        if (status.st_size == 0)
+        {
+            ::close(file);
+            return true;
+        }
+
+        auto data = ::mmap(nullptr, static_cast<std::size_t>(status.st_size), PROT_READ, MAP_SHARED, file, 0);
+        ::close(file);
+        if (data == MAP_FAILED)
+        {
+            return false;
+        }
+        data_ = data;
+        size_ = static_cast<std::size_t>(status.st_size);
+        return true;
+    }
+#endif
+
+    void *data_{};
+    std::size_t size_{};
+};
+
+} // namespace bizwen
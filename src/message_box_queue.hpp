@@ -0,0 +1,98 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+
+#include "text.hpp"
+
+namespace bizwen
+{
+
+using namespace std::literals;
+
+// Messages waiting for the MessageBox dialog. The first message after the dialog closes shows on its own, those
+// that come while it is open fold into the next dialog up to a bounded size and are only counted beyond it, so
+// memory stays the same however fast they arrive.
+class MessageBoxQueue
+{
+  public:
+    void Post(std::wstring_view message)
+    {
+        {
+            std::lock_guard lock(mutex_);
+            // NB: a lone message is never cut, so that it shows as it did without folding
+            if (count_ == 0 || pending_.size() + message.size() + 1 <= foldLimit)
+            {
+                pending_ += message;
+                pending_ += L'\n';
+            }
+            else
+            {
+                ++omitted_;
+            }
+            ++count_;
+        }
+        condition_.notify_one();
+    }
+
+    // Waits for the next dialog and writes its text to message, returns false once closed.
+    bool Wait(std::wstring &message)
+    {
+        std::unique_lock lock(mutex_);
+        condition_.wait(lock, [this] { return count_ != 0 || closed_; });
+        if (closed_)
+        {
+            return false;
+        }
+
+        message.clear();
+        if (count_ == 1)
+        {
+            message.assign(pending_, 0, pending_.size() - 1);
+        }
+        else
+        {
+            AppendNumber(count_, message);
+            message += L" application errors occurred while the previous message was open:\n\n"sv;
+            message += pending_;
+            if (omitted_ != 0)
+            {
+                AppendNumber(omitted_, message);
+                message += L" more not shown.\n"sv;
+            }
+        }
+        pending_.clear();
+        count_ = 0;
+        omitted_ = 0;
+        return true;
+    }
+
+    // Messages still waiting are dropped.
+    void Close()
+    {
+        {
+            std::lock_guard lock(mutex_);
+            closed_ = true;
+        }
+        condition_.notify_one();
+    }
+
+    bool Closed()
+    {
+        std::lock_guard lock(mutex_);
+        return closed_;
+    }
+
+  private:
+    static constexpr std::size_t foldLimit = 4096;
+
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::wstring pending_;
+    std::uint64_t count_{};
+    std::uint64_t omitted_{};
+    bool closed_ = false;
+};
+
+} // namespace bizwen
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <exception>
+#include <string>
+#include <thread>
+// NB: before windows.h, which includes the older winsock.h otherwise
+#include <winsock2.h>
+#include <windows.h>
+
+#include "message_box_queue.hpp"
+
+namespace bizwen
+{
+
+// The one thread of the MessageBox sink that shows its dialogs, one at a time. A dialog still open when the
+// sink stops is closed, like exiting the process closed those of the threads each message had before.
+class MessageBoxWorker
+{
+  public:
+    MessageBoxWorker() : thread_(&MessageBoxWorker::Run, this)
+    {
+    }
+
+    MessageBoxWorker(const MessageBoxWorker &) = delete;
+    MessageBoxWorker &operator=(const MessageBoxWorker &) = delete;
+
+    ~MessageBoxWorker()
+    {
+        queue_.Close();
+        // NB: WM_QUIT ends the modal loop of an open dialog; before the thread has a message queue posting fails,
+        // but then it has not shown a dialog yet and sees the queue closed first
+        ::PostThreadMessageW(::GetThreadId(thread_.native_handle()), WM_QUIT, 0, 0);
+        thread_.join();
+    }
+
+    void Post(std::wstring_view message)
+    {
+        queue_.Post(message);
+    }
+
+  private:
+    void Run()
+    {
+        if (::SetThreadDpiAwarenessContext(DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE_V2) == nullptr)
+        {
+            std::terminate();
+        }
+        // creates the message queue of the thread
+        MSG msg;
+        ::PeekMessageW(&msg, nullptr, WM_USER, WM_USER, PM_NOREMOVE);
+
+        std::wstring message;
+        while (queue_.Wait(message))
+        {
+            if (::MessageBoxW(nullptr, message.c_str(), L"Application Error", MB_TOPMOST | MB_OK | MB_ICONERROR) == 0 &&
+                !queue_.Closed())
+            {
+                std::terminate();
+            }
+        }
+    }
+
+    MessageBoxQueue queue_;
+    std::thread thread_;
+};
+
+} // namespace bizwen
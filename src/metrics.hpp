@@ -0,0 +1,160 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <iterator>
+#include <string>
+
+#include "options.hpp"
+#include "text.hpp"
+
+namespace bizwen
+{
+
+using namespace std::literals;
+
+// Log-linear histogram in the manner of HdrHistogram: values below 16 are exact, above that every power of two is
+// split into 16 buckets, so any value is reported within 1/16 of itself. Recording costs an index computation and
+// two stores. There is a single writer, readers may see it mid-update.
+class Histogram
+{
+  public:
+    void Record(std::uint64_t value) noexcept
+    {
+        Increment(buckets_[Index(value)]);
+        Increment(count_);
+        if (value > max_.load(std::memory_order_relaxed))
+        {
+            max_.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    std::uint64_t Count() const noexcept
+    {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t Max() const noexcept
+    {
+        return max_.load(std::memory_order_relaxed);
+    }
+
+    // The upper end of the bucket holding the given per mille of the values.
+    std::uint64_t Percentile(unsigned perMille) const noexcept
+    {
+        auto rank = (Count() * perMille + 999) / 1000;
+        std::uint64_t seen{};
+        for (std::size_t i = 0; i != std::size(buckets_); ++i)
+        {
+            seen += buckets_[i].load(std::memory_order_relaxed);
+            if (seen >= rank && seen != 0 && i + 1 != std::size(buckets_))
+            {
+                return std::min(Lowest(i + 1) - 1, Max());
+            }
+        }
+        return Max();
+    }
+
+  private:
+    static constexpr unsigned subBits = 4;
+
+    static std::size_t Index(std::uint64_t value) noexcept
+    {
+        if (value < (1u << subBits))
+        {
+            return static_cast<std::size_t>(value);
+        }
+        auto msb = static_cast<unsigned>(std::bit_width(value)) - 1;
+        return ((msb - subBits + 1) << subBits) + ((value >> (msb - subBits)) & ((1u << subBits) - 1));
+    }
+
+    static std::uint64_t Lowest(std::size_t index) noexcept
+    {
+        if (index < (1u << subBits))
+        {
+            return index;
+        }
+        auto msb = static_cast<unsigned>(index >> subBits) + subBits - 1;
+        return ((1u << subBits) + (index & ((1u << subBits) - 1))) << (msb - subBits);
+    }
+
+    static void Increment(std::atomic<std::uint64_t> &counter) noexcept
+    {
+        // NB: single writer, so no read-modify-write is needed
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    std::atomic<std::uint64_t> buckets_[(64 - subBits + 1) << subBits]{};
+    std::atomic<std::uint64_t> count_{};
+    std::atomic<std::uint64_t> max_{};
+};
+
+// A count with a single writer that any thread may read.
+class Counter
+{
+  public:
+    void Add(std::uint64_t count) noexcept
+    {
+        value_.store(value_.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+    }
+
+    std::uint64_t Value() const noexcept
+    {
+        return value_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<std::uint64_t> value_{};
+};
+
+// Instrumentation for -stats. Every group is written by one thread only, the collector, the parser or a sink
+// worker, so recording needs no shared cache lines and no locks. Durations are in nanoseconds, ages in 100ns
+// ticks from TimeCreated of the event.
+struct Metrics
+{
+    struct alignas(64) Collector
+    {
+        Counter received;
+        Histogram next;   // EvtNext per batch
+        Histogram render; // PrintEvent or rendering values per event
+    } collector;
+
+    struct alignas(64) Parser
+    {
+        Counter parsed;
+        Counter filtered;
+        Counter coalesced;
+        Counter correlated;
+        Histogram parse; // ParseEventLog per event
+    } parser;
+
+    // indexed like sinkMethods, dispatched is counted by the parser
+    struct alignas(64) Sink
+    {
+        Counter dispatched;
+        Counter completed;
+        Histogram output; // DispatchOutput per event
+        Histogram age;    // TimeCreated to completion
+    } sinks[std::size(sinkMethods)];
+};
+
+// "name p50 x, p99 y, max z", scale converts the recorded values to nanoseconds.
+inline void AppendHistogram(std::wstring_view name, const Histogram &histogram, std::wstring &output,
+                            std::uint64_t scale = 1)
+{
+    output += name;
+    if (histogram.Count() == 0)
+    {
+        output += L" -"sv;
+        return;
+    }
+    output += L" p50 "sv;
+    AppendDuration(histogram.Percentile(500) * scale, output);
+    output += L", p99 "sv;
+    AppendDuration(histogram.Percentile(990) * scale, output);
+    output += L", max "sv;
+    AppendDuration(histogram.Max() * scale, output);
+}
+
+} // namespace bizwen
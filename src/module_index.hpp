@@ -0,0 +1,388 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <filesystem>
+#include <functional>
+#include <limits>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "event_log.hpp"
+#include "mapped_file.hpp"
+#include "text.hpp"
+
+namespace bizwen
+{
+
+using namespace std::literals;
+
+// The exported functions and the sections of a PE image, parsed from the bytes of the file alone so that an
+// image built for any machine can be indexed. Every read is bounds checked, a truncated or malformed file only
+// yields a smaller index.
+class ModuleIndex
+{
+  public:
+    // Indexes image, returns false when it is not a PE image or when timeStamp, unless 0, is not its
+    // TimeDateStamp. The index is empty then.
+    bool Parse(std::span<const std::byte> image, std::uint32_t timeStamp)
+    {
+        names_.clear();
+        sections_.clear();
+        symbols_.clear();
+
+        Reader reader{image};
+        std::size_t pe = reader.U32(0x3c);
+        if (reader.U16(0) != 0x5a4d || reader.U32(pe) != 0x4550) // MZ, PE\0\0
+        {
+            return false;
+        }
+        if (timeStamp != 0 && reader.U32(pe + 8) != timeStamp)
+        {
+            return false;
+        }
+
+        auto optional = pe + 24;
+        std::size_t directories;
+        switch (reader.U16(optional))
+        {
+        case 0x10b: // PE32
+            directories = optional + 96;
+            break;
+        case 0x20b: // PE32+
+            directories = optional + 112;
+            break;
+        default:
+            return false;
+        }
+
+        // NB: the loader refuses images with more sections than this
+        auto sectionCount = std::min(reader.U16(pe + 6), 96u);
+        for (std::size_t i = 0, header = optional + reader.U16(pe + 20); i != sectionCount; ++i, header += 40)
+        {
+            Section section{static_cast<std::uint32_t>(names_.size())};
+            for (std::size_t j = 0; j != 8 && reader.U8(header + j) != 0; ++j)
+            {
+                names_ += static_cast<wchar_t>(reader.U8(header + j));
+            }
+            section.nameLength = static_cast<std::uint32_t>(names_.size()) - section.nameOffset;
+            section.rva = reader.U32(header + 12);
+            section.rawSize = reader.U32(header + 16);
+            section.size = std::max(reader.U32(header + 8), section.rawSize);
+            section.raw = reader.U32(header + 20);
+            sections_.push_back(section);
+        }
+
+        if (reader.U32(directories - 4) != 0)
+        {
+            ParseExports(reader, reader.U32(directories), reader.U32(directories + 4));
+        }
+        std::ranges::sort(symbols_, {}, &Symbol::rva);
+        return true;
+    }
+
+    // Appends the nearest exported function at or before rva in the same section and the displacement from it,
+    // such as RaiseException+0x6c, or the section and the offset into it when there is no such function.
+    // Returns false when rva lies in no section.
+    bool Resolve(std::uint32_t rva, std::wstring &output) const
+    {
+        auto section =
+            std::ranges::find_if(sections_, [rva](const Section &other) { return rva - other.rva < other.size; });
+        if (section == sections_.end())
+        {
+            return false;
+        }
+
+        auto nameOffset = section->nameOffset;
+        auto nameLength = section->nameLength;
+        auto base = section->rva;
+        auto symbol = std::ranges::upper_bound(symbols_, rva, {}, &Symbol::rva);
+        if (symbol != symbols_.begin() && (--symbol)->rva >= section->rva)
+        {
+            nameOffset = symbol->nameOffset;
+            nameLength = symbol->nameLength;
+            base = symbol->rva;
+        }
+        output.append(names_, nameOffset, nameLength);
+        if (rva != base)
+        {
+            output += L"+0x"sv;
+            AppendNumber(rva - base, output, 16);
+        }
+        return true;
+    }
+
+  private:
+    static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+    static constexpr std::size_t maxNameLength = 512;
+
+    // little-endian reads that yield 0 past the end of the image
+    struct Reader
+    {
+        std::span<const std::byte> image;
+
+        std::uint32_t Read(std::size_t offset, std::size_t size) const noexcept
+        {
+            std::uint32_t value{};
+            if (offset <= image.size() && size <= image.size() - offset)
+            {
+                for (auto i = size; i-- != 0;)
+                {
+                    value = value << 8 | std::to_integer<std::uint32_t>(image[offset + i]);
+                }
+            }
+            return value;
+        }
+
+        std::uint32_t U8(std::size_t offset) const noexcept
+        {
+            return Read(offset, 1);
+        }
+
+        std::uint32_t U16(std::size_t offset) const noexcept
+        {
+            return Read(offset, 2);
+        }
+
+        std::uint32_t U32(std::size_t offset) const noexcept
+        {
+            return Read(offset, 4);
+        }
+    };
+
+    struct Section
+    {
+        std::uint32_t nameOffset{}; // into names_
+        std::uint32_t nameLength{};
+        std::uint32_t rva{};
+        std::uint32_t size{};
+        std::uint32_t raw{}; // file offset of the data
+        std::uint32_t rawSize{};
+    };
+
+    struct Symbol
+    {
+        std::uint32_t rva;
+        std::uint32_t nameOffset;
+        std::uint32_t nameLength;
+    };
+
+    // The file offset of rva, npos when it is not backed by the file.
+    std::size_t FileOffset(std::uint32_t rva) const noexcept
+    {
+        for (auto &section : sections_)
+        {
+            if (rva - section.rva < section.rawSize)
+            {
+                return std::size_t{section.raw} + (rva - section.rva);
+            }
+        }
+        return npos;
+    }
+
+    void ParseExports(const Reader &reader, std::uint32_t directoryRva, std::uint32_t directorySize)
+    {
+        auto directory = FileOffset(directoryRva);
+        if (directory == npos)
+        {
+            return;
+        }
+        auto ordinalBase = reader.U32(directory + 16);
+        // NB: the counts come from the file, they are capped by what it can hold
+        auto functionCount = std::min<std::size_t>(reader.U32(directory + 20), reader.image.size() / 4);
+        auto nameCount = std::min<std::size_t>(reader.U32(directory + 24), reader.image.size() / 4);
+        auto functions = FileOffset(reader.U32(directory + 28));
+        auto names = FileOffset(reader.U32(directory + 32));
+        auto ordinals = FileOffset(reader.U32(directory + 36));
+        if (functions == npos)
+        {
+            return;
+        }
+
+        // the name of each function, if any, as an index into the name pointers
+        std::vector<std::uint32_t> named(functionCount, std::numeric_limits<std::uint32_t>::max());
+        if (names != npos && ordinals != npos)
+        {
+            for (std::size_t i = 0; i != nameCount; ++i)
+            {
+                auto function = reader.U16(ordinals + i * 2);
+                if (function < functionCount)
+                {
+                    named[function] = static_cast<std::uint32_t>(i);
+                }
+            }
+        }
+
+        symbols_.reserve(functionCount);
+        for (std::size_t i = 0; i != functionCount; ++i)
+        {
+            auto rva = reader.U32(functions + i * 4);
+            // unused ordinals are 0, forwarders point at a name in the export directory instead of code
+            if (rva == 0 || rva - directoryRva < directorySize)
+            {
+                continue;
+            }
+
+            auto nameOffset = names_.size();
+            auto name = named[i] != std::numeric_limits<std::uint32_t>::max()
+                            ? FileOffset(reader.U32(names + named[i] * std::size_t{4}))
+                            : npos;
+            for (auto end = name == npos ? name : name + maxNameLength; name != end && reader.U8(name) != 0; ++name)
+            {
+                names_ += static_cast<wchar_t>(reader.U8(name));
+            }
+            if (names_.size() == nameOffset)
+            {
+                names_ += L'#';
+                AppendNumber(ordinalBase + i, names_);
+            }
+            symbols_.push_back({rva, static_cast<std::uint32_t>(nameOffset),
+                                static_cast<std::uint32_t>(names_.size() - nameOffset)});
+        }
+    }
+
+    std::wstring names_;
+    std::vector<Section> sections_;
+    std::vector<Symbol> symbols_;
+};
+
+// Resolves the faulting offsets of -symbolize against the exports of the faulting module. The index of a module
+// is parsed on first use and kept in a fixed number of entries keyed by ModulePath and ModuleTimeStamp, the
+// least recently used one is parsed again once they are all in use, so repeated crashes in one DLL cost a hash
+// lookup. A module that cannot be read or was replaced since the crash is cached too, with an empty index.
+// NB: a module is parsed on the parser thread, the events behind it wait for that one read
+class ModuleSymbolizer
+{
+  public:
+    static constexpr FieldMask keyFields =
+        FieldBit(L"ModuleTimeStamp"sv) | FieldBit(L"FaultingOffset"sv) | FieldBit(L"ModulePath"sv);
+
+    explicit ModuleSymbolizer(std::size_t capacity)
+        : entries_(capacity), buckets_(std::bit_ceil(capacity * 2), none)
+    {
+    }
+
+    // Appends the symbol of the faulting offset to arena.content and points eventLog.faultingSymbol at it.
+    void Symbolize(EventArena &arena)
+    {
+        auto &eventLog = arena.eventLog;
+        auto offset = ParseEventNumber(eventLog.faultingOffset);
+        if (eventLog.modulePath.empty() || offset == 0 || offset > std::numeric_limits<std::uint32_t>::max())
+        {
+            return;
+        }
+
+        auto &index = Find(eventLog.modulePath, eventLog.moduleTimeStamp);
+        auto &content = arena.content;
+        auto from = content.data();
+        auto start = content.size();
+        if (!index.Resolve(static_cast<std::uint32_t>(offset), content))
+        {
+            return;
+        }
+        // NB: appending may have reallocated the buffer the fields point into
+        RebaseEventLog(eventLog, from, content.data());
+        eventLog.faultingSymbol = std::wstring_view(content).substr(start);
+    }
+
+  private:
+    static constexpr std::uint32_t none = std::numeric_limits<std::uint32_t>::max();
+
+    struct Entry
+    {
+        std::wstring key; // the path, case folded
+        std::uint32_t timeStamp{};
+        std::size_t hash{};
+        std::uint32_t chain = none; // next entry in the same bucket
+        std::uint32_t prev = none;  // neighbours from the least to the most recently used
+        std::uint32_t next = none;
+        ModuleIndex index;
+    };
+
+    ModuleIndex &Find(std::wstring_view path, std::wstring_view timeStamp)
+    {
+        key_.clear();
+        for (auto ch : path)
+        {
+            key_ += ch >= L'A' && ch <= L'Z' ? static_cast<wchar_t>(ch - L'A' + L'a') : ch;
+        }
+        auto stamp = static_cast<std::uint32_t>(ParseEventNumber(timeStamp, 16));
+        auto hash = std::hash<std::wstring_view>{}(key_) ^ stamp;
+        auto &bucket = buckets_[hash & (buckets_.size() - 1)];
+
+        for (auto index = bucket; index != none; index = entries_[index].chain)
+        {
+            auto &entry = entries_[index];
+            if (entry.hash == hash && entry.timeStamp == stamp && entry.key == key_)
+            {
+                Detach(index);
+                Append(index);
+                return entry.index;
+            }
+        }
+
+        std::uint32_t index;
+        if (size_ != entries_.size())
+        {
+            index = size_++;
+        }
+        else
+        {
+            index = head_;
+            Unlink(index);
+        }
+
+        auto &entry = entries_[index];
+        entry.key.assign(key_);
+        entry.timeStamp = stamp;
+        entry.hash = hash;
+        entry.chain = bucket;
+        bucket = index;
+        Append(index);
+
+        MappedFile file(std::filesystem::path(path), false);
+        entry.index.Parse(std::span(static_cast<const std::byte *>(file.Data()), file.Size()), stamp);
+        return entry.index;
+    }
+
+    void Append(std::uint32_t index) noexcept
+    {
+        auto &entry = entries_[index];
+        entry.prev = tail_;
+        entry.next = none;
+        (tail_ == none ? head_ : entries_[tail_].next) = index;
+        tail_ = index;
+    }
+
+    void Detach(std::uint32_t index) noexcept
+    {
+        auto &entry = entries_[index];
+        (entry.prev == none ? head_ : entries_[entry.prev].next) = entry.next;
+        (entry.next == none ? tail_ : entries_[entry.next].prev) = entry.prev;
+    }
+
+    // removes the entry from both its bucket and the use order
+    void Unlink(std::uint32_t index) noexcept
+    {
+        Detach(index);
+        for (auto *link = &buckets_[entries_[index].hash & (buckets_.size() - 1)]; *link != none;
+             link = &entries_[*link].chain)
+        {
+            if (*link == index)
+            {
+                *link = entries_[index].chain;
+                break;
+            }
+        }
+    }
+
+    std::vector<Entry> entries_;
+    std::vector<std::uint32_t> buckets_;
+    std::uint32_t size_{};
+    std::uint32_t head_ = none;
+    std::uint32_t tail_ = none;
+    std::wstring key_;
+};
+
+} // namespace bizwen
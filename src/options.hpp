@@ -0,0 +1,514 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <exception>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "event_filter.hpp"
+#include "event_format.hpp"
+
+namespace bizwen
+{
+
+using namespace std::literals;
+
+enum class PrintMethod
+{
+    console = 0b1,
+    messagebox = 0b10,
+    notepad = 0b100,
+    powershell = 0b1000,
+    notification = 0b10000,
+    forward = 0b100000
+};
+
+constexpr PrintMethod &operator|=(PrintMethod &a, PrintMethod b) noexcept
+{
+    return a = static_cast<PrintMethod>(std::to_underlying(a) | std::to_underlying(b));
+}
+
+constexpr bool operator&(PrintMethod a, PrintMethod b) noexcept
+{
+    return (std::to_underlying(a) & std::to_underlying(b)) != 0;
+}
+
+// Every PrintMethod is a sink, the index into these tables identifies the sink.
+constexpr PrintMethod sinkMethods[]{PrintMethod::console, PrintMethod::messagebox, PrintMethod::notepad,
+                                    PrintMethod::powershell, PrintMethod::notification, PrintMethod::forward};
+
+constexpr std::wstring_view sinkNames[]{L"console"sv, L"messagebox"sv, L"notepad"sv, L"powershell"sv,
+                                        L"notification"sv, L"forward"sv};
+
+static_assert(std::size(sinkMethods) == std::size(sinkNames));
+
+constexpr std::size_t messageBoxSink = std::ranges::find(sinkMethods, PrintMethod::messagebox) - sinkMethods;
+constexpr std::size_t notificationSink = std::ranges::find(sinkMethods, PrintMethod::notification) - sinkMethods;
+constexpr std::size_t forwardSink = std::ranges::find(sinkMethods, PrintMethod::forward) - sinkMethods;
+
+enum class RunMode
+{
+    console,
+    silent,
+    kill,
+    help,
+    ingest,
+    benchmark,
+    query,
+    history
+};
+
+// The receiver -forward sends the events to.
+struct ForwardTarget
+{
+    bool tcp = false;
+    std::wstring host;
+    std::wstring port;
+};
+
+// At most count events per seconds for one sink, a count of 0 means unlimited.
+struct SinkLimit
+{
+    std::uint32_t count{};
+    std::uint32_t seconds{};
+};
+
+// -groupby counts the history events by the values of at most this many fields
+constexpr std::size_t maxGroupFields = 4;
+
+struct Options
+{
+    PrintMethod method{};
+    PrintStyle style{};
+    RunMode mode{};
+
+    // number of events fetched from the event log per EvtNext call
+    std::uint32_t batchSize = 16;
+    // number of events in flight between collection and output
+    std::uint32_t queueSize = 64;
+    // number of events waiting for each sink before further events are dropped for it
+    std::uint32_t sinkQueueSize = 8;
+    // repeated faults with the same signature within this many seconds are summarized, 0 disables coalescing
+    std::uint32_t coalesceSeconds = 0;
+    // number of fault signatures tracked for coalescing
+    std::uint32_t coalesceTableSize = 256;
+    // the fault, report and .NET Runtime events of one crash within this many seconds make one incident, 0 disables
+    std::uint32_t correlateSeconds = 0;
+    // faulting offsets are resolved to the nearest export of the faulting module
+    bool symbolize = false;
+    // rate limit of each sink, indexed like sinkMethods
+    SinkLimit sinkLimits[std::size(sinkMethods)]{};
+    // file listing the channels and queries watched, empty for the errors of the Application channel
+    std::wstring channelsFile;
+    // file keeping the read position across runs, empty for none
+    std::wstring bookmarkFile;
+    // errors of this many seconds before start are replayed when there is no bookmark to resume from
+    std::uint32_t sinceSeconds = 0;
+    // files of exported events processed instead of the live channel
+    std::vector<std::wstring> ingestFiles;
+    // number of threads parsing ingestFiles, more than one bypasses the pipeline
+    std::uint32_t jobs = 1;
+    // -benchmark results are also written here, empty for none
+    std::wstring benchmarkFile;
+    // -benchmark results of an earlier run that this run must not be slower than
+    std::wstring baselineFile;
+    // instrument the pipeline and publish the report for -query
+    bool stats = false;
+    // the report is also written to the console this often, 0 only on exit
+    std::uint32_t statsSeconds = 0;
+    // every event is appended to segments of this file, which viewers open instead of temp files, empty for none
+    std::wstring logFile;
+    // a segment of logFile is rotated once it would grow beyond this many KiB
+    std::uint32_t logSizeKiB = 4096;
+    // or once it is this many seconds old
+    std::uint32_t logSeconds = 86400;
+    // fields extracted from the events and printed, the other ones are never copied or formatted
+    FieldMask fields = allFields;
+    // -include and -exclude rules in the order given
+    std::vector<FilterRule> filters;
+    // every event is appended to this crash history, which -top and -groupby query, empty for none
+    std::wstring historyFile;
+    // the history query prints this many groups, 0 for all of them
+    std::uint32_t top = 0;
+    // the fields the history query groups the events by
+    FieldMask groupBy = FieldBit(L"AppName"sv);
+    // events are forwarded here with PrintMethod::forward
+    ForwardTarget forward;
+    // forwarded batches the receiver did not take wait here, empty for a file in the temp directory
+    std::wstring spoolFile;
+    // batches are forwarded to a TCP receiver compressed
+    bool compress = false;
+};
+
+inline std::uint32_t ParseOptionNumber(std::wstring_view value)
+{
+    if (value.empty())
+    {
+        std::terminate();
+    }
+
+    std::uint32_t number{};
+    for (auto ch : value)
+    {
+        if (ch < L'0' || ch > L'9' || number > (std::numeric_limits<std::uint32_t>::max() - 9) / 10)
+        {
+            std::terminate();
+        }
+        number = number * 10 + static_cast<std::uint32_t>(ch - L'0');
+    }
+    return number;
+}
+
+// The fields named by a comma-separated list of labels, 0 if any of them is not a label.
+inline FieldMask ParseFieldList(std::wstring_view names) noexcept
+{
+    FieldMask fields{};
+    while (true)
+    {
+        auto comma = names.find(L',');
+        auto field = FieldBit(names.substr(0, comma));
+        if (field == 0)
+        {
+            return 0;
+        }
+        fields |= field;
+        if (comma == std::wstring_view::npos)
+        {
+            return fields;
+        }
+        names.remove_prefix(comma + 1);
+    }
+}
+
+// tcp://host:port or udp://host:port, a literal IPv6 address in brackets.
+inline bool ParseForwardTarget(std::wstring_view url, ForwardTarget &target)
+{
+    if (url.starts_with(L"tcp://"sv))
+    {
+        target.tcp = true;
+    }
+    else if (!url.starts_with(L"udp://"sv))
+    {
+        return false;
+    }
+    url.remove_prefix(6);
+
+    auto colon = url.rfind(L':');
+    if (colon == std::wstring_view::npos || colon == 0 || colon + 1 == url.size() ||
+        url.find_first_not_of(L"0123456789"sv, colon + 1) != std::wstring_view::npos)
+    {
+        return false;
+    }
+    auto host = url.substr(0, colon);
+    if (host.starts_with(L'[') && host.ends_with(L']'))
+    {
+        host = host.substr(1, host.size() - 2);
+    }
+    else if (host.find(L':') != std::wstring_view::npos)
+    {
+        return false;
+    }
+    target.host = host;
+    target.port = url.substr(colon + 1);
+    return !target.host.empty();
+}
+
+inline void ParseArguments(std::wstring_view arg, Options &options)
+{
+    if (arg == L"-messagebox"sv)
+    {
+        options.method |= PrintMethod::messagebox;
+    }
+    else if (arg == L"-notepad"sv)
+    {
+        options.method |= PrintMethod::notepad;
+    }
+    else if (arg == L"-powershell"sv)
+    {
+        options.method |= PrintMethod::powershell;
+    }
+    else if (arg == L"-notification"sv)
+    {
+        options.method |= PrintMethod::notification;
+    }
+    else if (arg == L"-text"sv)
+    {
+        options.style = PrintStyle::text;
+    }
+    else if (arg == L"-xml"sv)
+    {
+        options.style = PrintStyle::xml;
+    }
+    else if (arg == L"-jsonl"sv)
+    {
+        options.style = PrintStyle::jsonl;
+    }
+    else if (arg == L"-binary"sv)
+    {
+        options.style = PrintStyle::binary;
+    }
+    else if (arg == L"-console"sv)
+    {
+        options.mode = RunMode::console;
+    }
+    else if (arg == L"-silent"sv)
+    {
+        options.mode = RunMode::silent;
+    }
+    else if (arg == L"-kill")
+    {
+        options.mode = RunMode::kill;
+    }
+    else if (arg == L"-help")
+    {
+        options.mode = RunMode::help;
+    }
+    else if (arg.starts_with(L"-batch="sv))
+    {
+        options.batchSize = ParseOptionNumber(arg.substr(7));
+        if (options.batchSize == 0)
+        {
+            std::terminate();
+        }
+    }
+    else if (arg.starts_with(L"-queue="sv))
+    {
+        options.queueSize = ParseOptionNumber(arg.substr(7));
+        if (options.queueSize == 0)
+        {
+            std::terminate();
+        }
+    }
+    else if (arg.starts_with(L"-sinkqueue="sv))
+    {
+        options.sinkQueueSize = ParseOptionNumber(arg.substr(11));
+        if (options.sinkQueueSize == 0)
+        {
+            std::terminate();
+        }
+    }
+    else if (arg.starts_with(L"-coalesce="sv))
+    {
+        options.coalesceSeconds = ParseOptionNumber(arg.substr(10));
+    }
+    else if (arg.starts_with(L"-correlate="sv))
+    {
+        options.correlateSeconds = ParseOptionNumber(arg.substr(11));
+    }
+    else if (arg == L"-symbolize"sv)
+    {
+        options.symbolize = true;
+    }
+    else if (arg.starts_with(L"-limit="sv))
+    {
+        // -limit=sink:N/S
+        auto value = arg.substr(7);
+        auto colon = value.find(L':');
+        auto slash = value.find(L'/');
+        if (colon == value.npos || slash == value.npos || slash < colon)
+        {
+            std::terminate();
+        }
+
+        auto sink = std::ranges::find(sinkNames, value.substr(0, colon));
+        if (sink == std::end(sinkNames))
+        {
+            std::terminate();
+        }
+
+        auto &limit = options.sinkLimits[sink - std::begin(sinkNames)];
+        limit.count = ParseOptionNumber(value.substr(colon + 1, slash - colon - 1));
+        limit.seconds = ParseOptionNumber(value.substr(slash + 1));
+        if (limit.count == 0 || limit.seconds == 0)
+        {
+            std::terminate();
+        }
+    }
+    else if (arg.starts_with(L"-coalescetable="sv))
+    {
+        options.coalesceTableSize = ParseOptionNumber(arg.substr(15));
+        if (options.coalesceTableSize == 0)
+        {
+            std::terminate();
+        }
+    }
+    else if (arg.starts_with(L"-channels="sv))
+    {
+        options.channelsFile = arg.substr(10);
+        if (options.channelsFile.empty())
+        {
+            std::terminate();
+        }
+    }
+    else if (arg.starts_with(L"-bookmark="sv))
+    {
+        options.bookmarkFile = arg.substr(10);
+        if (options.bookmarkFile.empty())
+        {
+            std::terminate();
+        }
+    }
+    else if (arg.starts_with(L"-since="sv))
+    {
+        options.sinceSeconds = ParseOptionNumber(arg.substr(7));
+        if (options.sinceSeconds == 0)
+        {
+            std::terminate();
+        }
+    }
+    else if (arg.starts_with(L"-ingest="sv))
+    {
+        if (arg.size() == 8)
+        {
+            std::terminate();
+        }
+        options.ingestFiles.emplace_back(arg.substr(8));
+        options.mode = RunMode::ingest;
+    }
+    else if (arg == L"-stats"sv)
+    {
+        options.stats = true;
+    }
+    else if (arg.starts_with(L"-stats="sv))
+    {
+        options.stats = true;
+        options.statsSeconds = ParseOptionNumber(arg.substr(7));
+    }
+    else if (arg == L"-query"sv)
+    {
+        options.mode = RunMode::query;
+    }
+    else if (arg == L"-benchmark"sv)
+    {
+        options.mode = RunMode::benchmark;
+    }
+    else if (arg.starts_with(L"-benchmark="sv))
+    {
+        options.benchmarkFile = arg.substr(11);
+        options.mode = RunMode::benchmark;
+    }
+    else if (arg.starts_with(L"-baseline="sv))
+    {
+        options.baselineFile = arg.substr(10);
+        if (options.baselineFile.empty())
+        {
+            std::terminate();
+        }
+    }
+    else if (arg.starts_with(L"-jobs="sv))
+    {
+        options.jobs = ParseOptionNumber(arg.substr(6));
+        if (options.jobs == 0)
+        {
+            std::terminate();
+        }
+    }
+    else if (arg.starts_with(L"-fields="sv))
+    {
+        options.fields = ParseFieldList(arg.substr(8));
+        if (options.fields == 0)
+        {
+            std::terminate();
+        }
+    }
+    else if (arg.starts_with(L"-include="sv) || arg.starts_with(L"-exclude="sv))
+    {
+        auto rule = arg.substr(9);
+        auto colon = rule.find(L':');
+        if (colon == std::wstring_view::npos || colon + 1 == rule.size())
+        {
+            std::terminate();
+        }
+        FilterRule filter{arg[1] == L'e', std::wstring(rule.substr(0, colon)), std::wstring(rule.substr(colon + 1))};
+        // NB: the service matches Provider and EventID, it knows neither globs nor a literal with both quotes
+        std::wstring literal;
+        if (filter.field == L"EventID"sv ? filter.pattern.find_first_not_of(L"0123456789"sv) != std::wstring::npos
+            : filter.field == L"Provider"sv ? IsGlob(filter.pattern) || !AppendXPathLiteral(filter.pattern, literal)
+                                             : (FieldBit(filter.field) & ~relatedFields) == 0)
+        {
+            std::terminate();
+        }
+        options.filters.push_back(std::move(filter));
+    }
+    else if (arg.starts_with(L"-log="sv))
+    {
+        options.logFile = arg.substr(5);
+        if (options.logFile.empty())
+        {
+            std::terminate();
+        }
+    }
+    else if (arg.starts_with(L"-logsize="sv))
+    {
+        options.logSizeKiB = ParseOptionNumber(arg.substr(9));
+        if (options.logSizeKiB == 0)
+        {
+            std::terminate();
+        }
+    }
+    else if (arg.starts_with(L"-logage="sv))
+    {
+        options.logSeconds = ParseOptionNumber(arg.substr(8));
+        if (options.logSeconds == 0)
+        {
+            std::terminate();
+        }
+    }
+    else if (arg.starts_with(L"-history="sv))
+    {
+        options.historyFile = arg.substr(9);
+    }
+    else if (arg.starts_with(L"-forward="sv))
+    {
+        if (!ParseForwardTarget(arg.substr(9), options.forward))
+        {
+            std::terminate();
+        }
+        options.method |= PrintMethod::forward;
+    }
+    else if (arg == L"-compress"sv)
+    {
+        options.compress = true;
+    }
+    else if (arg.starts_with(L"-spool="sv))
+    {
+        options.spoolFile = arg.substr(7);
+        if (options.spoolFile.empty())
+        {
+            std::terminate();
+        }
+    }
+    else if (arg.starts_with(L"-top="sv))
+    {
+        options.top = ParseOptionNumber(arg.substr(5));
+        options.mode = RunMode::history;
+    }
+    else if (arg.starts_with(L"-groupby="sv))
+    {
+        // NB: SystemTime is the time column of the history, not a dictionary
+        options.groupBy = ParseFieldList(arg.substr(9));
+        if (options.groupBy == 0 || static_cast<std::size_t>(std::popcount(options.groupBy)) > maxGroupFields ||
+            (options.groupBy & FieldBit(L"SystemTime"sv)) != 0)
+        {
+            std::terminate();
+        }
+        options.mode = RunMode::history;
+    }
+    else
+    {
+        std::terminate();
+    }
+}
+
+// Whether -correlate is in effect. Incidents are only formatted from fields, so -xml outputs every event as it
+// is like with -coalesce.
+inline bool Correlating(const Options &options) noexcept
+{
+    return options.correlateSeconds != 0 && options.style != PrintStyle::xml;
+}
+
+} // namespace bizwen
@@ -0,0 +1,753 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.hpp"
+#include "coalescer.hpp"
+#include "correlator.hpp"
+#include "event_filter.hpp"
+#include "event_output.hpp"
+#include "event_parser.hpp"
+#include "event_source.hpp"
+#include "history.hpp"
+#include "limiter.hpp"
+#include "metrics.hpp"
+#include "module_index.hpp"
+#include "options.hpp"
+#include "rolling_log.hpp"
+#include "text.hpp"
+
+namespace bizwen
+{
+
+using namespace std::literals;
+
+// The fields parsed out of each event: those printed plus those the filters, coalescing, correlation,
+// symbolization and -stats rely on. The related fields are never part of the event itself.
+inline FieldMask ExtractedFields(const Options &options) noexcept
+{
+    auto fields = options.fields | FilterFields(options.filters);
+    if (options.coalesceSeconds != 0)
+    {
+        fields |= FaultCoalescer::signatureFields;
+    }
+    if (Correlating(options))
+    {
+        fields |= IncidentCorrelator::keyFields;
+    }
+    if (options.symbolize)
+    {
+        fields |= ModuleSymbolizer::keyFields;
+    }
+    if (options.stats || !options.historyFile.empty())
+    {
+        fields |= FieldBit(L"SystemTime"sv);
+    }
+    return fields & ~relatedFields;
+}
+
+// Incidents tracked by -correlate, the oldest goes out early once they are all in use.
+constexpr std::size_t incidentTableSize = 256;
+
+// Modules indexed by -symbolize, the least recently used is parsed again once they are all in use.
+constexpr std::size_t moduleCacheSize = 32;
+
+// The output of one sink, made and used by its worker thread only.
+class Sink
+{
+  public:
+    virtual ~Sink() = default;
+
+    virtual void Deliver(EventOutput &output) = 0;
+
+    // Called about once a second for the sinks that batch, so that a batch goes out without further events.
+    virtual void Tick(Clock::time_point)
+    {
+    }
+
+    // Sends whatever is still held back, called once the sink has delivered its last event.
+    virtual void Drain()
+    {
+    }
+};
+
+// Makes the sink of sinkMethods[index] on its worker thread. dropped counts the events the sink loses on its own,
+// on top of those its full queue drops.
+using SinkFactory = std::function<std::unique_ptr<Sink>(std::size_t index, std::atomic<std::uint64_t> &dropped)>;
+
+// Collector -> parser -> sink workers. The collector, the thread waiting on the subscription, only drains the
+// event source into free slots; the parser thread parses and formats; each enabled sink runs on its own worker.
+// A slot returns to the pool once every sink it was queued to is done with it. With coalescing, output limits,
+// toasts or forwarding enabled a ticker wakes the parser every second, and the parser the sinks that batch, so
+// that summaries, digests and batches go out even when no further events arrive.
+// Backpressure: the pool bounds the events in flight, when it is exhausted the collector stops reading and the
+// event log keeps buffering. The console is cheap and is the record of the session, so the parser waits for
+// room in its queue; any other sink whose queue is full drops the event for that sink only and counts it.
+class Pipeline
+{
+  public:
+    Pipeline(const Options &options, SinkFactory makeSink, Metrics *metrics = nullptr)
+        : method_(options.method), style_(options.style), fields_(options.fields),
+          extracted_(ExtractedFields(options)), filter_(options.filters), batchSize_(options.batchSize),
+          metrics_(metrics), makeSink_(std::move(makeSink)),
+          slots_(std::make_unique<Slot[]>(options.queueSize)), free_(options.queueSize),
+          parse_(options.queueSize + 1) // NB: one extra cell for the tick
+    {
+        if (!options.logFile.empty())
+        {
+            log_ = std::make_unique<RollingLog>(options.logFile, options.logSizeKiB * 1024ull,
+                                                options.logSeconds * 10'000'000ull, style_ == PrintStyle::binary);
+        }
+        for (std::size_t i = 0; i != options.queueSize; ++i)
+        {
+            slots_[i].output.UseLog(log_.get());
+            free_.TryPush(&slots_[i]);
+        }
+        taken_.reserve(batchSize_);
+        arenas_.reserve(batchSize_);
+
+        bool ticking = false;
+        if (options.coalesceSeconds != 0 && style_ != PrintStyle::xml)
+        {
+            coalescer_ = std::make_unique<FaultCoalescer>(options.coalesceTableSize,
+                                                          std::chrono::seconds(options.coalesceSeconds));
+            ticking = true;
+        }
+        if (Correlating(options))
+        {
+            correlator_ = std::make_unique<IncidentCorrelator>(incidentTableSize,
+                                                               std::chrono::seconds(options.correlateSeconds));
+            ticking = true;
+        }
+        if (options.symbolize && style_ != PrintStyle::xml)
+        {
+            symbolizer_ = std::make_unique<ModuleSymbolizer>(moduleCacheSize);
+        }
+        if (!options.historyFile.empty() && style_ != PrintStyle::xml)
+        {
+            history_ = std::make_unique<HistoryWriter>(options.historyFile, options.fields);
+            ticking = true;
+        }
+
+        for (std::size_t i = 0; i != std::size(sinkMethods); ++i)
+        {
+            // NB: -forward sends text, which a note of a -binary stream is not
+            if (method_ & sinkMethods[i] && (i != forwardSink || style_ != PrintStyle::binary))
+            {
+                if (options.sinkLimits[i].count != 0)
+                {
+                    limiters_[i] = std::make_unique<SinkLimiter>(options.sinkLimits[i], Clock::now());
+                    limited_ = true;
+                    ticking = true;
+                }
+                sinks_[i] = std::make_unique<SinkWorker>(options.sinkQueueSize);
+                if (i == notificationSink || i == forwardSink)
+                {
+                    ticking = true;
+                }
+                sinks_[i]->thread = std::thread(&Pipeline::RunSink, this, i);
+            }
+        }
+        parser_ = std::thread(&Pipeline::RunParser, this);
+
+        if (ticking)
+        {
+            ticker_ = std::jthread([this](std::stop_token token) {
+                std::mutex mutex;
+                std::condition_variable_any condition;
+                std::unique_lock lock(mutex);
+                while (!condition.wait_for(lock, token, 1s, [&token] { return token.stop_requested(); }))
+                {
+                    // a null slot is a tick, at most one is queued at any time
+                    if (!tickPending_.exchange(true, std::memory_order_relaxed))
+                    {
+                        parse_.TryPush(nullptr);
+                    }
+                }
+            });
+        }
+    }
+
+    Pipeline(const Pipeline &) = delete;
+    Pipeline &operator=(const Pipeline &) = delete;
+
+    ~Pipeline()
+    {
+        Stop();
+    }
+
+    // Drains the source, called by the collector whenever a subscription is signaled. Given a number of batches
+    // it stops after collecting that many and returns false, as the source may have more.
+    bool Collect(EventSource &source, std::size_t batches = std::numeric_limits<std::size_t>::max())
+    {
+        while (true)
+        {
+            Slot *slot;
+            if (!free_.TryPop(slot))
+            {
+                stalls_.fetch_add(1, std::memory_order_relaxed);
+                free_.Pop(slot);
+            }
+
+            taken_.clear();
+            arenas_.clear();
+            do
+            {
+                taken_.push_back(slot);
+                arenas_.push_back(&slot->arena);
+            } while (taken_.size() != batchSize_ && free_.TryPop(slot));
+
+            auto count = source.Next(arenas_);
+            if (metrics_)
+            {
+                metrics_->collector.received.Add(count);
+            }
+            // NB: neither queue can be full, both have room for every slot
+            for (std::size_t i = 0; i != taken_.size(); ++i)
+            {
+                if (i < count)
+                {
+                    parse_.TryPush(taken_[i]);
+                }
+                else
+                {
+                    free_.TryPush(taken_[i]);
+                }
+            }
+
+            if (count == 0)
+            {
+                return true;
+            }
+            if (--batches == 0)
+            {
+                return false;
+            }
+        }
+    }
+
+    // Finishes every queued event and joins the workers.
+    void Stop()
+    {
+        if (!parser_.joinable())
+        {
+            return;
+        }
+
+        if (ticker_.joinable())
+        {
+            ticker_.request_stop();
+            ticker_.join();
+        }
+        parse_.Close();
+        parser_.join();
+        for (auto &sink : sinks_)
+        {
+            if (sink)
+            {
+                sink->queue.Close();
+                sink->thread.join();
+            }
+        }
+    }
+
+    // Events not delivered to the sink because its queue was full.
+    std::uint64_t Dropped(std::size_t sink) const noexcept
+    {
+        return sinks_[sink] ? sinks_[sink]->dropped.load(std::memory_order_relaxed) : 0;
+    }
+
+    // Times the collector had to wait for a free slot.
+    std::uint64_t Stalls() const noexcept
+    {
+        return stalls_.load(std::memory_order_relaxed);
+    }
+
+    // Events the -include and -exclude rules dropped on the client, only valid after Stop.
+    std::uint64_t Filtered() const noexcept
+    {
+        return filtered_;
+    }
+
+    // Faults folded into summaries and summaries that could not be delivered, only valid after Stop.
+    std::uint64_t Coalesced() const noexcept
+    {
+        return coalesced_;
+    }
+
+    std::uint64_t SummariesLost() const noexcept
+    {
+        return coalescer_ ? coalescer_->Lost() : 0;
+    }
+
+    // Reports that joined no fault and incidents that could not be delivered, only valid after Stop.
+    std::uint64_t Unmatched() const noexcept
+    {
+        return correlator_ ? correlator_->Unmatched() : 0;
+    }
+
+    std::uint64_t IncidentsLost() const noexcept
+    {
+        return correlator_ ? correlator_->Lost() : 0;
+    }
+
+    // Events the output limit of the sink folded into digests and those left out of them, only valid after Stop.
+    std::uint64_t Deferred(std::size_t sink) const noexcept
+    {
+        return limiters_[sink] ? limiters_[sink]->Deferred() : 0;
+    }
+
+    std::uint64_t Omitted(std::size_t sink) const noexcept
+    {
+        return limiters_[sink] ? limiters_[sink]->Omitted() : 0;
+    }
+
+  private:
+    struct Slot
+    {
+        EventArena arena;
+        EventOutput output{arena};
+        std::atomic<std::uint32_t> pending{};
+    };
+
+    struct SinkWorker
+    {
+        explicit SinkWorker(std::size_t capacity) : queue(capacity)
+        {
+        }
+
+        BoundedQueue<Slot *> queue;
+        std::thread thread;
+        std::atomic<std::uint64_t> dropped{};
+    };
+
+    void RunParser()
+    {
+        // a summary borrows a free slot, when none is available it stays pending until the next flush
+        auto emitSummary = [this](std::wstring_view summary) {
+            Slot *slot;
+            if (!free_.TryPop(slot))
+            {
+                return false;
+            }
+            FormatNote(style_, summary, slot->arena.content);
+            slot->output.Reset(nullptr, style_);
+            Dispatch(*slot);
+            return true;
+        };
+        // an incident borrows a free slot the same way, runtime events without a fault meet the filters only here
+        auto emitIncident = [this](auto &&fill, bool wait = false) {
+            Slot *slot;
+            if (!free_.TryPop(slot) && (!wait || !free_.Pop(slot)))
+            {
+                return false;
+            }
+            auto &arena = slot->arena;
+            fill(arena);
+            if (!filter_.Admit(arena.eventLog))
+            {
+                ++filtered_;
+                if (metrics_)
+                {
+                    metrics_->parser.filtered.Add(1);
+                }
+                arena.Reset();
+                free_.TryPush(slot);
+                return true;
+            }
+            if (metrics_)
+            {
+                arena.created = ParseFileTime(arena.eventLog.systemTime);
+            }
+            Record(arena);
+            slot->output.Reset(&arena.eventLog, style_, fields_);
+            Dispatch(*slot);
+            return true;
+        };
+
+        Slot *slot;
+        while (parse_.Pop(slot))
+        {
+            if (slot == nullptr)
+            {
+                tickPending_.store(false, std::memory_order_relaxed);
+                // the sinks that batch flush on a null slot too, missing one only delays them
+                for (auto index : {notificationSink, forwardSink})
+                {
+                    if (auto &sink = sinks_[index])
+                    {
+                        sink->queue.TryPush(nullptr);
+                    }
+                }
+            }
+            if (coalescer_)
+            {
+                coalescer_->Flush(Clock::now(), emitSummary);
+            }
+            if (correlator_)
+            {
+                correlator_->Flush(Clock::now(), emitIncident);
+            }
+            if (history_)
+            {
+                history_->Flush(Clock::now());
+            }
+            if (limited_)
+            {
+                FlushDigests();
+            }
+            if (slot == nullptr)
+            {
+                continue;
+            }
+
+            auto &arena = slot->arena;
+            auto fault = true;
+            if (correlator_ && !arena.decoded)
+            {
+                auto header = ParseEventHeader(arena.content);
+                fault = header.eventId == 1000 && header.provider == L"Application Error"sv;
+                auto report = header.eventId == 1001 && header.provider == L"Windows Error Reporting"sv;
+                if (report || (header.eventId == 1026 && header.provider == L".NET Runtime"sv))
+                {
+                    std::wstring_view data[24];
+                    auto count = ParseEventData(arena.content, data);
+                    auto joined = true;
+                    if (report)
+                    {
+                        joined = correlator_->AddReport(std::span(data, count), emitIncident);
+                    }
+                    else
+                    {
+                        correlator_->AddRuntime(header, count != 0 ? data[0] : std::wstring_view{}, Clock::now(),
+                                                emitIncident);
+                    }
+                    if (metrics_)
+                    {
+                        metrics_->parser.parsed.Add(1);
+                        metrics_->parser.correlated.Add(joined);
+                    }
+                    arena.Reset();
+                    free_.TryPush(slot);
+                    continue;
+                }
+            }
+            if (style_ != PrintStyle::xml && !arena.decoded)
+            {
+                auto start = metrics_ ? Clock::now() : Clock::time_point{};
+                ParseEventLog(arena.content, arena.eventLog, extracted_);
+                if (metrics_)
+                {
+                    metrics_->parser.parse.Record(Nanoseconds(Clock::now() - start));
+                    arena.created = ParseFileTime(arena.eventLog.systemTime);
+                }
+            }
+            if (metrics_)
+            {
+                metrics_->parser.parsed.Add(1);
+            }
+
+            if (!filter_.Empty())
+            {
+                if (style_ == PrintStyle::xml)
+                {
+                    // NB: the XML is output verbatim, so the fields are decoded from a copy in the unused text buffer
+                    arena.text.assign(arena.content);
+                    ParseEventLog(arena.text, arena.eventLog, filter_.Fields());
+                }
+                if (!filter_.Admit(arena.eventLog))
+                {
+                    ++filtered_;
+                    if (metrics_)
+                    {
+                        metrics_->parser.filtered.Add(1);
+                    }
+                    arena.Reset();
+                    free_.TryPush(slot);
+                    continue;
+                }
+            }
+
+            if (coalescer_ && !coalescer_->Admit(arena.eventLog, Clock::now(), emitSummary))
+            {
+                ++coalesced_;
+                if (metrics_)
+                {
+                    metrics_->parser.coalesced.Add(1);
+                }
+                arena.Reset();
+                free_.TryPush(slot);
+                continue;
+            }
+
+            if (symbolizer_ && fault)
+            {
+                symbolizer_->Symbolize(arena);
+            }
+
+            if (correlator_ && fault)
+            {
+                correlator_->AddFault(arena, Clock::now(), emitIncident);
+                arena.Reset();
+                free_.TryPush(slot);
+                continue;
+            }
+
+            Record(arena);
+            slot->output.Reset(style_ != PrintStyle::xml ? &arena.eventLog : nullptr, style_, fields_);
+            Dispatch(*slot);
+        }
+
+        // NB: the sinks still run and return their slots, so waiting for one cannot block forever
+        if (correlator_)
+        {
+            correlator_->Drain([&emitIncident](auto &&fill) { return emitIncident(fill, true); });
+        }
+        if (history_)
+        {
+            history_->Flush();
+        }
+    }
+
+    // Appends the event to the history before it is dispatched, after which the sinks may reset the arena.
+    void Record(const EventArena &arena)
+    {
+        if (history_)
+        {
+            history_->Append(arena.eventLog,
+                             arena.created != 0 ? arena.created : ParseFileTime(arena.eventLog.systemTime));
+        }
+    }
+
+    void Dispatch(Slot &slot)
+    {
+        slot.output.Prepare(method_);
+        if (limited_)
+        {
+            // NB: produced before any sink can read the output concurrently
+            slot.output.MinimalText();
+        }
+
+        auto now = Clock::now();
+        // the parser holds one reference until the slot is queued to every sink
+        slot.pending.store(1, std::memory_order_relaxed);
+        for (std::size_t i = 0; i != std::size(sinks_); ++i)
+        {
+            if (sinks_[i] && (!limiters_[i] || limiters_[i]->Admit(slot.output, now)))
+            {
+                Enqueue(slot, i);
+            }
+        }
+        Release(slot);
+    }
+
+    // Sends every digest the output limits allow, each one to its sink only.
+    void FlushDigests()
+    {
+        auto now = Clock::now();
+        for (std::size_t i = 0; i != std::size(limiters_); ++i)
+        {
+            Slot *slot;
+            if (!limiters_[i] || !limiters_[i]->DigestReady(now) || !free_.TryPop(slot))
+            {
+                continue;
+            }
+
+            // NB: the text buffer of a free slot is unused, so it holds the digest until it is formatted
+            auto &arena = slot->arena;
+            limiters_[i]->TakeDigest(arena.text, now);
+            FormatNote(style_, arena.text, arena.content);
+            arena.text.clear();
+            slot->output.Reset(nullptr, style_);
+            slot->output.Prepare(sinkMethods[i]);
+            slot->pending.store(1, std::memory_order_relaxed);
+            Enqueue(*slot, i);
+            Release(*slot);
+        }
+    }
+
+    void Enqueue(Slot &slot, std::size_t index)
+    {
+        auto &sink = *sinks_[index];
+        slot.pending.fetch_add(1, std::memory_order_relaxed);
+        if (sinkMethods[index] == PrintMethod::console)
+        {
+            sink.queue.Push(&slot);
+        }
+        else if (!sink.queue.TryPush(&slot))
+        {
+            sink.dropped.fetch_add(1, std::memory_order_relaxed);
+            Release(slot);
+            return;
+        }
+        if (metrics_)
+        {
+            metrics_->sinks[index].dispatched.Add(1);
+        }
+    }
+
+    void RunSink(std::size_t index)
+    {
+        auto &worker = *sinks_[index];
+        auto sink = makeSink_(index, worker.dropped);
+        Slot *slot;
+        while (worker.queue.Pop(slot))
+        {
+            if (slot == nullptr)
+            {
+                sink->Tick(Clock::now());
+                continue;
+            }
+            if (!metrics_)
+            {
+                sink->Deliver(slot->output);
+                Release(*slot);
+                continue;
+            }
+
+            auto start = Clock::now();
+            auto created = slot->arena.created;
+            sink->Deliver(slot->output);
+            Release(*slot);
+            auto &metrics = metrics_->sinks[index];
+            metrics.output.Record(Nanoseconds(Clock::now() - start));
+            metrics.completed.Add(1);
+            if (created != 0)
+            {
+                auto now = FileTimeNow();
+                metrics.age.Record(now > created ? now - created : 0);
+            }
+        }
+        sink->Drain();
+    }
+
+    void Release(Slot &slot) noexcept
+    {
+        if (slot.pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            slot.arena.Reset();
+            free_.TryPush(&slot);
+        }
+    }
+
+    PrintMethod method_;
+    PrintStyle style_;
+    FieldMask fields_;
+    FieldMask extracted_;
+    EventFilter filter_;
+    std::size_t batchSize_;
+    Metrics *metrics_;
+    SinkFactory makeSink_;
+    std::unique_ptr<RollingLog> log_;
+    std::unique_ptr<Slot[]> slots_;
+    BoundedQueue<Slot *> free_;
+    BoundedQueue<Slot *> parse_;
+    std::unique_ptr<SinkWorker> sinks_[std::size(sinkMethods)];
+    std::thread parser_;
+    std::atomic<std::uint64_t> stalls_{};
+
+    // used by the parser only
+    std::unique_ptr<FaultCoalescer> coalescer_;
+    std::unique_ptr<IncidentCorrelator> correlator_;
+    std::unique_ptr<ModuleSymbolizer> symbolizer_;
+    std::unique_ptr<HistoryWriter> history_;
+    std::uint64_t coalesced_{};
+    std::uint64_t filtered_{};
+    std::unique_ptr<SinkLimiter> limiters_[std::size(sinkMethods)];
+    bool limited_ = false;
+    std::jthread ticker_;
+    std::atomic<bool> tickPending_{};
+
+    // used by the collector only
+    std::vector<Slot *> taken_;
+    std::vector<EventArena *> arenas_;
+};
+
+inline void FormatStats(const Metrics &metrics, const Pipeline &pipeline, PrintMethod method, std::wstring &output)
+{
+    output += L"Events: "sv;
+    AppendNumber(metrics.collector.received.Value(), output);
+    output += L" received, "sv;
+    AppendNumber(metrics.parser.parsed.Value(), output);
+    output += L" parsed, "sv;
+    AppendNumber(metrics.parser.filtered.Value(), output);
+    output += L" filtered, "sv;
+    AppendNumber(metrics.parser.coalesced.Value(), output);
+    output += L" coalesced, "sv;
+    AppendNumber(metrics.parser.correlated.Value(), output);
+    output += L" correlated\n"sv;
+    AppendHistogram(L"EvtNext"sv, metrics.collector.next, output);
+    AppendHistogram(L"; render"sv, metrics.collector.render, output);
+    AppendHistogram(L"; ParseEventLog"sv, metrics.parser.parse, output);
+    output += L'\n';
+
+    for (std::size_t i = 0; i != std::size(sinkMethods); ++i)
+    {
+        if (!(method & sinkMethods[i]))
+        {
+            continue;
+        }
+        auto &sink = metrics.sinks[i];
+        output += sinkNames[i];
+        output += L": "sv;
+        AppendNumber(sink.dispatched.Value(), output);
+        output += L" dispatched, "sv;
+        AppendNumber(pipeline.Dropped(i), output);
+        output += L" dropped, "sv;
+        AppendNumber(sink.completed.Value(), output);
+        output += L" done; "sv;
+        AppendHistogram(L"output"sv, sink.output, output);
+        AppendHistogram(L"; age"sv, sink.age, output, 100);
+        output += L'\n';
+    }
+}
+
+// Drops and deferrals of every sink and what -correlate could not deliver, only valid after Stop.
+inline std::wstring SinkSummary(const Pipeline &pipeline)
+{
+    std::wstring summary;
+    if (auto unmatched = pipeline.Unmatched())
+    {
+        AppendNumber(unmatched, summary);
+        summary += L" error reports joined no fault.\n"sv;
+    }
+    if (auto lost = pipeline.IncidentsLost())
+    {
+        AppendNumber(lost, summary);
+        summary += L" incidents lost to a full incident table.\n"sv;
+    }
+    for (std::size_t i = 0; i != std::size(sinkNames); ++i)
+    {
+        if (auto dropped = pipeline.Dropped(i))
+        {
+            AppendNumber(dropped, summary);
+            summary += L" events dropped by the "sv;
+            summary += sinkNames[i];
+            summary += L" output.\n"sv;
+        }
+        if (auto deferred = pipeline.Deferred(i))
+        {
+            AppendNumber(deferred, summary);
+            summary += L" events deferred by the "sv;
+            summary += sinkNames[i];
+            summary += L" output limit, "sv;
+            AppendNumber(pipeline.Omitted(i), summary);
+            summary += L" of them left out of digests.\n"sv;
+        }
+    }
+    return summary;
+}
+
+} // namespace bizwen
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "text.hpp"
+#include "utf8.hpp"
+
+namespace bizwen
+{
+
+using namespace std::literals;
+
+constexpr std::size_t logSegmentsKept = 16;
+constexpr std::size_t logCommitBytes = 64 * 1024;
+constexpr auto logCommitInterval = 200ms;
+
+// The -log sink: every event is appended to a log whose segments rotate by size and age, and viewers open the
+// current segment instead of a new temp file per event. The parser only appends to a buffer, a writer thread
+// commits it in groups after logCommitInterval, once logCommitBytes are pending or as soon as a viewer waits
+// in Sync. A segment is named after the log file with its creation FILETIME before the extension, and only the
+// newest logSegmentsKept are kept.
+class RollingLog
+{
+  public:
+    // Where an event went: its lines within the segment, none for -binary, and the end of its bytes in the log.
+    struct Entry
+    {
+        std::uint64_t firstLine{};
+        std::uint64_t lines{};
+        std::uint64_t end{};
+    };
+
+    // maxAge is in FILETIME ticks, binary segments hold raw units instead of UTF-8.
+    RollingLog(const std::filesystem::path &file, std::uint64_t maxBytes, std::uint64_t maxAge, bool binary)
+        : file_(std::filesystem::absolute(file)), maxBytes_(maxBytes), maxAge_(maxAge), binary_(binary)
+    {
+        Open();
+        thread_ = std::jthread([this](std::stop_token token) { RunWriter(token); });
+    }
+
+    RollingLog(const RollingLog &) = delete;
+    RollingLog &operator=(const RollingLog &) = delete;
+
+    // Appends the output of an event and stores the path of its segment into segment. Called by the parser only.
+    Entry Append(std::wstring_view text, std::wstring &segment)
+    {
+        std::unique_lock lock(mutex_);
+        auto start = pending_.size();
+        if (binary_)
+        {
+            pending_.append(reinterpret_cast<const char *>(text.data()), text.size() * sizeof(wchar_t));
+        }
+        else
+        {
+            AppendUtf8(text, pending_);
+        }
+        auto size = pending_.size() - start;
+
+        if (segmentBytes_ != 0 && (segmentBytes_ + size > maxBytes_ || FileTimeNow() - created_ >= maxAge_))
+        {
+            // NB: the event opens the new segment, so what is pending before it goes to the old one right away
+            synced_.wait(lock, [this] { return !writing_; });
+            Write(std::string_view(pending_).substr(0, start));
+            written_ += start;
+            pending_.erase(0, start);
+            start = 0;
+            Open();
+        }
+
+        Entry entry{lines_, 0, 0};
+        if (!binary_)
+        {
+            entry.lines = static_cast<std::uint64_t>(std::count(pending_.begin() + start, pending_.end(), '\n'));
+        }
+        lines_ += entry.lines;
+        segmentBytes_ += size;
+        appended_ += size;
+        entry.end = appended_;
+        segment.assign(segment_);
+
+        // the writer sleeps while nothing is pending
+        if (start == 0 || pending_.size() >= logCommitBytes)
+        {
+            condition_.notify_one();
+        }
+        return entry;
+    }
+
+    // Blocks until the log is written up to end, for a viewer about to open the segment.
+    void Sync(std::uint64_t end)
+    {
+        std::unique_lock lock(mutex_);
+        if (written_ >= end)
+        {
+            return;
+        }
+        ++waiters_;
+        condition_.notify_one();
+        synced_.wait(lock, [this, end] { return written_ >= end; });
+        --waiters_;
+    }
+
+  private:
+    void RunWriter(std::stop_token token)
+    {
+        std::unique_lock lock(mutex_);
+        while (condition_.wait(lock, token, [this] { return !pending_.empty(); }))
+        {
+            // group commit, unless a viewer waits or the buffer is full more events may join
+            condition_.wait_for(lock, token, logCommitInterval,
+                                [this] { return waiters_ != 0 || pending_.size() >= logCommitBytes; });
+            std::swap(pending_, committing_);
+            writing_ = true;
+            lock.unlock();
+            Write(committing_);
+            lock.lock();
+            written_ += committing_.size();
+            committing_.clear();
+            writing_ = false;
+            synced_.notify_all();
+        }
+    }
+
+    void Write(std::string_view bytes)
+    {
+        stream_.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        stream_.flush();
+        if (!stream_)
+        {
+            std::terminate();
+        }
+    }
+
+    // Starts a new segment, text segments begin with a BOM like the temp files.
+    void Open()
+    {
+        created_ = FileTimeNow();
+        auto name = file_.stem().wstring();
+        name += L'.';
+        AppendNumber(created_, name);
+        name += file_.extension().wstring();
+        segment_ = (file_.parent_path() / name).wstring();
+
+        stream_.close();
+        stream_.clear();
+        stream_.open(file_.parent_path() / name, std::ios::out | std::ios::binary);
+        if (!stream_.is_open())
+        {
+            std::terminate();
+        }
+        if (!binary_)
+        {
+            stream_.write("\xef\xbb\xbf", 3);
+        }
+        segmentBytes_ = 0;
+        lines_ = 0;
+        Prune();
+    }
+
+    // Deletes all but the newest logSegmentsKept segments, one still open elsewhere is left for the next time.
+    void Prune()
+    {
+        auto prefix = file_.stem().wstring();
+        prefix += L'.';
+        auto extension = file_.extension().wstring();
+
+        std::vector<std::wstring> segments;
+        std::error_code error;
+        for (auto &entry : std::filesystem::directory_iterator(file_.parent_path(), error))
+        {
+            auto name = entry.path().filename().wstring();
+            if (name.size() <= prefix.size() + extension.size() || !name.starts_with(prefix) ||
+                !name.ends_with(extension))
+            {
+                continue;
+            }
+            auto ticks = std::wstring_view(name).substr(prefix.size(), name.size() - prefix.size() - extension.size());
+            if (ticks.find_first_not_of(L"0123456789"sv) == std::wstring_view::npos)
+            {
+                segments.push_back(std::move(name));
+            }
+        }
+        if (segments.size() <= logSegmentsKept)
+        {
+            return;
+        }
+
+        // NB: the tick counts have no leading zeros, so the shorter one is older
+        std::ranges::sort(segments, [](const std::wstring &left, const std::wstring &right) {
+            return left.size() != right.size() ? left.size() < right.size() : left < right;
+        });
+        for (std::size_t i = 0; i != segments.size() - logSegmentsKept; ++i)
+        {
+            std::filesystem::remove(file_.parent_path() / segments[i], error);
+        }
+    }
+
+    std::filesystem::path file_;
+    std::uint64_t maxBytes_;
+    std::uint64_t maxAge_;
+    bool binary_;
+
+    std::mutex mutex_;
+    std::condition_variable_any condition_;
+    std::condition_variable synced_;
+    std::string pending_;
+    std::string committing_;
+    bool writing_ = false;
+    std::uint32_t waiters_{};
+    std::uint64_t appended_{};
+    std::uint64_t written_{};
+
+    // the current segment, changed only while the writer is idle
+    std::ofstream stream_;
+    std::wstring segment_;
+    std::uint64_t created_{};
+    std::uint64_t segmentBytes_{};
+    std::uint64_t lines_{};
+
+    std::jthread thread_;
+};
+
+} // namespace bizwen
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <exception>
+#include <string>
+// NB: before windows.h, which includes the older winsock.h otherwise
+#include <winsock2.h>
+#include <windows.h>
+
+#include "console.hpp"
+#include "event_output.hpp"
+#include "options.hpp"
+
+namespace bizwen
+{
+
+using namespace std::literals;
+
+inline void OpenNotepadWithFile(std::wstring_view tempFile)
+{
+    std::wstring parameter;
+    parameter.reserve(tempFile.size() + 2);
+    parameter += L"\""sv;
+    parameter += tempFile;
+    parameter += L"\""sv;
+
+    HINSTANCE hInst = ::ShellExecuteW(nullptr, L"open", L"notepad.exe", parameter.c_str(), nullptr, SW_SHOWNORMAL);
+    if (reinterpret_cast<INT_PTR>(hInst) <= 32)
+    {
+        std::terminate();
+    }
+}
+
+// Shows the file, or only lines [firstLine, firstLine + lines) of it when lines is not 0.
+inline void OpenPowerShellWithFile(std::wstring_view tempFile, std::uint64_t firstLine = 0, std::uint64_t lines = 0)
+{
+    auto prefix = L"-NoExit Get-Content -Path \""sv;
+    auto postfix = L"\""sv;
+    std::wstring parameter;
+    parameter.reserve(tempFile.size() + prefix.size() + postfix.size());
+    parameter += prefix;
+    parameter += tempFile;
+    parameter += postfix;
+    if (lines != 0)
+    {
+        parameter += L" | Select-Object -Skip "sv;
+        parameter += std::to_wstring(firstLine);
+        parameter += L" -First "sv;
+        parameter += std::to_wstring(lines);
+    }
+
+    HINSTANCE hInst = ::ShellExecuteW(nullptr, L"open", L"powershell.exe", parameter.c_str(), nullptr, SW_SHOWNORMAL);
+    if (reinterpret_cast<INT_PTR>(hInst) <= 32)
+    {
+        std::terminate();
+    }
+}
+
+inline void DispatchOutput(PrintMethod method, EventOutput &output)
+{
+    if (method & PrintMethod::console)
+    {
+        WriteContentConsole(output.Text(), output.Binary());
+    }
+    if (method & PrintMethod::notepad)
+    {
+        OpenNotepadWithFile(output.TempFile());
+    }
+    if (method & PrintMethod::powershell)
+    {
+        OpenPowerShellWithFile(output.TempFile(), output.FirstLine(), output.Lines());
+    }
+}
+
+} // namespace bizwen
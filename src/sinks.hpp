@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <string>
+
+#include "forwarder.hpp"
+#include "message_box_worker.hpp"
+#include "options.hpp"
+#include "pipeline.hpp"
+#include "shell.hpp"
+#include "toast_batcher.hpp"
+#include "toast_notifier.hpp"
+
+namespace bizwen
+{
+
+// The console, Notepad and PowerShell, which output each event on its own.
+class ShellSink final : public Sink
+{
+  public:
+    explicit ShellSink(PrintMethod method) noexcept : method_(method)
+    {
+    }
+
+    void Deliver(EventOutput &output) override
+    {
+        DispatchOutput(method_, output);
+    }
+
+  private:
+    PrintMethod method_;
+};
+
+class MessageBoxSink final : public Sink
+{
+  public:
+    void Deliver(EventOutput &output) override
+    {
+        worker_.Post(output.Text());
+    }
+
+  private:
+    MessageBoxWorker worker_;
+};
+
+// Toasts in bursts, see ToastBatcher.
+class NotificationSink final : public Sink
+{
+  public:
+    void Deliver(EventOutput &output) override
+    {
+        toasts_.Add(output.MinimalText(), Clock::now(), Show{notifier_});
+    }
+
+    void Tick(Clock::time_point now) override
+    {
+        toasts_.Flush(now, Show{notifier_});
+    }
+
+    void Drain() override
+    {
+        toasts_.Drain(Show{notifier_});
+    }
+
+  private:
+    struct Show
+    {
+        const ToastNotifier &notifier;
+
+        void operator()(std::wstring_view xml, std::wstring_view tag) const
+        {
+            notifier.Show(xml, tag);
+        }
+    };
+
+    ToastNotifier notifier_;
+    ToastBatcher toasts_{toastWindow};
+};
+
+class ForwardSink final : public Sink
+{
+  public:
+    ForwardSink(const Options &options, std::atomic<std::uint64_t> &dropped)
+        : forwarder_(options.forward, options.style == PrintStyle::jsonl, options.compress, SpoolPath(options),
+                     dropped)
+    {
+    }
+
+    void Deliver(EventOutput &output) override
+    {
+        forwarder_.Add(output, Clock::now());
+    }
+
+    void Tick(Clock::time_point now) override
+    {
+        forwarder_.Flush(now);
+    }
+
+    void Drain() override
+    {
+        forwarder_.Flush(Clock::now());
+    }
+
+  private:
+    static std::filesystem::path SpoolPath(const Options &options)
+    {
+        return options.spoolFile.empty() ? std::filesystem::temp_directory_path() / L"apperrnotitool-forward.spool"
+                                         : std::filesystem::path(options.spoolFile);
+    }
+
+    Forwarder forwarder_;
+};
+
+// The sinks of the tool on the desktop. NB: options must outlive the pipeline.
+inline SinkFactory DesktopSinks(const Options &options)
+{
+    return [&options](std::size_t index, std::atomic<std::uint64_t> &dropped) -> std::unique_ptr<Sink> {
+        if (index == messageBoxSink)
+        {
+            return std::make_unique<MessageBoxSink>();
+        }
+        if (index == notificationSink)
+        {
+            return std::make_unique<NotificationSink>();
+        }
+        if (index == forwardSink)
+        {
+            return std::make_unique<ForwardSink>(options, dropped);
+        }
+        return std::make_unique<ShellSink>(sinkMethods[index]);
+    };
+}
+
+} // namespace bizwen
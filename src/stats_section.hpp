@@ -0,0 +1,177 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <iterator>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <thread>
+// NB: before windows.h, which includes the older winsock.h otherwise
+#include <winsock2.h>
+#include <windows.h>
+
+#include "console.hpp"
+#include "metrics.hpp"
+#include "options.hpp"
+#include "pipeline.hpp"
+
+namespace bizwen
+{
+
+using namespace std::literals;
+
+constexpr wchar_t statsSectionName[] = L"Application_Error_Notification_Tool_Stats";
+
+// The latest -stats report of the running instance, read by -query from another process through a named
+// section. The writer keeps the sequence odd while it rewrites the text, so the reader retries instead of
+// taking a lock.
+class StatsSection
+{
+  public:
+    // Creates the section for the running instance, or opens it for -query in which case it may not be Valid.
+    explicit StatsSection(bool create)
+    {
+        if (create)
+        {
+            hMapping_ = ::CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(Layout),
+                                             statsSectionName);
+        }
+        else
+        {
+            hMapping_ = ::OpenFileMappingW(FILE_MAP_READ, FALSE, statsSectionName);
+        }
+        if (hMapping_ == nullptr)
+        {
+            if (create || ::GetLastError() != ERROR_FILE_NOT_FOUND)
+            {
+                std::terminate();
+            }
+            return;
+        }
+
+        layout_ = static_cast<Layout *>(
+            ::MapViewOfFile(hMapping_, create ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, sizeof(Layout)));
+        if (layout_ == nullptr)
+        {
+            std::terminate();
+        }
+    }
+
+    StatsSection(const StatsSection &) = delete;
+    StatsSection &operator=(const StatsSection &) = delete;
+
+    ~StatsSection()
+    {
+        if (layout_ != nullptr)
+        {
+            ::UnmapViewOfFile(layout_);
+        }
+        if (hMapping_ != nullptr)
+        {
+            ::CloseHandle(hMapping_);
+        }
+    }
+
+    bool Valid() const noexcept
+    {
+        return layout_ != nullptr;
+    }
+
+    void Publish(std::wstring_view text) noexcept
+    {
+        std::atomic_ref sequence(layout_->sequence);
+        auto current = sequence.load(std::memory_order_relaxed);
+        sequence.store(current + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        auto length = std::min(text.size(), std::size(layout_->text));
+        std::copy_n(text.data(), length, layout_->text);
+        std::atomic_ref(layout_->length).store(static_cast<std::uint32_t>(length), std::memory_order_relaxed);
+        sequence.store(current + 2, std::memory_order_release);
+    }
+
+    std::wstring Read() const
+    {
+        std::wstring text;
+        std::atomic_ref sequence(layout_->sequence);
+        while (true)
+        {
+            auto before = sequence.load(std::memory_order_acquire);
+            if (before % 2 == 0)
+            {
+                auto length = std::min<std::size_t>(std::atomic_ref(layout_->length).load(std::memory_order_relaxed),
+                                                    std::size(layout_->text));
+                text.assign(layout_->text, length);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (sequence.load(std::memory_order_relaxed) == before)
+                {
+                    return text;
+                }
+            }
+            std::this_thread::yield();
+        }
+    }
+
+  private:
+    struct Layout
+    {
+        alignas(std::atomic_ref<std::uint32_t>::required_alignment) std::uint32_t sequence;
+        alignas(std::atomic_ref<std::uint32_t>::required_alignment) std::uint32_t length;
+        wchar_t text[16 * 1024];
+    };
+
+    HANDLE hMapping_{};
+    Layout *layout_{};
+};
+
+// Publishes the -stats report every second for -query and, with -stats=S, writes it to the console every S
+// seconds when there is one.
+class StatsReporter
+{
+  public:
+    StatsReporter(const Metrics &metrics, const Pipeline &pipeline, const Options &options, bool console)
+        : section_(true)
+    {
+        auto interval = console ? options.statsSeconds : 0;
+        thread_ = std::jthread([this, &metrics, &pipeline, method = options.method, interval](std::stop_token token) {
+            std::mutex mutex;
+            std::condition_variable_any condition;
+            std::unique_lock lock(mutex);
+            std::wstring text;
+            for (std::uint32_t ticks = 1;
+                 !condition.wait_for(lock, token, 1s, [&token] { return token.stop_requested(); }); ++ticks)
+            {
+                text.clear();
+                FormatStats(metrics, pipeline, method, text);
+                section_.Publish(text);
+                if (interval != 0 && ticks % interval == 0)
+                {
+                    WriteContentConsole(text);
+                }
+            }
+        });
+    }
+
+  private:
+    StatsSection section_;
+    std::jthread thread_;
+};
+
+// Prints the report published by the running instance, for -query.
+inline void QueryStats()
+{
+    StatsSection section(false);
+    if (section.Valid())
+    {
+        WriteContentConsole(section.Read());
+    }
+    else
+    {
+        WriteContentConsole(L"No running instance was started with -stats.\n"sv);
+    }
+}
+
+} // namespace bizwen
@@ -0,0 +1,343 @@
+#pragma once
+
+#include <chrono>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "backfill.hpp"
+#include "bounded_queue.hpp"
+#include "metrics.hpp"
+#include "pipeline.hpp"
+
+namespace bizwen
+{
+
+using namespace std::literals;
+
+// Subscribes to the events of the channel after the bookmark if it has a position, otherwise to those created
+// since the given time if it is not 0, otherwise to future events. Without a query of its own the channel is
+// subscribed to its errors, and the service applies what it can of the filters.
+inline EVT_HANDLE SubscribeEvent(HANDLE event, const ChannelQuery &channel, const BookmarkStore &bookmark,
+                                 std::uint64_t since, std::span<const FilterRule> filters, bool related)
+{
+    auto positioned = bookmark.Positioned();
+    auto query = channel.query.empty() ? ErrorQuery(positioned ? 0 : since, 0, filters, related) : channel.query;
+    EVT_HANDLE hSubscription;
+    if (positioned)
+    {
+        hSubscription = ::EvtSubscribe(nullptr, event, channel.channel.c_str(), query.c_str(), bookmark.Handle(),
+                                       nullptr, nullptr, EvtSubscribeStartAfterBookmark);
+    }
+    else
+    {
+        hSubscription = ::EvtSubscribe(nullptr, event, channel.channel.c_str(), query.c_str(), nullptr, nullptr,
+                                       nullptr,
+                                       since != 0 ? EvtSubscribeStartAtOldestRecord : EvtSubscribeToFutureEvents);
+    }
+    if (hSubscription == nullptr)
+    {
+        std::terminate();
+    }
+    return hSubscription;
+}
+
+class SubscriptionSource final : public EventSource
+{
+  public:
+    // Only -xml needs the full XML, every other style renders the selected fields of EventLog as values. The
+    // bookmark, if any, follows the events handed out.
+    SubscriptionSource(EVT_HANDLE hSubscription, PrintStyle style, FieldMask fields,
+                       BookmarkStore *bookmark = nullptr, Metrics *metrics = nullptr)
+        : hSubscription_(hSubscription), fields_(fields), bookmark_(bookmark), metrics_(metrics)
+    {
+        if (style != PrintStyle::xml)
+        {
+            LPCWSTR valuePaths[std::size(eventFields)];
+            DWORD count = 0;
+            for (std::size_t i = 0; i != std::size(eventFields); ++i)
+            {
+                if ((fields >> i & 1) != 0)
+                {
+                    valuePaths[count++] = eventFields[i].valuePath;
+                }
+            }
+            hContext_ = ::EvtCreateRenderContext(count, valuePaths, EvtRenderContextValues);
+            if (hContext_ == nullptr)
+            {
+                std::terminate();
+            }
+        }
+    }
+
+    SubscriptionSource(const SubscriptionSource &) = delete;
+    SubscriptionSource &operator=(const SubscriptionSource &) = delete;
+
+    ~SubscriptionSource()
+    {
+        if (hContext_ != nullptr)
+        {
+            ::EvtClose(hContext_);
+        }
+    }
+
+    std::size_t Next(std::span<EventArena *const> batch) override
+    {
+        hEvents_.resize(batch.size());
+
+        DWORD dwReturned = 0;
+        auto start = metrics_ ? Clock::now() : Clock::time_point{};
+        if (!::EvtNext(hSubscription_, static_cast<DWORD>(hEvents_.size()), hEvents_.data(), INFINITE, 0,
+                       &dwReturned))
+        {
+            if (::GetLastError() == ERROR_NO_MORE_ITEMS)
+            {
+                return 0;
+            }
+            std::terminate();
+        }
+        if (metrics_)
+        {
+            auto now = Clock::now();
+            metrics_->collector.next.Record(Nanoseconds(now - start));
+            start = now;
+        }
+
+        // render the whole batch first so that the handles can be released before any output happens
+        for (DWORD i = 0; i != dwReturned; ++i)
+        {
+            if (hContext_ != nullptr)
+            {
+                auto count = RenderEventValues(hContext_, hEvents_[i], values_);
+                DecodeEventValues(std::span(values_).first(count), *batch[i], fields_);
+            }
+            else
+            {
+                PrintEvent(hEvents_[i], batch[i]->content);
+            }
+            if (bookmark_ != nullptr && i + 1 == dwReturned)
+            {
+                bookmark_->Update(hEvents_[i], dwReturned);
+            }
+            ::EvtClose(hEvents_[i]);
+            if (metrics_)
+            {
+                auto now = Clock::now();
+                metrics_->collector.render.Record(Nanoseconds(now - start));
+                start = now;
+            }
+        }
+        return dwReturned;
+    }
+
+  private:
+    EVT_HANDLE hSubscription_;
+    FieldMask fields_;
+    BookmarkStore *bookmark_;
+    Metrics *metrics_;
+    EVT_HANDLE hContext_{};
+    std::vector<EVT_HANDLE> hEvents_;
+    std::vector<EVT_VARIANT> values_;
+};
+
+// Batches a subscription collects per turn before the next one signaled gets its own.
+constexpr std::size_t collectQuantum = 4;
+
+// The subscriptions of the -channels file, or to the errors of the Application channel without one, all drained
+// by the calling thread. Each subscription signals its own event, which a thread pool wait turns into a turn on
+// the ready queue, so the collector waits on the single Ready event however many channels there are, well past
+// the MAXIMUM_WAIT_OBJECTS of WaitForMultipleObjects. With -bookmark the first subscription keeps its position
+// in the file and the n-th in the file with .n appended. The -since backfill of a channel is collected in turns
+// like its events, so the caller sees its kill event or exit key meanwhile, and the channel is only subscribed
+// once the backfill is drained.
+class SubscriptionSet
+{
+  public:
+    SubscriptionSet(const Options &options, Pipeline &pipeline, Metrics *metrics)
+        : channels_(options.channelsFile.empty() ? std::vector<ChannelQuery>{{L"Application"s, {}}}
+                                                 : ReadChannels(options.channelsFile)),
+          ready_(channels_.size()), options_(options), pipeline_(pipeline), metrics_(metrics)
+    {
+        hReady_ = ::CreateEventW(nullptr, FALSE, FALSE, nullptr);
+        if (hReady_ == nullptr)
+        {
+            std::terminate();
+        }
+
+        subscriptions_.reserve(channels_.size());
+        for (std::size_t i = 0; i != channels_.size(); ++i)
+        {
+            auto bookmarkFile = options.bookmarkFile;
+            if (i != 0 && !bookmarkFile.empty())
+            {
+                bookmarkFile += L'.';
+                AppendNumber(i, bookmarkFile);
+            }
+            auto &subscription = *subscriptions_.emplace_back(std::make_unique<Subscription>(*this, i, bookmarkFile));
+
+            // NB: created signaled, so the first turn collects what the subscription already has
+            subscription.hEvent = ::CreateEventW(nullptr, TRUE, TRUE, nullptr);
+            if (subscription.hEvent == nullptr)
+            {
+                std::terminate();
+            }
+            subscription.wait = ::CreateThreadpoolWait(OnSignaled, &subscription, nullptr);
+            if (subscription.wait == nullptr)
+            {
+                std::terminate();
+            }
+
+            subscription.backfill = StartBackfill(channels_[i], options, subscription.bookmark, subscription.since);
+            if (subscription.backfill == nullptr)
+            {
+                Subscribe(subscription);
+            }
+            else
+            {
+                ++backfills_;
+                if (ready_.Signal(i) && !::SetEvent(hReady_))
+                {
+                    std::terminate();
+                }
+            }
+        }
+    }
+
+    SubscriptionSet(const SubscriptionSet &) = delete;
+    SubscriptionSet &operator=(const SubscriptionSet &) = delete;
+
+    ~SubscriptionSet()
+    {
+        for (auto &subscription : subscriptions_)
+        {
+            ::SetThreadpoolWait(subscription->wait, nullptr, nullptr);
+            ::WaitForThreadpoolWaitCallbacks(subscription->wait, TRUE);
+            ::CloseThreadpoolWait(subscription->wait);
+            subscription->source.reset();
+            subscription->backfill.reset();
+            if (subscription->hSubscription != nullptr)
+            {
+                ::EvtClose(subscription->hSubscription);
+            }
+            subscription->bookmark.Checkpoint();
+            ::CloseHandle(subscription->hEvent);
+        }
+        ::CloseHandle(hReady_);
+    }
+
+    // Signaled whenever a subscription has events to collect.
+    HANDLE Ready() const noexcept
+    {
+        return hReady_;
+    }
+
+    // Whether some channel still replays its -since backfill.
+    bool Backfilling() const noexcept
+    {
+        return backfills_ != 0;
+    }
+
+    // Gives every signaled subscription a turn of at most collectQuantum batches.
+    void Collect()
+    {
+        auto requeued = ready_.Run([this](std::size_t index) {
+            auto &subscription = *subscriptions_[index];
+            if (subscription.backfill != nullptr)
+            {
+                if (!pipeline_.Collect(*subscription.backfill, collectQuantum))
+                {
+                    return true;
+                }
+                subscription.backfill.reset();
+                --backfills_;
+                Subscribe(subscription);
+                return false;
+            }
+            // NB: reset before draining, so events that arrive meanwhile signal it again
+            ::ResetEvent(subscription.hEvent);
+            if (!pipeline_.Collect(*subscription.source, collectQuantum))
+            {
+                return true;
+            }
+            ::SetThreadpoolWait(subscription.wait, subscription.hEvent, nullptr);
+            return false;
+        });
+        if (requeued && !::SetEvent(hReady_))
+        {
+            std::terminate();
+        }
+    }
+
+    void Checkpoint()
+    {
+        for (auto &subscription : subscriptions_)
+        {
+            subscription->bookmark.Checkpoint();
+        }
+    }
+
+  private:
+    struct Subscription
+    {
+        Subscription(SubscriptionSet &set, std::size_t index, std::wstring bookmarkFile)
+            : set(set), index(index), bookmark(std::move(bookmarkFile))
+        {
+        }
+
+        SubscriptionSet &set;
+        std::size_t index;
+        BookmarkStore bookmark;
+        HANDLE hEvent{};
+        EVT_HANDLE hSubscription{};
+        std::unique_ptr<SubscriptionSource> source;
+        PTP_WAIT wait{};
+        std::uint64_t since{};
+        std::unique_ptr<BackfillSource> backfill;
+    };
+
+    // Subscribes the channel and arms its wait, once its backfill is drained if it has one.
+    void Subscribe(Subscription &subscription)
+    {
+        subscription.hSubscription =
+            SubscribeEvent(subscription.hEvent, channels_[subscription.index], subscription.bookmark,
+                           subscription.since, options_.filters, Correlating(options_));
+        // NB: the related events have no named Data, so -correlate parses them from the XML
+        subscription.source = std::make_unique<SubscriptionSource>(
+            subscription.hSubscription, Correlating(options_) ? PrintStyle::xml : options_.style,
+            ExtractedFields(options_), &subscription.bookmark, metrics_);
+        ::SetThreadpoolWait(subscription.wait, subscription.hEvent, nullptr);
+    }
+
+    // A thread pool wait is one-shot, Collect arms it again once the subscription is drained.
+    static void CALLBACK OnSignaled(PTP_CALLBACK_INSTANCE, PVOID context, PTP_WAIT, TP_WAIT_RESULT)
+    {
+        auto &subscription = *static_cast<Subscription *>(context);
+        if (subscription.set.ready_.Signal(subscription.index) && !::SetEvent(subscription.set.hReady_))
+        {
+            std::terminate();
+        }
+    }
+
+    std::vector<ChannelQuery> channels_;
+    ReadyQueue ready_;
+    const Options &options_;
+    Pipeline &pipeline_;
+    Metrics *metrics_;
+    HANDLE hReady_{};
+    std::vector<std::unique_ptr<Subscription>> subscriptions_;
+    std::size_t backfills_{};
+};
+
+// Waiting times out at checkpoints so that the bookmark is written while no events arrive.
+inline DWORD CheckpointTimeout(const Options &options)
+{
+    return options.bookmarkFile.empty()
+               ? INFINITE
+               : static_cast<DWORD>(std::chrono::milliseconds(checkpointInterval).count());
+}
+
+} // namespace bizwen
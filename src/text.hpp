@@ -0,0 +1,163 @@
+#pragma once
+
+#include <chrono>
+#include <iterator>
+#include <string>
+
+namespace bizwen
+{
+
+using namespace std::literals;
+
+inline void AppendNumber(std::uint64_t value, std::wstring &output, unsigned base = 10, unsigned width = 1)
+{
+    wchar_t digits[64];
+    auto last = std::end(digits);
+    auto first = last;
+    do
+    {
+        *--first = L"0123456789abcdef"[value % base];
+        value /= base;
+    } while (value != 0 || last - first < static_cast<std::ptrdiff_t>(width));
+    output.append(first, last);
+}
+
+// Parses a decimal or 0x-prefixed hexadecimal event value, returns 0 for anything else. Base 16 reads values
+// such as ModuleTimeStamp that are hexadecimal without the prefix.
+inline std::uint64_t ParseEventNumber(std::wstring_view text, unsigned base = 10) noexcept
+{
+    if (text.starts_with(L"0x"sv) || text.starts_with(L"0X"sv))
+    {
+        base = 16;
+        text.remove_prefix(2);
+    }
+
+    std::uint64_t number{};
+    for (auto ch : text)
+    {
+        unsigned digit{};
+        if (ch >= L'0' && ch <= L'9')
+            digit = ch - L'0';
+        else if (base == 16 && ch >= L'a' && ch <= L'f')
+            digit = ch - L'a' + 10;
+        else if (base == 16 && ch >= L'A' && ch <= L'F')
+            digit = ch - L'A' + 10;
+        else
+            return 0;
+        number = number * base + digit;
+    }
+    return number;
+}
+
+// Appends 2025-01-02T03:04:05.1234567Z, ticks count 100ns since 1601-01-01 like FILETIME.
+inline void AppendFileTime(std::uint64_t ticks, std::wstring &output)
+{
+    constexpr std::uint64_t ticksPerDay = 864'000'000'000;
+    auto date = std::chrono::year_month_day(std::chrono::sys_days(std::chrono::year(1601) / 1 / 1) +
+                                            std::chrono::days(ticks / ticksPerDay));
+    auto time = ticks % ticksPerDay;
+    AppendNumber(static_cast<int>(date.year()), output, 10, 4);
+    output += L'-';
+    AppendNumber(static_cast<unsigned>(date.month()), output, 10, 2);
+    output += L'-';
+    AppendNumber(static_cast<unsigned>(date.day()), output, 10, 2);
+    output += L'T';
+    AppendNumber(time / 36'000'000'000, output, 10, 2);
+    output += L':';
+    AppendNumber(time / 600'000'000 % 60, output, 10, 2);
+    output += L':';
+    AppendNumber(time / 10'000'000 % 60, output, 10, 2);
+    output += L'.';
+    AppendNumber(time % 10'000'000, output, 10, 7);
+    output += L'Z';
+}
+
+// Parses the text written by AppendFileTime, with any number of fractional digits, returns 0 if it is malformed.
+inline std::uint64_t ParseFileTime(std::wstring_view text) noexcept
+{
+    std::uint64_t fields[6]{};
+    constexpr wchar_t separators[] = L"--T::";
+    std::size_t pos = 0;
+    for (std::size_t i = 0; i != std::size(fields); ++i)
+    {
+        auto begin = pos;
+        for (; pos != text.size() && text[pos] >= L'0' && text[pos] <= L'9'; ++pos)
+        {
+            fields[i] = fields[i] * 10 + static_cast<std::uint64_t>(text[pos] - L'0');
+        }
+        if (pos == begin || (i + 1 != std::size(fields) && (pos == text.size() || text[pos++] != separators[i])))
+        {
+            return 0;
+        }
+    }
+
+    std::uint64_t fraction{};
+    if (pos != text.size() && text[pos] == L'.')
+    {
+        unsigned digits = 0;
+        for (++pos; pos != text.size() && text[pos] >= L'0' && text[pos] <= L'9'; ++pos)
+        {
+            if (digits++ < 7)
+            {
+                fraction = fraction * 10 + static_cast<std::uint64_t>(text[pos] - L'0');
+            }
+        }
+        for (; digits < 7; ++digits)
+        {
+            fraction *= 10;
+        }
+    }
+
+    std::chrono::year_month_day date{std::chrono::year(static_cast<int>(fields[0])),
+                                     std::chrono::month(static_cast<unsigned>(fields[1])),
+                                     std::chrono::day(static_cast<unsigned>(fields[2]))};
+    if (!date.ok() || fields[0] < 1601)
+    {
+        return 0;
+    }
+    auto days = std::chrono::sys_days(date) - std::chrono::sys_days(std::chrono::year(1601) / 1 / 1);
+    return static_cast<std::uint64_t>(days.count()) * 864'000'000'000 +
+           ((fields[3] * 60 + fields[4]) * 60 + fields[5]) * 10'000'000 + fraction;
+}
+
+inline std::uint64_t FileTimeNow() noexcept
+{
+    // NB: FILETIME counts from 1601, the system clock from 1970
+    using Ticks = std::chrono::duration<std::int64_t, std::ratio<1, 10'000'000>>;
+    auto now = std::chrono::duration_cast<Ticks>(std::chrono::system_clock::now().time_since_epoch());
+    return static_cast<std::uint64_t>(now.count()) + 116'444'736'000'000'000;
+}
+
+using Clock = std::chrono::steady_clock;
+
+template <typename Rep, typename Period>
+std::uint64_t Nanoseconds(std::chrono::duration<Rep, Period> duration) noexcept
+{
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+}
+
+inline void AppendDuration(std::uint64_t nanoseconds, std::wstring &output)
+{
+    if (nanoseconds < 10'000)
+    {
+        AppendNumber(nanoseconds, output);
+        output += L" ns"sv;
+    }
+    else if (nanoseconds < 10'000'000)
+    {
+        AppendNumber(nanoseconds / 1'000, output);
+        output += L" us"sv;
+    }
+    else if (nanoseconds < 10'000'000'000)
+    {
+        AppendNumber(nanoseconds / 1'000'000, output);
+        output += L" ms"sv;
+    }
+    else
+    {
+        AppendNumber(nanoseconds / 1'000'000'000, output);
+        output += L" s"sv;
+    }
+}
+
+} // namespace bizwen
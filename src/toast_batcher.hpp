@@ -0,0 +1,119 @@
+#pragma once
+
+#include <string>
+
+#include "event_format.hpp"
+#include "text.hpp"
+
+namespace bizwen
+{
+
+using namespace std::literals;
+
+// The errors that follow the first toast of a burst within this window are folded into its summary.
+constexpr auto toastWindow = 2s;
+
+// Batches the toasts of the notification sink. The first error after a quiet window shows at once, those that
+// follow within the window go out together as one "N application errors" toast when it ends. Every toast of a
+// burst carries the same tag, so each one replaces the previous in Action Center, and the burst lasts as long as
+// each window brings further errors. The payload is the toast template with each line of text escaped into it.
+// The caller passes the time and a function that shows a payload with its tag, so that the batcher depends on
+// neither a particular clock nor WinRT.
+class ToastBatcher
+{
+  public:
+    explicit ToastBatcher(Clock::duration window) noexcept : window_(window)
+    {
+    }
+
+    template <typename Show>
+    void Add(std::wstring_view text, Clock::time_point now, Show &&show)
+    {
+        Flush(now, show);
+        if (burst_ != 0)
+        {
+            ++burst_;
+            ++pending_;
+            latest_.assign(text);
+            return;
+        }
+
+        burst_ = 1;
+        end_ = now + window_;
+        tag_.clear();
+        AppendNumber(++bursts_, tag_, 16);
+        Compose({}, text);
+        show(std::wstring_view(xml_), std::wstring_view(tag_));
+    }
+
+    // Shows the summary once the window has ended, or ends the burst when no further errors came.
+    template <typename Show>
+    void Flush(Clock::time_point now, Show &&show)
+    {
+        if (burst_ == 0 || now < end_)
+        {
+            return;
+        }
+        if (pending_ == 0)
+        {
+            burst_ = 0;
+            return;
+        }
+        Summarize(show);
+        end_ = now + window_;
+    }
+
+    // Shows the pending summary right away, when the sink stops.
+    template <typename Show>
+    void Drain(Show &&show)
+    {
+        if (pending_ != 0)
+        {
+            Summarize(show);
+        }
+    }
+
+  private:
+    static constexpr std::wstring_view head =
+        L"<toast duration=\"short\"><visual><binding template=\"ToastGeneric\">"sv;
+    static constexpr std::wstring_view tail = L"</binding></visual></toast>"sv;
+
+    // title is left out when empty
+    void Compose(std::wstring_view title, std::wstring_view text)
+    {
+        xml_.assign(head);
+        for (auto line : {title, text})
+        {
+            if (!line.empty())
+            {
+                xml_ += L"<text>"sv;
+                AppendXmlEscaped(line, xml_);
+                xml_ += L"</text>"sv;
+            }
+        }
+        xml_ += tail;
+    }
+
+    template <typename Show>
+    void Summarize(Show &show)
+    {
+        title_.clear();
+        AppendNumber(burst_, title_);
+        title_ += L" application errors"sv;
+        Compose(title_, latest_);
+        show(std::wstring_view(xml_), std::wstring_view(tag_));
+        pending_ = 0;
+    }
+
+    Clock::duration window_;
+    Clock::time_point end_;
+    std::uint64_t burst_{};   // errors of the current burst, 0 between bursts
+    std::uint64_t pending_{}; // of them not shown yet
+    std::uint64_t bursts_{};
+    std::wstring latest_;
+    std::wstring title_;
+    std::wstring tag_;
+    std::wstring xml_;
+};
+
+} // namespace bizwen
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <exception>
+#include <string>
+// NB: before windows.h, which includes the older winsock.h otherwise
+#include <winsock2.h>
+#include <windows.h>
+#include <winrt/Windows.Data.Xml.Dom.h>
+#include <winrt/Windows.Foundation.h>
+#include <winrt/Windows.UI.Notifications.h>
+#include <winrt/base.h>
+#include <winrt/windows.foundation.collections.h>
+
+#pragma comment(lib, "runtimeobject.lib")
+
+namespace winrt
+{
+using namespace Windows::UI::Notifications;
+using namespace Windows::Foundation;
+using namespace Windows::Data::Xml::Dom;
+} // namespace winrt
+
+namespace bizwen
+{
+
+using namespace std::literals;
+
+inline void RegisterAumidForToast()
+{
+    HKEY hKey{};
+    LONG result =
+        ::RegCreateKeyExW(HKEY_CURRENT_USER, L"Software\\Classes\\AppUserModelId\\Application_Error_Notification_Tool",
+                          0, nullptr, REG_OPTION_VOLATILE, KEY_WRITE, nullptr, &hKey, nullptr);
+
+    if (result != ERROR_SUCCESS)
+    {
+        std::terminate();
+    }
+
+    const wchar_t displayName[] = L"Application Error Notification";
+    result = ::RegSetValueExW(hKey, L"DisplayName", 0, REG_SZ, reinterpret_cast<const BYTE *>(displayName),
+                              sizeof(displayName));
+
+    if (result != ERROR_SUCCESS)
+    {
+        std::terminate();
+    }
+
+    if (RegCloseKey(hKey) != ERROR_SUCCESS)
+    {
+        std::terminate();
+    }
+}
+
+inline void CleanupRegistry()
+{
+    winrt::ToastNotificationManager::History().Clear(L"Application_Error_Notification_Tool"sv);
+
+    auto errorCode =
+        ::RegDeleteKeyW(HKEY_CURRENT_USER, L"Software\\Classes\\AppUserModelId\\Application_Error_Notification_Tool");
+    if (errorCode != ERROR_SUCCESS && errorCode != ERROR_FILE_NOT_FOUND)
+    {
+        std::terminate();
+    }
+}
+
+// The toast notifier of the tool, created once by the notification sink since creating one for every toast
+// activates it anew.
+class ToastNotifier
+{
+  public:
+    ToastNotifier()
+        : notifier_(winrt::ToastNotificationManager::CreateToastNotifier(L"Application_Error_Notification_Tool"sv))
+    {
+    }
+
+    void Show(std::wstring_view xml, std::wstring_view tag) const
+    {
+        winrt::XmlDocument toastXml;
+        toastXml.LoadXml(winrt::hstring(xml));
+        winrt::ToastNotification toast(toastXml);
+        toast.ExpiresOnReboot(true);
+        toast.Tag(winrt::hstring(tag));
+        toast.Group(L"errors"sv);
+        notifier_.Show(toast);
+    }
+
+  private:
+    winrt::ToastNotifier notifier_;
+};
+
+} // namespace bizwen
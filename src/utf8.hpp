@@ -0,0 +1,320 @@
+#pragma once
+
+#include <bit>
+#include <exception>
+#include <string>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#if defined(_M_X64) || defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#ifdef _WIN32
+#include <winsock2.h>
+#include <windows.h>
+#endif
+
+namespace bizwen
+{
+
+// UTF-16 to UTF-8 for everything that leaves the process as bytes: temp files and redirected standard output.
+// Event content is mostly ASCII, so the vector loops narrow a block of units at once and keep its ASCII
+// prefix, then the scalar encoder takes the one code point that ended it.
+
+// Encodes the code point starting at in, an unpaired surrogate becomes U+FFFD and clears valid.
+inline char *EncodeUtf8(const char16_t *&in, const char16_t *last, char *out, bool &valid) noexcept
+{
+    std::uint32_t unit = *in++;
+    if (unit < 0x80)
+    {
+        *out++ = static_cast<char>(unit);
+        return out;
+    }
+    if (unit < 0x800)
+    {
+        *out++ = static_cast<char>(0xc0 | unit >> 6);
+        *out++ = static_cast<char>(0x80 | (unit & 0x3f));
+        return out;
+    }
+    if (unit >= 0xd800 && unit < 0xe000)
+    {
+        if (unit < 0xdc00 && in != last && *in >= 0xdc00 && *in < 0xe000)
+        {
+            auto codePoint = 0x10000 + ((unit - 0xd800) << 10) + (*in++ - 0xdc00u);
+            *out++ = static_cast<char>(0xf0 | codePoint >> 18);
+            *out++ = static_cast<char>(0x80 | (codePoint >> 12 & 0x3f));
+            *out++ = static_cast<char>(0x80 | (codePoint >> 6 & 0x3f));
+            *out++ = static_cast<char>(0x80 | (codePoint & 0x3f));
+            return out;
+        }
+        valid = false;
+        unit = 0xfffd;
+    }
+    *out++ = static_cast<char>(0xe0 | unit >> 12);
+    *out++ = static_cast<char>(0x80 | (unit >> 6 & 0x3f));
+    *out++ = static_cast<char>(0x80 | (unit & 0x3f));
+    return out;
+}
+
+inline char *TranscodeScalar(const char16_t *in, const char16_t *last, char *out, bool &valid) noexcept
+{
+    while (in != last)
+    {
+        out = EncodeUtf8(in, last, out, valid);
+    }
+    return out;
+}
+
+#if defined(_M_X64) || defined(__x86_64__)
+
+#if defined(__GNUC__) || defined(__clang__)
+#define BIZWEN_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define BIZWEN_TARGET_AVX2
+#endif
+
+// SSE2 is part of x64, so this is the baseline.
+inline char *TranscodeSse2(const char16_t *in, const char16_t *last, char *out, bool &valid) noexcept
+{
+    auto high = _mm_set1_epi16(static_cast<short>(0xff80));
+    auto zero = _mm_setzero_si128();
+    while (last - in >= 8)
+    {
+        auto units = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+        // NB: bytes of non-ASCII units are saturated garbage, the encoder overwrites them
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out), _mm_packus_epi16(units, units));
+        auto ascii = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(units, high), zero)));
+        if (ascii == 0xffff)
+        {
+            in += 8;
+            out += 8;
+            continue;
+        }
+        auto prefix = std::countr_one(ascii) / 2;
+        in += prefix;
+        out += prefix;
+        out = EncodeUtf8(in, last, out, valid);
+    }
+    return TranscodeScalar(in, last, out, valid);
+}
+
+inline BIZWEN_TARGET_AVX2 char *TranscodeAvx2(const char16_t *in, const char16_t *last, char *out, bool &valid) noexcept
+{
+    auto high = _mm256_set1_epi16(static_cast<short>(0xff80));
+    while (last - in >= 16)
+    {
+        auto units = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in));
+        // packus works per 128-bit lane, the permutation joins the low halves of both lanes
+        auto packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(units, units), 0b1000);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm256_castsi256_si128(packed));
+        auto ascii = static_cast<unsigned>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_and_si256(units, high), _mm256_setzero_si256())));
+        if (ascii == 0xffffffff)
+        {
+            in += 16;
+            out += 16;
+            continue;
+        }
+        auto prefix = std::countr_one(ascii) / 2;
+        in += prefix;
+        out += prefix;
+        out = EncodeUtf8(in, last, out, valid);
+    }
+    return TranscodeSse2(in, last, out, valid);
+}
+
+inline bool HasAvx2() noexcept
+{
+#ifdef _MSC_VER
+    int info[4];
+    ::__cpuid(info, 0);
+    if (info[0] < 7)
+    {
+        return false;
+    }
+    // NB: the OS must also save the YMM registers on context switches
+    ::__cpuid(info, 1);
+    if ((info[2] & 1 << 27) == 0 || (::_xgetbv(0) & 6) != 6)
+    {
+        return false;
+    }
+    ::__cpuidex(info, 7, 0);
+    return (info[1] & 1 << 5) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+using Transcoder = char *(*)(const char16_t *, const char16_t *, char *, bool &) noexcept;
+
+// The fastest transcoder this processor supports, picked once.
+inline Transcoder BestTranscoder() noexcept
+{
+#if defined(_M_X64) || defined(__x86_64__)
+    static const Transcoder transcoder = HasAvx2() ? TranscodeAvx2 : TranscodeSse2;
+    return transcoder;
+#else
+    return TranscodeScalar;
+#endif
+}
+
+// Appends text as UTF-8 and returns whether it was valid UTF-16, unpaired surrogates become U+FFFD.
+inline bool AppendUtf8(std::u16string_view text, std::string &output, Transcoder transcoder = BestTranscoder())
+{
+    bool valid = true;
+    auto used = output.size();
+    // NB: every unit takes at most 3 bytes, a surrogate pair takes 4
+    output.resize_and_overwrite(used + text.size() * 3, [&](char *buffer, std::size_t) {
+        return static_cast<std::size_t>(transcoder(text.data(), text.data() + text.size(), buffer + used, valid) -
+                                        buffer);
+    });
+    return valid;
+}
+
+// The UTF-16 units of text. On Windows wchar_t holds UTF-16 and this is a view of text, elsewhere it holds UTF-32
+// and the units are encoded into buffer.
+inline std::u16string_view AsUtf16(std::wstring_view text, std::u16string &buffer)
+{
+    if constexpr (sizeof(wchar_t) == sizeof(char16_t))
+    {
+        return {reinterpret_cast<const char16_t *>(text.data()), text.size()};
+    }
+    else
+    {
+        buffer.clear();
+        for (auto unit : text)
+        {
+            auto code = static_cast<std::uint32_t>(unit);
+            if (code > 0xffff && code <= 0x10ffff)
+            {
+                code -= 0x10000;
+                buffer += static_cast<char16_t>(0xd800 | code >> 10);
+                buffer += static_cast<char16_t>(0xdc00 | (code & 0x3ff));
+            }
+            else
+            {
+                buffer += static_cast<char16_t>(code > 0x10ffff ? 0xfffd : code);
+            }
+        }
+        return buffer;
+    }
+}
+
+inline bool AppendUtf8(std::wstring_view text, std::string &output)
+{
+    if constexpr (sizeof(wchar_t) == sizeof(char16_t))
+    {
+        return AppendUtf8(std::u16string_view(reinterpret_cast<const char16_t *>(text.data()), text.size()), output);
+    }
+    else
+    {
+        // NB: UTF-32 outside Windows, surrogates and values beyond U+10FFFF become U+FFFD
+        bool valid = true;
+        for (auto unit : text)
+        {
+            auto code = static_cast<std::uint32_t>(unit);
+            if ((code >= 0xd800 && code < 0xe000) || code > 0x10ffff)
+            {
+                code = 0xfffd;
+                valid = false;
+            }
+            if (code < 0x80)
+            {
+                output += static_cast<char>(code);
+                continue;
+            }
+            char bytes[4];
+            std::size_t length = code < 0x800 ? 2 : code < 0x10000 ? 3 : 4;
+            for (auto i = length; --i != 0; code >>= 6)
+            {
+                bytes[i] = static_cast<char>(0x80 | (code & 0x3f));
+            }
+            bytes[0] = static_cast<char>((0xf00 >> length & 0xff) | code);
+            output.append(bytes, length);
+        }
+        return valid;
+    }
+}
+
+// Appends UTF-8 as wide text. A byte that does not begin a well-formed sequence, or the bytes of a sequence cut
+// short, become one U+FFFD.
+inline void AppendWide(std::string_view text, std::wstring &output)
+{
+#ifdef _WIN32
+    if (text.empty())
+    {
+        return;
+    }
+    // UTF-16 never needs more code units than UTF-8
+    auto used = output.size();
+    output.resize_and_overwrite(used + text.size(), [text, used](wchar_t *data, std::size_t size) {
+        auto length = ::MultiByteToWideChar(CP_UTF8, 0, text.data(), static_cast<int>(text.size()), data + used,
+                                            static_cast<int>(size - used));
+        if (length == 0)
+        {
+            std::terminate();
+        }
+        return used + static_cast<std::size_t>(length);
+    });
+#else
+    for (std::size_t i = 0; i != text.size();)
+    {
+        auto lead = static_cast<unsigned char>(text[i]);
+        // NB: 0 for a continuation byte and for leads of overlong or out of range sequences
+        std::size_t length = lead < 0x80   ? 1
+                             : lead < 0xc2 ? 0
+                             : lead < 0xe0 ? 2
+                             : lead < 0xf0 ? 3
+                             : lead < 0xf5 ? 4
+                                           : 0;
+        auto code = length == 1 ? std::uint32_t{lead} : std::uint32_t{lead} & 0x7fu >> length;
+        std::size_t read = 1;
+        for (; read < length && i + read != text.size() && (static_cast<unsigned char>(text[i + read]) & 0xc0) == 0x80;
+             ++read)
+        {
+            code = code << 6 | (static_cast<unsigned char>(text[i + read]) & 0x3f);
+        }
+        i += read;
+        if (read != length || (length == 3 && (code < 0x800 || (code >= 0xd800 && code < 0xe000))) ||
+            (length == 4 && (code < 0x10000 || code > 0x10ffff)))
+        {
+            output += L'\ufffd';
+        }
+        else
+        {
+            // NB: wchar_t holds UTF-32 outside Windows
+            output += static_cast<wchar_t>(code);
+        }
+    }
+#endif
+}
+
+// Appends UTF-16 as wide text. Outside Windows surrogate pairs are joined, a lone surrogate becomes U+FFFD.
+inline void AppendWide(std::u16string_view text, std::wstring &output)
+{
+    if constexpr (sizeof(wchar_t) == sizeof(char16_t))
+    {
+        output.append(reinterpret_cast<const wchar_t *>(text.data()), text.size());
+    }
+    else
+    {
+        for (std::size_t i = 0; i != text.size(); ++i)
+        {
+            std::uint32_t code = text[i];
+            if (code >= 0xd800 && code < 0xdc00 && i + 1 != text.size() && text[i + 1] >= 0xdc00 &&
+                text[i + 1] < 0xe000)
+            {
+                code = 0x10000 + ((code - 0xd800) << 10 | (text[++i] - 0xdc00u));
+            }
+            else if (code >= 0xd800 && code < 0xe000)
+            {
+                code = 0xfffd;
+            }
+            output += static_cast<wchar_t>(code);
+        }
+    }
+}
+
+} // namespace bizwen
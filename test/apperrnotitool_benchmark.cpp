@@ -0,0 +1,50 @@
+// Runs the stages of -benchmark on any platform and prints the same JSON. With a file argument the result is
+// compared with that earlier JSON like -baseline=F, and the program exits with 1 if a stage regressed.
+
+#include <cstdlib>
+#include <new>
+#include <string>
+
+#include "../src/benchmark.hpp"
+#include "../src/console.hpp"
+
+#if defined(__GNUC__) && !defined(__clang__)
+// NB: GCC takes the free in operator delete for a mismatch with the replaced operator new
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void *operator new(std::size_t size)
+{
+    ++bizwen::allocations;
+    bizwen::allocatedBytes += size;
+    if (auto p = std::malloc(size == 0 ? 1 : size))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+int main(int argc, char **argv)
+{
+    bizwen::allocationsCounted = true;
+    auto results = bizwen::RunBenchmark();
+    auto json = bizwen::BenchmarkJson(results);
+    std::wstring report(json.begin(), json.end());
+    bool passed = true;
+    if (argc > 1)
+    {
+        passed = bizwen::CheckBaseline(results, argv[1], report);
+    }
+    bizwen::WriteContentConsole(report);
+    return passed ? 0 : 1;
+}
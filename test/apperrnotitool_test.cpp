@@ -0,0 +1,1955 @@
+// Tests of the parts of the tool that need neither the event log nor the desktop. The portable parts build and
+// run anywhere, see CMakeLists.txt; on Windows the backfill and -forward are tested too. Every failed check is
+// printed and the exit code is 1 if any failed.
+#ifdef _WIN32
+#define APPERRNOTITOOL_TEST
+#include "../apperrnotitool.cpp"
+#endif
+
+#include <bit>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include "../src/archive.hpp"
+#include "../src/benchmark.hpp"
+#include "../src/bounded_queue.hpp"
+#include "../src/coalescer.hpp"
+#include "../src/correlator.hpp"
+#include "../src/event_filter.hpp"
+#include "../src/event_format.hpp"
+#include "../src/event_output.hpp"
+#include "../src/event_parser.hpp"
+#include "../src/event_source.hpp"
+#include "../src/event_value.hpp"
+#include "../src/history.hpp"
+#include "../src/limiter.hpp"
+#include "../src/message_box_queue.hpp"
+#include "../src/module_index.hpp"
+#include "../src/pipeline.hpp"
+#include "../src/rolling_log.hpp"
+#include "../src/toast_batcher.hpp"
+#include "../src/utf8.hpp"
+
+namespace
+{
+
+using namespace bizwen;
+
+// NB: atomic, some checks run on the threads of a test
+std::atomic<int> failures = 0;
+
+void Check(bool condition, const char *expression, int line)
+{
+    if (!condition)
+    {
+        std::fprintf(stderr, "apperrnotitool_test.cpp(%d): check failed: %s\n", line, expression);
+        ++failures;
+    }
+}
+
+#define CHECK(expression) Check(static_cast<bool>(expression), #expression, __LINE__)
+
+// Replays rendered events, a batch at a time like the live subscription.
+class ReplaySource final : public EventSource
+{
+  public:
+    explicit ReplaySource(std::vector<std::wstring> events) : events_(std::move(events))
+    {
+    }
+
+    std::size_t Next(std::span<EventArena *const> batch) override
+    {
+        std::size_t count = 0;
+        for (; count != batch.size() && next_ != events_.size(); ++count)
+        {
+            batch[count]->content = events_[next_++];
+        }
+        return count;
+    }
+
+  private:
+    std::vector<std::wstring> events_;
+    std::size_t next_{};
+};
+
+// Collects a source to the end in batches of arenas, returning the contents in order.
+std::vector<std::wstring> Drain(EventSource &source, std::size_t batchSize)
+{
+    std::vector<EventArena> arenas(batchSize);
+    std::vector<EventArena *> batch;
+    for (auto &arena : arenas)
+    {
+        batch.push_back(&arena);
+    }
+    std::vector<std::wstring> contents;
+    while (auto count = source.Next(batch))
+    {
+        for (std::size_t i = 0; i != count; ++i)
+        {
+            contents.push_back(arenas[i].content);
+        }
+    }
+    return contents;
+}
+
+#ifdef _WIN32
+// A socket bound to a free loopback port, which a test reads from or, for TCP, accepts connections on.
+class LoopbackSocket
+{
+  public:
+    explicit LoopbackSocket(bool tcp) : socket_(::socket(AF_INET, tcp ? SOCK_STREAM : SOCK_DGRAM, 0))
+    {
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        if (socket_ == INVALID_SOCKET || ::bind(socket_, reinterpret_cast<sockaddr *>(&address), length) != 0 ||
+            ::getsockname(socket_, reinterpret_cast<sockaddr *>(&address), &length) != 0 ||
+            (tcp && ::listen(socket_, 4) != 0))
+        {
+            std::terminate();
+        }
+        port_ = std::to_wstring(ntohs(address.sin_port));
+    }
+
+    LoopbackSocket(const LoopbackSocket &) = delete;
+    LoopbackSocket &operator=(const LoopbackSocket &) = delete;
+
+    ~LoopbackSocket()
+    {
+        ::closesocket(socket_);
+    }
+
+    SOCKET Get() const noexcept
+    {
+        return socket_;
+    }
+
+    const std::wstring &Port() const noexcept
+    {
+        return port_;
+    }
+
+  private:
+    SOCKET socket_;
+    std::wstring port_;
+};
+#endif
+
+// Numeric references to anything but a character, malformed ones and runs of digits too long for any character
+// all decode to U+FFFD; entities the parser does not know and a lone '&' are kept as they are.
+void TestDecodeXmlText()
+{
+    struct Case
+    {
+        std::wstring_view text;
+        std::wstring_view decoded;
+    };
+    constexpr Case cases[]{
+        {L"plain"sv, L"plain"sv},
+        {L"&lt;&gt;&amp;&quot;&apos;"sv, L"<>&\"'"sv},
+        {L"a\r\nb\rc\n"sv, L"a\nb\nc\n"sv},
+        {L"&#65;&#x42;&#x63;&#13;"sv, L"ABc\r"sv},
+        {L"&#x1F600;&#128512;"sv, L"\U0001F600\U0001F600"sv},
+        {L"&#xFFFD;&#x10FFFF;"sv, L"\uFFFD\U0010FFFF"sv},
+        {L"&#x;&#;"sv, L"\uFFFD\uFFFD"sv},
+        {L"&#x110000;&#1114112;"sv, L"\uFFFD\uFFFD"sv},
+        {L"&#99999999999999999999;&#xFFFFFFFFFFFFFFFF41;"sv, L"\uFFFD\uFFFD"sv},
+        {L"&#xD800;&#0;&#12a;&#xG;"sv, L"\uFFFD\uFFFD\uFFFD\uFFFD"sv},
+        {L"&nbsp;&;"sv, L"&nbsp;&;"sv},
+        {L"Tom & Jerry"sv, L"Tom & Jerry"sv},
+    };
+    for (auto &test : cases)
+    {
+        std::wstring text(test.text);
+        CHECK(DecodeXmlText(std::span(text)) == test.decoded);
+    }
+}
+
+struct EventFixture
+{
+    std::wstring_view xml;
+    // the name and value of each field, the fields left out are empty
+    std::initializer_list<std::pair<std::wstring_view, std::wstring_view>> fields;
+};
+
+// Compares every field of the parsed event with the fixture, a mismatch names the fixture and the field.
+void CheckEventLog(const EventLog &eventLog, const EventFixture &fixture, std::size_t index, FieldMask mask, int line)
+{
+    for (std::size_t i = 0; i != std::size(eventFields); ++i)
+    {
+        std::wstring_view expected;
+        for (auto &[name, value] : fixture.fields)
+        {
+            if (name == eventFields[i].name && (mask >> i & 1) != 0)
+            {
+                expected = value;
+            }
+        }
+        auto field = "ParseEventLog fixture "s + std::to_string(index) + " field ";
+        field.append(eventFields[i].name.begin(), eventFields[i].name.end());
+        Check(eventLog.*eventFields[i].member == expected, field.c_str(), line);
+    }
+}
+
+// Rendered Application Error events checked field by field: values with entities, character references and
+// line breaks, non-ASCII text, empty and unnamed Data, and a packaged app. Fields outside the mask stay empty.
+void TestParseEventLog()
+{
+    constexpr auto header =
+        L"<Event xmlns='http://schemas.microsoft.com/win/2004/08/events/event'><System>"
+        L"<Provider Name='Application Error'/><EventID Qualifiers='0'>1000</EventID>"
+        L"<TimeCreated SystemTime='2024-05-01T10:20:30.1234567Z'/><Security UserID='S-1-5-21-1-2-3-1001'/>"
+        L"</System>"sv;
+    auto escaped = std::wstring(header) +
+                   L"<EventData><Data Name='AppName'>Tom &amp; Jerry&apos;s &lt;Game&gt;.exe</Data>"
+                   L"<Data Name='AppVersion'>1.2.3.4</Data><Data Name='ExceptionCode'>c0000005</Data>"
+                   L"<Data Name='AppPath'>C:\\Games\\&quot;Tom&quot;\\game.exe</Data>"
+                   L"<Data Name='ModulePath'>line1\r\nline2&#13;&#10;&#x9;end</Data>"
+                   L"<Data Name='ProcessId'>0x1a2c</Data></EventData></Event>"s;
+    auto nonAscii = std::wstring(header) +
+                    L"<EventData><Data Name='AppName'>caf\u00e9-client.exe</Data>"
+                    L"<Data Name='ModuleName'>\u6a21\u5757.dll</Data>"
+                    L"<Data Name='AppPath'>D:\\\u5de5\u5177\\\u6d4b\u8bd5 &amp; \u8c03\u8bd5\\x.exe</Data>"
+                    L"<Data Name='FaultingOffset'>&#x1F600;\U0001F601</Data></EventData></Event>"s;
+    auto empty = std::wstring(header) +
+                 L"<EventData><Data Name='AppName'>a.exe</Data><Data Name='ModuleVersion'/>"
+                 L"<Data Name='FaultingOffset'></Data><Data>unnamed</Data><Data Name='Unknown'>x</Data>"
+                 L"<Data Name='ModuleName'>b.dll</Data></EventData></Event>"s;
+    auto packaged = std::wstring(header) +
+                    L"<EventData><Data Name=\"AppName\">CalculatorApp.exe</Data>"
+                    L"<Data Name=\"IntegratorReportId\">4f3b2a10-0000-0000-0000-000000000000</Data>"
+                    L"<Data Name=\"PackageFullName\">Microsoft.WindowsCalculator_11.2307.4.0_x64__8wekyb3d8bbwe</Data>"
+                    L"<Data Name=\"PackageRelativeAppId\">App</Data></EventData></Event>"s;
+
+    constexpr auto systemTime = L"2024-05-01T10:20:30.1234567Z"sv;
+    constexpr auto userId = L"S-1-5-21-1-2-3-1001"sv;
+    EventFixture fixtures[]{
+        {escaped,
+         {{L"SystemTime"sv, systemTime},
+          {L"UserID"sv, userId},
+          {L"AppName"sv, L"Tom & Jerry's <Game>.exe"sv},
+          {L"AppVersion"sv, L"1.2.3.4"sv},
+          {L"ExceptionCode"sv, L"c0000005"sv},
+          {L"AppPath"sv, L"C:\\Games\\\"Tom\"\\game.exe"sv},
+          {L"ModulePath"sv, L"line1\nline2\r\n\tend"sv},
+          {L"ProcessId"sv, L"0x1a2c"sv}}},
+        {nonAscii,
+         {{L"SystemTime"sv, systemTime},
+          {L"UserID"sv, userId},
+          {L"AppName"sv, L"caf\u00e9-client.exe"sv},
+          {L"ModuleName"sv, L"\u6a21\u5757.dll"sv},
+          {L"AppPath"sv, L"D:\\\u5de5\u5177\\\u6d4b\u8bd5 & \u8c03\u8bd5\\x.exe"sv},
+          {L"FaultingOffset"sv, L"\U0001F600\U0001F601"sv}}},
+        {empty,
+         {{L"SystemTime"sv, systemTime},
+          {L"UserID"sv, userId},
+          {L"AppName"sv, L"a.exe"sv},
+          {L"ModuleName"sv, L"b.dll"sv}}},
+        {packaged,
+         {{L"SystemTime"sv, systemTime},
+          {L"UserID"sv, userId},
+          {L"AppName"sv, L"CalculatorApp.exe"sv},
+          {L"IntegratorReportId"sv, L"4f3b2a10-0000-0000-0000-000000000000"sv},
+          {L"PackageFullName"sv, L"Microsoft.WindowsCalculator_11.2307.4.0_x64__8wekyb3d8bbwe"sv},
+          {L"PackageRelativeAppId"sv, L"App"sv}}},
+    };
+
+    for (auto mask : {allFields, minimalFields})
+    {
+        for (std::size_t i = 0; i != std::size(fixtures); ++i)
+        {
+            EventArena arena;
+            arena.content.assign(fixtures[i].xml);
+            ParseEventLog(arena.content, arena.eventLog, mask);
+            CheckEventLog(arena.eventLog, fixtures[i], i, mask, __LINE__);
+        }
+    }
+}
+
+// Values rendered by EvtRenderEventValues come out as EvtRenderEventXml would print them.
+void TestEventValues()
+{
+    auto format = [](const EVT_VARIANT &value) {
+        std::wstring output;
+        AppendEventValue(value, output);
+        return output;
+    };
+
+    EVT_VARIANT value{};
+    value.Type = EvtVarTypeNull;
+    CHECK(format(value).empty());
+    value.Type = EvtVarTypeString;
+    value.StringVal = L"";
+    CHECK(format(value).empty());
+    value.StringVal = L"caf\u00e9.exe";
+    CHECK(format(value) == L"caf\u00e9.exe"sv);
+    value.Type = EvtVarTypeAnsiString;
+    value.AnsiStringVal = "caf\xe9";
+    CHECK(format(value) == L"caf\u00e9"sv);
+
+    value.Type = EvtVarTypeFileTime;
+    value.FileTimeVal = 133'590'324'301'234'567;
+    CHECK(format(value) == L"2024-05-01T10:20:30.1234567Z"sv);
+    SYSTEMTIME systemTime{2024, 5, 3, 1, 10, 20, 30, 123};
+    value.Type = EvtVarTypeSysTime;
+    value.SysTimeVal = &systemTime;
+    CHECK(format(value) == L"2024-05-01T10:20:30.1230000Z"sv);
+
+    // S-1-5-21-1-2-3-1001: revision, count, authority big-endian, then the subauthorities little-endian
+    unsigned char sid[]{1, 5, 0, 0, 0, 0, 0, 5, 21, 0, 0, 0, 1, 0, 0, 0, 2, 0, 0, 0, 3, 0, 0, 0, 0xe9, 3, 0, 0};
+    value.Type = EvtVarTypeSid;
+    value.SidVal = sid;
+    CHECK(format(value) == L"S-1-5-21-1-2-3-1001"sv);
+
+    value.Type = EvtVarTypeHexInt64;
+    value.UInt64Val = 0x7ffe'1234'abcd;
+    CHECK(format(value) == L"0x7ffe1234abcd"sv);
+    value.UInt64Val = 0;
+    CHECK(format(value) == L"0x0"sv);
+    value.Type = EvtVarTypeHexInt32;
+    value.UInt32Val = 0xc0000005;
+    CHECK(format(value) == L"0xc0000005"sv);
+    value.Type = EvtVarTypeInt64;
+    value.Int64Val = std::numeric_limits<std::int64_t>::min();
+    CHECK(format(value) == L"-9223372036854775808"sv);
+    value.Type = EvtVarTypeUInt16;
+    value.UInt16Val = 65535;
+    CHECK(format(value) == L"65535"sv);
+    value.Type = EvtVarTypeBoolean;
+    value.BooleanVal = 1;
+    CHECK(format(value) == L"true"sv);
+
+    GUID guid{0x0123abcd, 0x4567, 0x89ef, {0xfe, 0xdc, 0xba, 0x98, 0x76, 0x54, 0x32, 0x10}};
+    value.Type = EvtVarTypeGuid;
+    value.GuidVal = &guid;
+    CHECK(format(value) == L"{0123ABCD-4567-89EF-FEDC-BA9876543210}"sv);
+
+    // one value per selected field in order, a null value leaves its field empty
+    EVT_VARIANT values[4]{};
+    values[0].Type = EvtVarTypeFileTime;
+    values[0].FileTimeVal = 133'590'324'301'234'567;
+    values[1].Type = EvtVarTypeString;
+    values[1].StringVal = L"a.exe";
+    values[2].Type = EvtVarTypeNull;
+    values[3].Type = EvtVarTypeHexInt32;
+    values[3].UInt32Val = 0xc0000005;
+    auto fields = FieldBit(L"SystemTime"sv) | FieldBit(L"AppName"sv) | FieldBit(L"ModuleName"sv) |
+                  FieldBit(L"ExceptionCode"sv);
+    EventArena arena;
+    DecodeEventValues(values, arena, fields);
+    CHECK(arena.decoded);
+    CHECK(arena.created == 133'590'324'301'234'567);
+    for (std::size_t i = 0; i != std::size(eventFields); ++i)
+    {
+        auto name = eventFields[i].name;
+        auto expected = name == L"SystemTime"sv      ? L"2024-05-01T10:20:30.1234567Z"sv
+                        : name == L"AppName"sv       ? L"a.exe"sv
+                        : name == L"ExceptionCode"sv ? L"0xc0000005"sv
+                                                     : L""sv;
+        CHECK(arena.eventLog.*eventFields[i].member == expected);
+    }
+}
+
+// -jsonl strings escape quotes, backslashes and control characters, and keep any other text as it is.
+void TestJsonEscaping()
+{
+    auto escape = [](std::wstring_view text) {
+        std::wstring output;
+        AppendJsonEscaped(text, output);
+        return output;
+    };
+    CHECK(escape(L""sv).empty());
+    CHECK(escape(L"plain text"sv) == L"plain text"sv);
+    CHECK(escape(L"say \"hi\" from C:\\dir\\"sv) == L"say \\\"hi\\\" from C:\\\\dir\\\\"sv);
+    CHECK(escape(L"a\nb\rc\td"sv) == L"a\\nb\\rc\\td"sv);
+    CHECK(escape(std::wstring_view(L"\0\x01\x08\x0b\x0c\x1b\x1f", 7)) ==
+          L"\\u0000\\u0001\\u0008\\u000b\\u000c\\u001b\\u001f"sv);
+    CHECK(escape(L" ~\x7f"sv) == L" ~\x7f"sv);
+    CHECK(escape(L"caf\u00e9 \u6a21\u5757 \U0001F600"sv) == L"caf\u00e9 \u6a21\u5757 \U0001F600"sv);
+    CHECK(escape(L"\U0001F600\"\U0001F601"sv) == L"\U0001F600\\\"\U0001F601"sv);
+
+    std::wstring output = L"x"s;
+    AppendJsonEscaped(L"\""sv, output);
+    CHECK(output == L"x\\\""sv);
+
+    EventLog eventLog;
+    eventLog.appName = L"a\"b.exe"sv;
+    eventLog.exceptionCode = L"c0000005"sv;
+    output.clear();
+    FormatEventJson(eventLog, allFields, output);
+    CHECK(output == L"{\"AppName\":\"a\\\"b.exe\",\"ExceptionCode\":\"c0000005\"}\n"sv);
+    output.clear();
+    FormatEventJson(EventLog{}, allFields, output);
+    CHECK(output == L"{}\n"sv);
+    output.clear();
+    FormatNote(PrintStyle::jsonl, L"2 more\n"sv, output);
+    CHECK(output == L"{\"Note\":\"2 more\\n\"}\n"sv);
+}
+
+// A u32 of a -binary record, stored low unit first.
+std::uint32_t BinaryU32(std::wstring_view units, std::size_t at)
+{
+    return static_cast<std::uint32_t>(units[at] & 0xffff) | static_cast<std::uint32_t>(units[at + 1] & 0xffff) << 16;
+}
+
+// The values of a -binary record after its size and mask, checking that they fill the record exactly.
+std::vector<std::wstring_view> BinaryFields(std::wstring_view record)
+{
+    std::vector<std::wstring_view> values;
+    std::size_t at = 4;
+    while (at < record.size())
+    {
+        std::size_t length = record[at] & 0xffff;
+        values.push_back(record.substr(at + 1, length));
+        at += 1 + length;
+    }
+    CHECK(at == record.size());
+    return values;
+}
+
+// -binary records are size:u32 mask:u32 field*, size counting every unit of the record and each present field
+// being length:u16 unit[length] in the order of eventFields. Longer values are cut at 65535 units, and a note is
+// the only field of a record with bit 31 set.
+void TestBinaryRecords()
+{
+    std::wstring longValue(70'000, L'x');
+    EventLog eventLog;
+    eventLog.appName = L"a.exe"sv;
+    eventLog.exceptionCode = L"c0000005"sv;
+    eventLog.appPath = longValue;
+    eventLog.modulePath = std::wstring_view(longValue).substr(0, 65'535);
+
+    // NB: records are appended to whatever the buffer holds
+    std::wstring output = L"prefix"s;
+    FormatEventBinary(eventLog, allFields, output);
+    auto record = std::wstring_view(output).substr(6);
+    CHECK(BinaryU32(record, 0) == record.size());
+    CHECK(BinaryU32(record, 2) == (FieldBit(L"AppName"sv) | FieldBit(L"ExceptionCode"sv) | FieldBit(L"AppPath"sv) |
+                                   FieldBit(L"ModulePath"sv)));
+    auto values = BinaryFields(record);
+    CHECK(values.size() == 4);
+    CHECK(values.size() == 4 && values[0] == L"a.exe"sv && values[1] == L"c0000005"sv);
+    CHECK(values.size() == 4 && values[2] == std::wstring_view(longValue).substr(0, 65'535));
+    CHECK(values.size() == 4 && values[3] == std::wstring_view(longValue).substr(0, 65'535));
+    CHECK(record.size() == 4 + 1 + 5 + 1 + 8 + 2 * (1 + 65'535));
+
+    output.clear();
+    FormatEventBinary(eventLog, FieldBit(L"ExceptionCode"sv), output);
+    CHECK(output.size() == 13 && BinaryU32(output, 0) == 13 && BinaryU32(output, 2) == FieldBit(L"ExceptionCode"sv));
+    output.clear();
+    FormatEventBinary(EventLog{}, allFields, output);
+    CHECK(output.size() == 4 && BinaryU32(output, 0) == 4 && BinaryU32(output, 2) == 0);
+
+    output.clear();
+    FormatNote(PrintStyle::binary, L"2 more"sv, output);
+    CHECK(BinaryU32(output, 0) == output.size() && BinaryU32(output, 2) == std::uint32_t{1} << 31);
+    CHECK(BinaryFields(output) == std::vector{L"2 more"sv});
+}
+
+// Every transcoder this processor runs turns the same UTF-16 into the same bytes and the same validity as the
+// scalar one: random text of every kind of unit, and ASCII runs around a surrogate pair split across the 8 and
+// 16 unit blocks of the vector loops, or a lone surrogate there, followed by tails of 0 to 31 units.
+void TestTranscoders()
+{
+    std::vector<Transcoder> transcoders{TranscodeScalar};
+#if defined(_M_X64) || defined(__x86_64__)
+    transcoders.push_back(TranscodeSse2);
+    if (HasAvx2())
+    {
+        transcoders.push_back(TranscodeAvx2);
+    }
+#endif
+
+    std::vector<std::u16string> inputs;
+    CorpusRandom random;
+    for (std::size_t i = 0; i != 2'000; ++i)
+    {
+        auto &units = inputs.emplace_back();
+        auto length = random.Below(80);
+        while (units.size() < length)
+        {
+            // NB: mostly ASCII like event text, so the vector loops take both of their paths
+            switch (random.Below(8))
+            {
+            case 0:
+                units += static_cast<char16_t>(0x80 + random.Below(0x780));
+                break;
+            case 1:
+                units += static_cast<char16_t>(0x800 + random.Below(0xd000));
+                break;
+            case 2:
+                units += static_cast<char16_t>(0xd800 + random.Below(0x400));
+                units += static_cast<char16_t>(0xdc00 + random.Below(0x400));
+                break;
+            case 3:
+                units += static_cast<char16_t>(0xd800 + random.Below(0x800));
+                break;
+            default:
+                units += static_cast<char16_t>(random.Below(0x80));
+                break;
+            }
+        }
+    }
+    constexpr std::u16string_view specials[]{u"\xd83d\xde00"sv, u"\xd83d"sv, u"\xde00"sv, u"\xde00\xd83d"sv,
+                                             u"\xe9"sv, u"\x6a21"sv, u"\xffff"sv};
+    for (std::size_t prefix = 0; prefix != 18; ++prefix)
+    {
+        for (auto special : specials)
+        {
+            for (std::size_t tail = 0; tail != 32; ++tail)
+            {
+                auto &units = inputs.emplace_back(prefix, u'a');
+                units += special;
+                units.append(tail, u'z');
+            }
+        }
+    }
+
+    for (auto &units : inputs)
+    {
+        std::string expected;
+        auto valid = AppendUtf8(units, expected, TranscodeScalar);
+        for (auto transcoder : transcoders)
+        {
+            std::string bytes = "prefix"s;
+            CHECK(AppendUtf8(units, bytes, transcoder) == valid);
+            CHECK(bytes.substr(6) == expected);
+        }
+    }
+
+    // the scalar transcoder itself against known bytes
+    std::string bytes;
+    CHECK(AppendUtf8(u"a\xe9\x6a21\xd83d\xde00"sv, bytes, TranscodeScalar));
+    CHECK(bytes == "a\xc3\xa9\xe6\xa8\xa1\xf0\x9f\x98\x80"sv);
+    bytes.clear();
+    CHECK(!AppendUtf8(u"\xde00\xd83d"sv, bytes, TranscodeScalar));
+    CHECK(bytes == "\xef\xbf\xbd\xef\xbf\xbd"sv);
+}
+
+// Each Data Name finds its field, and none of the names one edit away from it does: with a letter of the other
+// case, a character dropped, doubled or changed, or padded with a space. -fields and -groupby take comma-separated
+// labels only, a list with any other name in it parses to no fields.
+void TestFieldNames()
+{
+    for (std::size_t i = firstDataField; i != firstRelatedField; ++i)
+    {
+        std::wstring name(eventFields[i].name);
+        CHECK(FindDataField(name) == i);
+
+        std::vector<std::wstring> misses{L" "s + name, name + L" "s, name + L"s"s};
+        for (std::size_t at = 0; at != name.size(); ++at)
+        {
+            auto &flipped = misses.emplace_back(name);
+            flipped[at] ^= 0x20;
+            misses.push_back(name.substr(0, at) + name.substr(at + 1));
+            misses.push_back(name.substr(0, at + 1) + name.substr(at));
+            auto &changed = misses.emplace_back(name);
+            ++changed[at];
+        }
+        for (auto &miss : misses)
+        {
+            if (FindDataField(miss) != noDataField)
+            {
+                CHECK(FindDataField(miss) == noDataField);
+            }
+        }
+    }
+    CHECK(FindDataField(L""sv) == noDataField);
+    CHECK(FindDataField(L"SystemTime"sv) == noDataField);
+    CHECK(FindDataField(L"FaultingSymbol"sv) == noDataField);
+
+    CHECK(ParseFieldList(L"AppName"sv) == FieldBit(L"AppName"sv));
+    CHECK(ParseFieldList(L"ModuleName,AppName,ModuleName"sv) == (FieldBit(L"AppName"sv) | FieldBit(L"ModuleName"sv)));
+    CHECK(ParseFieldList(L"SystemTime,FaultingSymbol"sv) ==
+          (FieldBit(L"SystemTime"sv) | FieldBit(L"FaultingSymbol"sv)));
+    for (auto names : {L""sv, L","sv, L"AppName,"sv, L",AppName"sv, L"AppName,,ModuleName"sv, L"appname"sv,
+                       L"AppName ,ModuleName"sv, L"AppName,Bogus"sv, L"AppName;ModuleName"sv})
+    {
+        CHECK(ParseFieldList(names) == 0);
+    }
+
+    Options options;
+    ParseArguments(L"-fields=ExceptionCode,AppName"sv, options);
+    CHECK(options.fields == (FieldBit(L"AppName"sv) | FieldBit(L"ExceptionCode"sv)));
+}
+
+// Patterns of -include and -exclude one by one: exact ones are case-sensitive, the prefix, suffix and contains
+// shapes of a glob and any other glob ignore ASCII case, ? takes exactly one character and a run of * any number.
+// Rules on one field are alternatives, rules on different fields must all match and an exclude wins.
+void TestEventFilter()
+{
+    struct Case
+    {
+        std::wstring_view pattern;
+        std::wstring_view value;
+        bool match;
+    };
+    constexpr Case cases[]{
+        // exact
+        {L"explorer.exe"sv, L"explorer.exe"sv, true},
+        {L"explorer.exe"sv, L"Explorer.exe"sv, false},
+        {L"explorer.exe"sv, L"explorer.exe "sv, false},
+        {L"explorer.exe"sv, L""sv, false},
+        {L""sv, L""sv, true},
+        {L""sv, L"a"sv, false},
+        // prefix
+        {L"explorer*"sv, L"EXPLORER.EXE"sv, true},
+        {L"explorer*"sv, L"explorer"sv, true},
+        {L"explorer*"sv, L"explore"sv, false},
+        {L"explorer*"sv, L"my explorer.exe"sv, false},
+        // suffix
+        {L"*.EXE"sv, L"notepad.exe"sv, true},
+        {L"*.exe"sv, L".exe"sv, true},
+        {L"*.exe"sv, L"notepad.exe.bak"sv, false},
+        {L"*.exe"sv, L"exe"sv, false},
+        // contains
+        {L"*Client*"sv, L"caf\u00e9-client.exe"sv, true},
+        {L"*client*"sv, L"client"sv, true},
+        {L"*client*"sv, L"clien"sv, false},
+        {L"*\u00e9*"sv, L"CAF\u00c9"sv, false},
+        // glob
+        {L"notepad++*.exe"sv, L"Notepad++ 8.exe"sv, true},
+        {L"notepad++*.exe"sv, L"notepad++.ex"sv, false},
+        {L"a*b*c"sv, L"aXbYc"sv, true},
+        {L"a*b*c"sv, L"abc"sv, true},
+        {L"a*b*c"sv, L"acb"sv, false},
+        {L"a*b*c"sv, L"abcbcx"sv, false},
+        {L"a*b*c"sv, L"ab-ab-c"sv, true},
+        {L"*a*a*a*"sv, L"banana"sv, true},
+        {L"*a*a*a*"sv, L"banan"sv, false},
+        // ?
+        {L"a?c"sv, L"abc"sv, true},
+        {L"a?c"sv, L"ABC"sv, true},
+        {L"a?c"sv, L"ac"sv, false},
+        {L"a?c"sv, L"abbc"sv, false},
+        {L"?"sv, L""sv, false},
+        {L"?"sv, L"\u6a21"sv, true},
+        {L"??*"sv, L"a"sv, false},
+        {L"??*"sv, L"ab"sv, true},
+        {L"*?"sv, L""sv, false},
+        {L"*?"sv, L"x"sv, true},
+        // *, ** and runs of *
+        {L"*"sv, L""sv, true},
+        {L"*"sv, L"anything"sv, true},
+        {L"**"sv, L""sv, true},
+        {L"**"sv, L"anything"sv, true},
+        {L"a**b"sv, L"ab"sv, true},
+        {L"a**b"sv, L"a-x-b"sv, true},
+        {L"a**b"sv, L"a-x-c"sv, false},
+        {L"***x"sv, L"yyx"sv, true},
+    };
+    for (auto &test : cases)
+    {
+        FilterRule rules[]{{false, L"AppName"s, std::wstring(test.pattern)}};
+        EventFilter filter(rules);
+        EventLog eventLog;
+        eventLog.appName = test.value;
+        if (filter.Admit(eventLog) != test.match)
+        {
+            std::fprintf(stderr, "pattern %ls on %ls\n", std::wstring(test.pattern).c_str(),
+                         std::wstring(test.value).c_str());
+            CHECK(filter.Admit(eventLog) == test.match);
+        }
+
+        rules[0].exclude = true;
+        EventFilter exclude(rules);
+        CHECK(exclude.Admit(eventLog) != test.match);
+    }
+
+    std::vector<FilterRule> rules{{false, L"AppName"s, L"a.exe"s},
+                                  {false, L"AppName"s, L"b*"s},
+                                  {false, L"ModuleName"s, L"*.dll"s},
+                                  {true, L"ModuleName"s, L"ntdll.dll"s},
+                                  {false, L"Bogus"s, L"x"s}};
+    EventFilter filter(rules);
+    CHECK(filter.Fields() == (FieldBit(L"AppName"sv) | FieldBit(L"ModuleName"sv)));
+    auto admit = [&filter](std::wstring_view appName, std::wstring_view moduleName) {
+        EventLog eventLog;
+        eventLog.appName = appName;
+        eventLog.moduleName = moduleName;
+        return filter.Admit(eventLog);
+    };
+    CHECK(admit(L"a.exe"sv, L"x.dll"sv));
+    CHECK(admit(L"B.exe"sv, L"X.DLL"sv));
+    CHECK(!admit(L"c.exe"sv, L"x.dll"sv));
+    CHECK(!admit(L"a.exe"sv, L"x.exe"sv));
+    CHECK(!admit(L"a.exe"sv, L"ntdll.dll"sv));
+    CHECK(EventFilter({}).Empty());
+    CHECK(EventFilter({}).Admit(EventLog{}));
+}
+
+// A replayed burst is parsed and formatted in reused arenas without any heap allocation once the buffers have
+// grown to fit the largest event.
+void TestArenaAllocations()
+{
+    auto corpus = GenerateCorpus(2'000);
+    EventArena arena;
+    EventOutput output(arena);
+    auto method = PrintMethod::console;
+    method |= PrintMethod::messagebox;
+    method |= PrintMethod::notification;
+    auto replay = [&] {
+        for (auto &xml : corpus)
+        {
+            arena.Reset();
+            arena.content.assign(xml);
+            ParseEventLog(arena.content, arena.eventLog);
+            for (auto style : {PrintStyle::text, PrintStyle::jsonl, PrintStyle::binary})
+            {
+                arena.text.clear();
+                arena.minimalText.clear();
+                output.Reset(&arena.eventLog, style);
+                output.Prepare(method);
+            }
+        }
+    };
+
+    replay();
+    auto before = allocations;
+    replay();
+    CHECK(allocations == before);
+}
+
+// Counts what the pipeline delivers to it, in place of a sink that needs a desktop.
+class CountingSink final : public Sink
+{
+  public:
+    explicit CountingSink(std::atomic<std::size_t> &delivered) noexcept : delivered_(delivered)
+    {
+    }
+
+    void Deliver(EventOutput &) override
+    {
+        delivered_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<std::size_t> &delivered_;
+};
+
+// A storm through a pipeline with a tiny pool and sink queue: every event is parsed, and each one is either
+// delivered by the sink or counted as dropped for it, so no slot is lost on the way.
+void TestPipelineStress()
+{
+    constexpr std::size_t events = 20'000;
+    Options options;
+    options.batchSize = 8;
+    options.queueSize = 16;
+    options.sinkQueueSize = 2;
+    options.method = PrintMethod::console;
+
+    Metrics metrics;
+    std::atomic<std::size_t> delivered = 0;
+    Pipeline pipeline(options, [&](std::size_t, std::atomic<std::uint64_t> &) -> std::unique_ptr<Sink> {
+        return std::make_unique<CountingSink>(delivered);
+    }, &metrics);
+    ReplaySource source(GenerateCorpus(events));
+    // NB: a few batches at a time, like a subscription signaled again and again
+    while (!pipeline.Collect(source, 3))
+    {
+    }
+    pipeline.Stop();
+
+    constexpr std::size_t index = std::ranges::find(sinkMethods, PrintMethod::console) - sinkMethods;
+    auto &sink = metrics.sinks[index];
+    CHECK(metrics.collector.received.Value() == events);
+    CHECK(metrics.parser.parsed.Value() == events);
+    CHECK(sink.dispatched.Value() + pipeline.Dropped(index) == events);
+    CHECK(sink.completed.Value() == sink.dispatched.Value());
+    CHECK(delivered == sink.completed.Value());
+}
+
+// Records the ProcessId of each event the pipeline delivers to it.
+class RecordingSink final : public Sink
+{
+  public:
+    explicit RecordingSink(std::vector<std::wstring> &processIds) noexcept : processIds_(processIds)
+    {
+    }
+
+    void Deliver(EventOutput &output) override
+    {
+        processIds_.emplace_back(output.Event()->processId);
+    }
+
+  private:
+    std::vector<std::wstring> &processIds_;
+};
+
+// More events than fit a batch come out of a source once each and in order, whether drained in batches of any
+// size or collected by the pipeline a few -batch batches at a time.
+void TestEventBatches()
+{
+    constexpr std::size_t events = 1'000;
+    std::vector<std::wstring> corpus;
+    std::vector<std::wstring> processIds;
+    for (std::size_t i = 0; i != events; ++i)
+    {
+        processIds.push_back(std::to_wstring(i));
+        corpus.push_back(L"<Event><EventData><Data Name='ProcessId'>"s + processIds.back() +
+                         L"</Data></EventData></Event>"s);
+    }
+
+    for (std::size_t batchSize : {std::size_t{1}, std::size_t{7}, std::size_t{64}, events, events + 1})
+    {
+        ReplaySource source(corpus);
+        CHECK(Drain(source, batchSize) == corpus);
+        EventArena arena;
+        EventArena *batch[]{&arena};
+        CHECK(source.Next(batch) == 0);
+    }
+
+    Options options;
+    options.batchSize = 8;
+    options.queueSize = 32;
+    options.sinkQueueSize = 4;
+    // NB: the console sink waits for room in its queue instead of dropping
+    options.method = PrintMethod::console;
+    std::vector<std::wstring> delivered;
+    {
+        Pipeline pipeline(options, [&](std::size_t, std::atomic<std::uint64_t> &) -> std::unique_ptr<Sink> {
+            return std::make_unique<RecordingSink>(delivered);
+        });
+        ReplaySource source(corpus);
+        while (!pipeline.Collect(source, 2))
+        {
+        }
+        pipeline.Stop();
+    }
+    CHECK(delivered == processIds);
+}
+
+// The records NextEventRecord finds in each NextChunk of text, as -jobs cuts an export.
+template <typename Char>
+std::vector<std::basic_string<Char>> SplitRecords(std::basic_string_view<Char> text, std::size_t chunkSize)
+{
+    std::vector<std::basic_string<Char>> records;
+    for (std::size_t pos = 0; pos != text.size();)
+    {
+        auto chunk = NextChunk(text, pos, chunkSize);
+        std::size_t at = 0;
+        for (auto record = NextEventRecord(chunk, at); !record.empty(); record = NextEventRecord(chunk, at))
+        {
+            records.emplace_back(record);
+        }
+    }
+    return records;
+}
+
+// Records come out of an export whole and in order, narrow or wide, wrapped in <Events> or not, and however the
+// text is cut into chunks. <EventData> starts no record and a record cut short at the end is dropped. Read from
+// files through ArchiveSource they decode to the same wide text.
+void TestEventRecords()
+{
+    constexpr std::string_view records[]{
+        "<Event xmlns='http://schemas.microsoft.com/win/2004/08/events/event'><System><EventID>1000</EventID>"
+        "</System><EventData><Data Name='AppName'>a.exe</Data></EventData></Event>"sv,
+        "<Event>\r\n<EventData><Data Name='AppName'>caf\xc3\xa9 \xf0\x9f\x98\x80.exe</Data></EventData>\r\n</Event>"sv,
+        "<Event\t><EventData><Data Name='AppName'>&lt;Event&gt;&lt;/Event&gt;.exe</Data></EventData></Event>"sv,
+    };
+    constexpr std::size_t count = 30;
+    std::string narrow = "\xEF\xBB\xBF<?xml version='1.0' encoding='utf-8'?>\r\n<Events>"s;
+    std::vector<std::string> expected;
+    std::vector<std::wstring> decoded;
+    for (std::size_t i = 0; i != count; ++i)
+    {
+        expected.emplace_back(records[i % std::size(records)]);
+        narrow += expected.back();
+        narrow += "\r\n"sv;
+        decoded.emplace_back();
+        AppendWide(expected.back(), decoded.back());
+    }
+    narrow += "<Event><EventData>cut short</Events>"sv;
+
+    std::wstring wideText;
+    AppendWide(std::string_view(narrow).substr(3), wideText);
+    std::u16string units;
+    auto wide = AsUtf16(wideText, units);
+    std::vector<std::u16string> expectedWide;
+    for (auto &record : decoded)
+    {
+        std::u16string recordUnits;
+        expectedWide.emplace_back(AsUtf16(record, recordUnits));
+    }
+
+    for (std::size_t chunkSize : {std::size_t{1}, std::size_t{7}, std::size_t{100}, std::size_t{1} << 20})
+    {
+        CHECK(SplitRecords(std::string_view(narrow), chunkSize) == expected);
+        CHECK(SplitRecords(wide, chunkSize) == expectedWide);
+    }
+
+    // NB: the wide export is UTF-16LE behind its byte order mark
+    auto directory = std::filesystem::temp_directory_path();
+    std::wstring files[]{(directory / L"apperrnotitool-test-utf8.xml").wstring(),
+                         (directory / L"apperrnotitool-test-utf16.xml").wstring()};
+    std::ofstream(std::filesystem::path(files[0]), std::ios::binary) << narrow;
+    {
+        std::ofstream file(std::filesystem::path(files[1]), std::ios::binary);
+        file << "\xFF\xFE"sv;
+        for (auto unit : wide)
+        {
+            file.put(static_cast<char>(unit & 0xff));
+            file.put(static_cast<char>(unit >> 8));
+        }
+    }
+    for (auto &file : files)
+    {
+        ArchiveSource source(std::span(&file, 1));
+        CHECK(Drain(source, 4) == decoded);
+        std::filesystem::remove(file);
+    }
+}
+
+// What ParallelIngest writes, in place of the console.
+std::wstring ingested;
+
+void Ingested(std::wstring_view output, bool)
+{
+    ingested += output;
+}
+
+// An export of several rounds of chunks comes out of -jobs the same as formatting its events one by one, for any
+// number of threads, the last round being partly filled.
+void TestParallelIngest()
+{
+    constexpr std::size_t events = 20'000;
+    auto corpus = GenerateCorpus(events);
+    std::string archive;
+    std::wstring expected;
+    EventArena arena;
+    for (auto &xml : corpus)
+    {
+        AppendUtf8(xml, archive);
+        archive += "\r\n"sv;
+        arena.Reset();
+        arena.content.assign(xml);
+        ParseEventLog(arena.content, arena.eventLog);
+        FormatEvent(PrintStyle::text, arena.eventLog, allFields, expected);
+    }
+
+    for (std::size_t threads : {1, 2, 3})
+    {
+        ingested.clear();
+        ParallelIngest ingest(PrintStyle::text, allFields, {}, threads, Ingested);
+        ingest.Run({archive, {}});
+        CHECK(ingest.Events() == events);
+        CHECK(ingested == expected);
+    }
+}
+
+// A subscription that always has events left gets one turn per round, and every quiet subscription signaled
+// before or during its turn gets one in the same round, in the order they were signaled.
+void TestReadyQueue()
+{
+    constexpr std::size_t quiet = 6;
+    constexpr std::size_t noisy = 0;
+    ReadyQueue ready(quiet + 1);
+    CHECK(ready.Signal(noisy));
+    CHECK(!ready.Signal(noisy));
+
+    for (std::size_t round = 0; round != 5; ++round)
+    {
+        std::vector<std::size_t> turns;
+        auto requeued = ready.Run([&](std::size_t index) {
+            turns.push_back(index);
+            if (index == noisy)
+            {
+                // NB: the quiet ones are signaled while the noisy one collects, the last one twice
+                for (std::size_t i = 1; i <= quiet; ++i)
+                {
+                    CHECK(ready.Signal(i));
+                }
+                CHECK(!ready.Signal(quiet));
+            }
+            return index == noisy;
+        });
+        CHECK(requeued);
+        std::vector<std::size_t> expected{noisy};
+        for (std::size_t i = 1; i <= quiet; ++i)
+        {
+            expected.push_back(i);
+        }
+        CHECK(turns == expected);
+    }
+
+    // a signal during a subscription's own turn queues it again
+    std::vector<std::size_t> turns;
+    CHECK(!ready.Run([&](std::size_t index) {
+        turns.push_back(index);
+        return false;
+    }));
+    CHECK(turns == std::vector<std::size_t>{noisy});
+    CHECK(ready.Signal(3));
+    CHECK(!ready.Run([&](std::size_t index) {
+        turns.push_back(index);
+        if (turns.size() == 2)
+        {
+            CHECK(ready.Signal(index));
+        }
+        return false;
+    }));
+    CHECK(turns == (std::vector<std::size_t>{noisy, 3, 3}));
+    CHECK(!ready.Run([&](std::size_t) {
+        CHECK(false);
+        return false;
+    }));
+}
+
+// The -channels file: a BOM, CRLF, blank lines, # comments and padding are skipped, a line is a channel with an
+// optional query after the first colon, and a channel may be listed twice.
+void TestReadChannels()
+{
+    auto file = std::filesystem::temp_directory_path() / L"apperrnotitool-test.channels";
+    std::ofstream(file, std::ios::binary) << "\xEF\xBB\xBF# channels watched\r\n"
+                                             "Application\r\n"
+                                             "\r\n"
+                                             "   \t\r\n"
+                                             "  System : *[System[Level=1]]  \r\n"
+                                             "  # Security: not this one\n"
+                                             "Security:*[EventData[Data[@Name='Path']='C:\\x']]\n"
+                                             "Microsoft-Windows-Sysmon/Operational\n"
+                                             "Application: *[System[(EventID=1001)]]\n"
+                                             "Caf\xc3\xa9/Op\xc3\xa9rationnel:"sv;
+    auto channels = ReadChannels(file);
+    std::filesystem::remove(file);
+
+    std::pair<std::wstring_view, std::wstring_view> expected[]{
+        {L"Application"sv, L""sv},
+        {L"System"sv, L"*[System[Level=1]]"sv},
+        {L"Security"sv, L"*[EventData[Data[@Name='Path']='C:\\x']]"sv},
+        {L"Microsoft-Windows-Sysmon/Operational"sv, L""sv},
+        {L"Application"sv, L"*[System[(EventID=1001)]]"sv},
+        {L"Caf\u00e9/Op\u00e9rationnel"sv, L""sv},
+    };
+    CHECK(channels.size() == std::size(expected));
+    for (std::size_t i = 0; i != std::min(channels.size(), std::size(expected)); ++i)
+    {
+        CHECK(channels[i].channel == expected[i].first);
+        CHECK(channels[i].query == expected[i].second);
+    }
+}
+
+// Field i of history event n. AppName has more values than a byte code holds, ModuleName a few, ExceptionCode
+// and UserID one each, ProcessId one per event; SystemTime is not stored and reads back empty.
+std::wstring HistoryValue(std::size_t n, std::size_t field)
+{
+    auto name = eventFields[field].name;
+    if (name == L"UserID"sv)
+    {
+        return {};
+    }
+    if (name == L"AppName"sv)
+    {
+        return L"app"s + std::to_wstring(n * 7 % 300) + L".exe"s;
+    }
+    if (name == L"ModuleName"sv)
+    {
+        return L"module"s + std::to_wstring(n % 3);
+    }
+    if (name == L"ExceptionCode"sv)
+    {
+        return L"c0000005"s;
+    }
+    if (name == L"ProcessId"sv)
+    {
+        return std::to_wstring(n);
+    }
+    return field % 4 == 0 ? std::wstring() : std::wstring(name) + std::to_wstring(n % (field + 1));
+}
+
+// FILETIME ticks of history event n, every 97th is unknown.
+std::uint64_t HistoryTime(std::size_t n)
+{
+    return n % 97 == 0 ? 0 : 1000 + n * 10;
+}
+
+void AppendHistory(HistoryWriter &writer, std::size_t begin, std::size_t end)
+{
+    std::vector<std::wstring> values(std::size(eventFields));
+    for (auto n = begin; n != end; ++n)
+    {
+        EventLog eventLog{};
+        for (std::size_t i = 0; i != std::size(eventFields); ++i)
+        {
+            values[i] = HistoryValue(n, i);
+            eventLog.*eventFields[i].member = values[i];
+        }
+        writer.Append(eventLog, HistoryTime(n));
+    }
+}
+
+// The rows of a history, each with its time followed by its fields, and the rows of each block.
+struct HistoryRows
+{
+    std::vector<std::vector<std::wstring>> rows;
+    std::vector<std::uint64_t> times;
+    std::vector<std::uint32_t> blocks;
+};
+
+HistoryRows ReadHistory(const std::filesystem::path &file)
+{
+    HistoryRows history;
+    HistoryReader reader(file);
+    HistoryBlock block;
+    std::vector<std::uint64_t> codes;
+    for (std::size_t offset = 0; reader.Next(offset, block);)
+    {
+        history.blocks.push_back(block.rows);
+        auto first = history.rows.size();
+        history.rows.resize(first + block.rows, std::vector<std::wstring>(std::size(eventFields)));
+        history.times.insert(history.times.end(), block.times, block.times + block.rows);
+        for (std::size_t i = 0; i != std::size(eventFields); ++i)
+        {
+            codes.assign(block.rows, 0);
+            block.columns[i].AddCodes(1, codes);
+            for (std::size_t row = 0; row != block.rows; ++row)
+            {
+                history.rows[first + row][i] = block.columns[i].Value(static_cast<std::uint32_t>(codes[row]));
+            }
+        }
+    }
+    return history;
+}
+
+// Rows [first, first + end - begin) of the history are events [begin, end) with the fields stored.
+void CheckHistory(const HistoryRows &history, std::size_t first, std::size_t begin, std::size_t end, FieldMask fields)
+{
+    CHECK(history.rows.size() >= first + end - begin);
+    for (auto n = begin; n != end && first + n - begin < history.rows.size(); ++n)
+    {
+        auto row = first + n - begin;
+        CHECK(history.times[row] == HistoryTime(n));
+        bool same = true;
+        for (std::size_t i = 0; i != std::size(eventFields); ++i)
+        {
+            auto stored = (fields >> i & 1) != 0 && eventFields[i].name != L"SystemTime"sv;
+            same = same && history.rows[row][i] == (stored ? HistoryValue(n, i) : std::wstring());
+        }
+        CHECK(same);
+    }
+}
+
+// Events of a history written in two sessions read back in order, whole blocks of historyBlockRows rows first,
+// and AggregateHistory counts them as a map of the values of each event does, for groups of one to four fields
+// that are counted in an array or in a hash, with and without since. A file cut short anywhere in its last block
+// reads as the blocks before it, and is appended to once the writer dropped the rest of the block.
+void TestHistory()
+{
+    constexpr std::size_t count = historyBlockRows * 2 + 1234;
+    auto file = std::filesystem::temp_directory_path() / L"apperrnotitool-test.history";
+    std::filesystem::remove(file);
+    {
+        HistoryWriter writer(file, allFields);
+        AppendHistory(writer, 0, historyBlockRows + 100);
+    }
+    {
+        HistoryWriter writer(file, allFields);
+        AppendHistory(writer, historyBlockRows + 100, count);
+    }
+    auto history = ReadHistory(file);
+    CHECK(history.rows.size() == count);
+    CheckHistory(history, 0, 0, count, allFields);
+    CHECK(history.blocks == (std::vector<std::uint32_t>{historyBlockRows, 100, historyBlockRows, 1134}));
+
+    auto aggregate = [&](FieldMask fields, std::uint64_t since) {
+        HistoryGroups groups;
+        {
+            HistoryReader reader(file);
+            AggregateHistory(reader, fields, since, groups);
+        }
+        std::unordered_map<std::wstring, std::uint64_t> expected;
+        std::uint64_t matched = 0;
+        for (std::size_t n = 0; n != count; ++n)
+        {
+            if (HistoryTime(n) < since)
+            {
+                continue;
+            }
+            std::wstring key;
+            for (std::size_t i = 0, j = 0; i != std::size(eventFields); ++i)
+            {
+                if ((fields >> i & 1) != 0)
+                {
+                    key += j++ == 0 ? L""s : L"\0"s;
+                    key += HistoryValue(n, i);
+                }
+            }
+            ++expected[key];
+            ++matched;
+        }
+        CHECK(groups.events == count);
+        CHECK(groups.matched == matched);
+        CHECK(groups.counts == expected);
+    };
+    FieldMask groupBys[]{
+        FieldBit(L"AppName"sv),
+        FieldBit(L"AppName"sv) | FieldBit(L"ModuleName"sv),
+        FieldBit(L"AppName"sv) | FieldBit(L"ProcessId"sv),
+        FieldBit(L"UserID"sv) | FieldBit(L"ModuleName"sv) | FieldBit(L"ExceptionCode"sv) | FieldBit(L"AppPath"sv),
+    };
+    for (auto groupBy : groupBys)
+    {
+        for (auto since : {std::uint64_t{0}, HistoryTime(count / 3), HistoryTime(count - 1) + 1})
+        {
+            aggregate(groupBy, since);
+        }
+    }
+
+    // NB: the reader is closed before the file is resized, Windows does not resize a mapped file
+    std::vector<std::size_t> offsets;
+    {
+        HistoryReader reader(file);
+        HistoryBlock block;
+        for (std::size_t offset = 0; offsets.push_back(offset), reader.Next(offset, block, 0);)
+        {
+        }
+    }
+    CHECK(offsets.size() == 5 && offsets.back() == std::filesystem::file_size(file));
+    auto last = offsets[3];
+    for (auto size : {offsets[4] - 8, last + (offsets[4] - last) / 2, last + HistoryReader::headerSize, last + 4})
+    {
+        std::filesystem::resize_file(file, size);
+        history = ReadHistory(file);
+        CHECK(history.rows.size() == count - 1134);
+        CheckHistory(history, 0, 0, count - 1134, allFields);
+    }
+    {
+        HistoryWriter writer(file, FieldBit(L"AppName"sv) | FieldBit(L"ProcessId"sv));
+        CHECK(std::filesystem::file_size(file) == last);
+        AppendHistory(writer, count - 1134, count);
+    }
+    history = ReadHistory(file);
+    CHECK(history.rows.size() == count);
+    CheckHistory(history, 0, 0, count - 1134, allFields);
+    CheckHistory(history, count - 1134, count - 1134, count, FieldBit(L"AppName"sv) | FieldBit(L"ProcessId"sv));
+    std::filesystem::remove(file);
+
+    // a block is written early once its dictionaries hold historyBlockBytes, here every eighth event
+    constexpr std::size_t length = historyBlockBytes / sizeof(wchar_t) / 8;
+    {
+        HistoryWriter writer(file, FieldBit(L"AppPath"sv));
+        for (std::size_t n = 0; n != 20; ++n)
+        {
+            std::wstring path(length, static_cast<wchar_t>(L'a' + n));
+            EventLog eventLog{};
+            eventLog.appPath = path;
+            writer.Append(eventLog, n);
+        }
+    }
+    history = ReadHistory(file);
+    CHECK(history.blocks == (std::vector<std::uint32_t>{8, 8, 4}));
+    for (std::size_t n = 0; n != std::min<std::size_t>(history.rows.size(), 20); ++n)
+    {
+        auto &path = history.rows[n][std::countr_zero(FieldBit(L"AppPath"sv))];
+        CHECK(path.size() == length && path.find_first_not_of(static_cast<wchar_t>(L'a' + n)) == path.npos);
+    }
+    std::filesystem::remove(file);
+}
+
+// Repeats of a signature are folded into one summary per window, which lists up to eight PIDs and marks the
+// rest with " ...". Idle signatures are forgotten at the end of their window and their entries reused.
+void TestFaultCoalescer()
+{
+    using namespace std::chrono_literals;
+    FaultCoalescer coalescer(2, 10s);
+    std::vector<std::wstring> summaries;
+    auto emit = [&](std::wstring_view summary) {
+        summaries.emplace_back(summary);
+        return true;
+    };
+    auto fault = [](std::wstring_view appName, std::wstring_view processId) {
+        EventLog eventLog;
+        eventLog.appName = appName;
+        eventLog.exceptionCode = L"c0000005"sv;
+        eventLog.processId = processId;
+        return eventLog;
+    };
+    Clock::time_point start{};
+
+    CHECK(coalescer.Admit(fault(L"a.exe"sv, L"0x1"sv), start, emit));
+    CHECK(!coalescer.Admit(fault(L"a.exe"sv, L"0x1"sv), start + 1s, emit));
+    CHECK(!coalescer.Admit(fault(L"a.exe"sv, L"0x2"sv), start + 2s, emit));
+    CHECK(coalescer.Admit(fault(L"b.exe"sv, L"0x3"sv), start + 3s, emit));
+    coalescer.Flush(start + 9s, emit);
+    CHECK(summaries.empty());
+    coalescer.Flush(start + 10s, emit);
+    CHECK(summaries.size() == 1);
+    CHECK(summaries.back() == L"AppName: a.exe\nExceptionCode: c0000005\n2 more in last 10 seconds, PIDs 0x1, 0x2\n"sv);
+
+    // b.exe stays idle and leaves the table, so two new signatures fit without evicting a.exe
+    coalescer.Flush(start + 13s, emit);
+    CHECK(coalescer.Admit(fault(L"c.exe"sv, L"0x4"sv), start + 14s, emit));
+    std::wstring pids[10];
+    for (int i = 0; i != 10; ++i)
+    {
+        pids[i] = L"0x"s + std::to_wstring(10 + i);
+        CHECK(!coalescer.Admit(fault(L"a.exe"sv, pids[i]), start + 15s, emit));
+    }
+    CHECK(summaries.size() == 1);
+    coalescer.Flush(start + 20s, emit);
+    CHECK(summaries.size() == 2);
+    CHECK(summaries.back().ends_with(L"PIDs 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17 ...\n"sv));
+
+    // once its window is over a signature faults again as a first occurrence
+    CHECK(coalescer.Admit(fault(L"b.exe"sv, L"0x3"sv), start + 30s, emit));
+    CHECK(coalescer.Lost() == 0);
+}
+
+// The bucket refills evenly over its period and never holds more than its capacity, whatever the gap between
+// calls.
+void TestTokenBucket()
+{
+    using namespace std::chrono_literals;
+    Clock::time_point start{};
+    TokenBucket bucket(4, 2s, start);
+    for (int i = 0; i != 4; ++i)
+    {
+        CHECK(bucket.TryTake(start));
+    }
+    CHECK(!bucket.TryTake(start));
+    CHECK(!bucket.TryTake(start + 400ms));
+    CHECK(bucket.TryTake(start + 500ms));
+    CHECK(!bucket.Available(start + 500ms));
+    CHECK(bucket.TryTake(start + 1s));
+
+    // an hour of silence still only brings capacity tokens
+    auto later = start + 1h;
+    for (int i = 0; i != 4; ++i)
+    {
+        CHECK(bucket.TryTake(later));
+    }
+    CHECK(!bucket.TryTake(later));
+}
+
+// Over budget a sink gets one digest of the held back events once a token is free, events arriving meanwhile
+// join the digest, and those that do not fit into it are only counted.
+void TestSinkLimiter()
+{
+    using namespace std::chrono_literals;
+    EventArena arena;
+    arena.content.assign(GenerateCorpus(1).front());
+    ParseEventLog(arena.content, arena.eventLog);
+    EventOutput output(arena);
+    output.Reset(&arena.eventLog);
+    auto minimalText = std::wstring(output.MinimalText());
+
+    Clock::time_point start{};
+    SinkLimiter limiter({2, 10}, start);
+    CHECK(limiter.Admit(output, start));
+    CHECK(limiter.Admit(output, start));
+    CHECK(!limiter.Admit(output, start));
+    CHECK(!limiter.DigestReady(start + 4s));
+    // NB: a token is free again, but the digest goes first so that the order is kept
+    CHECK(!limiter.Admit(output, start + 5s));
+    CHECK(limiter.DigestReady(start + 5s));
+
+    std::wstring digest;
+    limiter.TakeDigest(digest, start + 5s);
+    CHECK(digest == L"2 application errors were held back by the output limit:\n\n"s + minimalText + L'\n' +
+                        minimalText + L'\n');
+    CHECK(!limiter.DigestReady(start + 5s));
+    CHECK(limiter.Admit(output, start + 10s));
+
+    // a burst far beyond the digest size is counted, not collected
+    constexpr std::uint64_t burst = 10'000;
+    for (std::uint64_t i = 0; i != burst; ++i)
+    {
+        limiter.Admit(output, start + 10s);
+    }
+    CHECK(limiter.DigestReady(start + 20s));
+    digest.clear();
+    limiter.TakeDigest(digest, start + 20s);
+    CHECK(digest.size() < 4096 + 128);
+    CHECK(digest.ends_with(L" more not shown.\n"sv));
+    CHECK(limiter.Deferred() == burst + 2);
+    CHECK(limiter.Omitted() != 0 && limiter.Omitted() < burst);
+}
+
+#ifdef _WIN32
+// Slices read concurrently through small queues still come out in the order of the slices, and a backfill
+// abandoned midway stops readers that block on a full queue or would never end.
+void TestBackfillSource()
+{
+    constexpr std::size_t slices = 4;
+    constexpr std::size_t perSlice = 500;
+    BackfillSource source(slices, 8, [](std::size_t slice, std::stop_token token, BoundedQueue<BackfillEvent> &queue) {
+        for (std::size_t i = 0; i != perSlice && !token.stop_requested(); ++i)
+        {
+            queue.Push(BackfillEvent{nullptr, std::to_wstring(slice * perSlice + i)});
+        }
+    });
+    auto contents = Drain(source, 7);
+    CHECK(contents.size() == slices * perSlice);
+    for (std::size_t i = 0; i != contents.size(); ++i)
+    {
+        if (contents[i] != std::to_wstring(i))
+        {
+            CHECK(contents[i] == std::to_wstring(i));
+            break;
+        }
+    }
+
+    std::atomic<std::size_t> stopped{};
+    {
+        BackfillSource endless(slices, 2, [&](std::size_t, std::stop_token token, BoundedQueue<BackfillEvent> &queue) {
+            while (!token.stop_requested())
+            {
+                queue.Push(BackfillEvent{nullptr, L"event"s});
+            }
+            ++stopped;
+        });
+        std::vector<EventArena> arenas(3);
+        EventArena *batch[]{&arenas[0], &arenas[1], &arenas[2]};
+        CHECK(endless.Next(batch) == std::size(batch));
+    }
+    CHECK(stopped == slices);
+}
+#endif
+
+// Reads a whole file as bytes.
+std::string ReadFile(const std::filesystem::path &file)
+{
+    std::ifstream stream(file, std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+}
+
+// Segments rotate once they would exceed their size, each starts with a BOM and its own line numbers, Sync makes
+// an event readable before the group commit would write it, and only the newest segments are kept.
+void TestRollingLog()
+{
+    auto directory = std::filesystem::temp_directory_path() / L"apperrnotitool_test_log";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    {
+        constexpr std::size_t events = 40;
+        RollingLog log(directory / L"events.log", 100, std::numeric_limits<std::uint64_t>::max(), false);
+        std::vector<std::wstring> segments(events);
+        std::vector<RollingLog::Entry> entries;
+        std::string expected;
+        for (std::size_t i = 0; i != events; ++i)
+        {
+            auto text = L"event "s + std::to_wstring(100 + i) + L'\n';
+            entries.push_back(log.Append(text, segments[i]));
+            AppendUtf8(text, expected);
+        }
+
+        // NB: 10 bytes an event, so a segment of at most 100 holds 10 of them
+        for (std::size_t i = 0; i != events; ++i)
+        {
+            CHECK(segments[i] == segments[i / 10 * 10]);
+            CHECK(i % 10 != 0 || i == 0 || segments[i] != segments[i - 1]);
+            CHECK(entries[i].firstLine == i % 10);
+            CHECK(entries[i].lines == 1);
+            CHECK(entries[i].end == (i + 1) * 10);
+        }
+
+        log.Sync(entries.back().end);
+        std::string written;
+        for (std::size_t i = 0; i != events; i += 10)
+        {
+            auto bytes = ReadFile(segments[i]);
+            CHECK(bytes.starts_with("\xef\xbb\xbf"sv));
+            CHECK(bytes.size() == 3 + 100);
+            written += bytes.substr(3);
+        }
+        CHECK(written == expected);
+    }
+    {
+        RollingLog log(directory / L"many.log", 10, std::numeric_limits<std::uint64_t>::max(), true);
+        std::wstring segment;
+        RollingLog::Entry entry;
+        for (std::size_t i = 0; i != 3 * logSegmentsKept; ++i)
+        {
+            entry = log.Append(L"event"sv, segment);
+        }
+        log.Sync(entry.end);
+        CHECK(ReadFile(segment) == std::string_view(reinterpret_cast<const char *>(L"event"), 5 * sizeof(wchar_t)));
+    }
+    std::size_t kept{};
+    for (auto &file : std::filesystem::directory_iterator(directory))
+    {
+        kept += file.path().filename().wstring().starts_with(L"many."sv);
+    }
+    CHECK(kept == logSegmentsKept);
+    std::filesystem::remove_all(directory);
+}
+
+// What an incident carries, copied out of the arena it was filled into.
+struct Incident
+{
+    std::wstring appName;
+    std::wstring processId;
+    std::wstring eventName;
+    std::wstring bucket;
+    std::wstring exception;
+};
+
+// Replays the events of crashes into a correlator: faults as rendered XML, runtime events and reports as their
+// header and Data values.
+class CrashReplay
+{
+  public:
+    explicit CrashReplay(std::size_t capacity) : correlator(capacity, std::chrono::seconds(10))
+    {
+    }
+
+    void Fault(std::wstring_view appName, std::uint32_t processId, std::wstring_view reportId = {})
+    {
+        arena_.Reset();
+        arena_.content = L"<Event><System><Provider Name='Application Error'/><EventID>1000</EventID>"
+                         L"<TimeCreated SystemTime='2025-01-02T03:04:05.0000000Z'/></System><EventData>"
+                         L"<Data Name='AppName'>"s;
+        arena_.content += appName;
+        arena_.content += L"</Data><Data Name='ProcessId'>0x"sv;
+        AppendNumber(processId, arena_.content, 16);
+        arena_.content += L"</Data><Data Name='IntegratorReportId'>"sv;
+        arena_.content += reportId;
+        arena_.content += L"</Data></EventData></Event>"sv;
+        ParseEventLog(arena_.content, arena_.eventLog);
+        correlator.AddFault(arena_, now, emit_);
+    }
+
+    void Runtime(std::wstring_view appName, std::uint32_t processId, std::wstring_view exception)
+    {
+        auto text = L"Application: "s + std::wstring(appName) + L"\r\nException Info: "s + std::wstring(exception);
+        correlator.AddRuntime({L".NET Runtime"sv, 1026, processId, L"2025-01-02T03:04:04.0000000Z"sv}, text, now,
+                              emit_);
+    }
+
+    bool Report(std::wstring_view appName, std::wstring_view reportId, std::wstring_view bucket)
+    {
+        std::wstring_view data[20];
+        data[0] = bucket;
+        data[2] = L"APPCRASH"sv;
+        data[5] = appName;
+        data[19] = reportId;
+        return correlator.AddReport(data, emit_);
+    }
+
+    void Flush()
+    {
+        correlator.Flush(now, emit_);
+    }
+
+    IncidentCorrelator correlator;
+    Clock::time_point now{};
+    std::vector<Incident> incidents;
+
+  private:
+    EventArena arena_;
+    std::function<bool(const std::function<void(EventArena &)> &)> emit_ = [this](auto &fill) {
+        EventArena arena;
+        fill(arena);
+        auto &eventLog = arena.eventLog;
+        incidents.push_back({std::wstring(eventLog.appName), std::wstring(eventLog.processId),
+                             std::wstring(eventLog.werEventName), std::wstring(eventLog.werBucket),
+                             std::wstring(eventLog.clrException)});
+        return true;
+    };
+};
+
+// A crash goes out as one incident as soon as its report joins the fault, a fault without a report once its window
+// has elapsed, and a report joins the fault with its report ID before one with only the same image name.
+void TestIncidentCorrelator()
+{
+    using namespace std::chrono_literals;
+    {
+        CrashReplay replay(16);
+        replay.Runtime(L"app.exe"sv, 0x10, L"System.InvalidOperationException"sv);
+        replay.Fault(L"app.exe"sv, 0x10, L"r1"sv);
+        CHECK(replay.incidents.empty());
+        CHECK(replay.Report(L"APP.EXE"sv, L"r1"sv, L"1234"sv));
+        CHECK(replay.incidents.size() == 1);
+        auto &incident = replay.incidents.back();
+        CHECK(incident.appName == L"app.exe"sv);
+        CHECK(incident.processId == L"0x10"sv);
+        CHECK(incident.eventName == L"APPCRASH"sv);
+        CHECK(incident.bucket == L"1234"sv);
+        CHECK(incident.exception == L"System.InvalidOperationException"sv);
+        CHECK(!replay.Report(L"app.exe"sv, L"r1"sv, L"1234"sv));
+        CHECK(replay.correlator.Unmatched() == 1);
+    }
+    {
+        CrashReplay replay(16);
+        replay.Fault(L"app.exe"sv, 0x20);
+        replay.Fault(L"app.exe"sv, 0x21, L"r2"sv);
+        replay.Runtime(L"other.exe"sv, 0x30, L"System.Exception"sv);
+        CHECK(replay.Report(L"app.exe"sv, L"r2"sv, L"b2"sv));
+        CHECK(replay.Report(L"app.exe"sv, {}, L"b1"sv));
+        CHECK(replay.incidents.size() == 2);
+        CHECK(replay.incidents[0].processId == L"0x21"sv && replay.incidents[0].bucket == L"b2"sv);
+        CHECK(replay.incidents[1].processId == L"0x20"sv && replay.incidents[1].bucket == L"b1"sv);
+
+        // the runtime event alone stands in for its fault once the window has elapsed
+        replay.now += 9s;
+        replay.Flush();
+        CHECK(replay.incidents.size() == 2);
+        replay.now += 1s;
+        replay.Fault(L"late.exe"sv, 0x40);
+        replay.Flush();
+        CHECK(replay.incidents.size() == 3);
+        CHECK(replay.incidents[2].appName == L"other.exe"sv && replay.incidents[2].processId == L"0x30"sv);
+        CHECK(replay.incidents[2].exception == L"System.Exception"sv);
+    }
+    {
+        // a storm beyond the table sends the oldest incidents early, none is lost
+        CrashReplay replay(4);
+        for (std::uint32_t i = 0; i != 10; ++i)
+        {
+            replay.Fault(L"storm.exe"sv, i);
+        }
+        CHECK(replay.incidents.size() == 6);
+        CHECK(replay.incidents[0].processId == L"0x0"sv);
+        CHECK(replay.correlator.Lost() == 0);
+    }
+}
+
+// The filters pushed into the query of -correlate leave the events it joins to faults alone.
+void TestRelatedQuery()
+{
+    FilterRule rules[]{{false, L"EventID"s, L"1000"s}, {true, L"Provider"s, L"Noisy"s}, {false, L"AppName"s, L"a"s}};
+    CHECK(ErrorQuery(0, 0, rules) == L"*[System[(Level=2) and (EventID=1000) and (Provider[@Name!='Noisy'])]] and "
+                                     L"*[EventData[(Data[@Name='AppName']='a')]]"sv);
+    auto related = L" or "s + std::wstring(relatedEventsQuery) + L')';
+    CHECK(ErrorQuery(0, 0, rules, true) == L"*[System[(Level=2"s + related + L" and (EventID=1000" + related +
+                                               L" and (Provider[@Name!='Noisy']" + related + L"]]");
+}
+
+// Reads a little-endian u32 out of an image.
+std::uint32_t Peek(std::span<const std::byte> image, std::size_t offset)
+{
+    std::uint32_t value{};
+    std::memcpy(&value, image.data() + offset, sizeof(value));
+    return value;
+}
+
+// Writes a little-endian value into an image.
+void Poke(std::vector<std::byte> &image, std::size_t offset, std::uint32_t value, std::size_t size = 4)
+{
+    for (std::size_t i = 0; i != size; ++i)
+    {
+        image[offset + i] = static_cast<std::byte>(value >> i * 8);
+    }
+}
+
+// The trap programs of both machines resolve to their sections, since they export nothing. An export directory
+// written into the .data of one of them resolves to the nearest function by name or ordinal, and images that
+// are truncated, of another build or no PE image at all yield no index.
+void TestModuleIndex()
+{
+    auto directory = std::filesystem::path(__FILE__).parent_path().parent_path() / L"trap_program";
+    for (auto name : {L"x64trap.exe", L"arm64trap.exe"})
+    {
+        auto bytes = ReadFile(directory / name);
+        auto image = std::as_bytes(std::span(bytes));
+        CHECK(bytes.size() > 0x400);
+        if (bytes.size() <= 0x400)
+        {
+            continue;
+        }
+
+        ModuleIndex index;
+        auto timeStamp = Peek(image, Peek(image, 0x3c) + 8);
+        CHECK(!index.Parse(image, timeStamp + 1));
+        CHECK(index.Parse(image, timeStamp));
+        std::wstring symbol;
+        CHECK(index.Resolve(0x12a8, symbol) && symbol == L".text+0x2a8"sv);
+        symbol.clear();
+        CHECK(index.Resolve(0x2000, symbol) && symbol == L".rdata"sv);
+        CHECK(!index.Resolve(0x9000, symbol));
+        CHECK(!index.Parse(image.first(0x100), 0));
+        CHECK(!index.Parse(image.subspan(0x100), 0));
+    }
+
+    auto bytes = ReadFile(directory / L"x64trap.exe");
+    if (bytes.size() <= 0x400)
+    {
+        return;
+    }
+    std::vector<std::byte> image(bytes.size());
+    std::memcpy(image.data(), bytes.data(), bytes.size());
+    // NB: .data starts at RVA 0x3000 and file offset 0x1e00, the export directory is the first of PE32+
+    constexpr std::size_t data = 0x1e00;
+    Poke(image, data + 16, 1);      // ordinal base
+    Poke(image, data + 20, 2);      // functions
+    Poke(image, data + 24, 1);      // names
+    Poke(image, data + 28, 0x3040); // function RVAs
+    Poke(image, data + 32, 0x3050); // name RVAs
+    Poke(image, data + 36, 0x3060); // name ordinals
+    Poke(image, data + 0x40, 0x1100);
+    Poke(image, data + 0x44, 0x1200);
+    Poke(image, data + 0x50, 0x3070);
+    Poke(image, data + 0x60, 1, 2);
+    std::memcpy(image.data() + data + 0x70, "Trap", 5);
+    auto pe = Peek(image, 0x3c);
+    Poke(image, pe + 24 + 112, 0x3000);
+    Poke(image, pe + 24 + 116, 0x80);
+
+    ModuleIndex index;
+    CHECK(index.Parse(image, 0));
+    auto resolve = [&index](std::uint32_t rva) {
+        std::wstring symbol;
+        index.Resolve(rva, symbol);
+        return symbol;
+    };
+    CHECK(resolve(0x10f0) == L".text+0xf0"sv);
+    CHECK(resolve(0x1100) == L"#1"sv);
+    CHECK(resolve(0x1150) == L"#1+0x50"sv);
+    CHECK(resolve(0x1250) == L"Trap+0x50"sv);
+    CHECK(resolve(0x2010) == L".rdata+0x10"sv);
+}
+
+// The first error of a burst shows at once, the rest of the window goes out as one summary under the same tag,
+// a quiet window ends the burst, and the next one gets a tag of its own. Text is escaped into the payload.
+void TestToastBatcher()
+{
+    using namespace std::chrono_literals;
+    struct Toast
+    {
+        std::wstring xml;
+        std::wstring tag;
+    };
+    std::vector<Toast> toasts;
+    auto show = [&toasts](std::wstring_view xml, std::wstring_view tag) {
+        toasts.push_back({std::wstring(xml), std::wstring(tag)});
+    };
+    ToastBatcher batcher(2s);
+    Clock::time_point start{};
+
+    batcher.Add(L"first <error> in \"Tom & Jerry's\""sv, start, show);
+    CHECK(toasts.size() == 1);
+    CHECK(toasts[0].xml.find(L"<text>first &lt;error&gt; in &quot;Tom &amp; Jerry&apos;s&quot;</text>"sv) !=
+          std::wstring::npos);
+    batcher.Add(L"second"sv, start + 1s, show);
+    batcher.Add(L"third"sv, start + 1500ms, show);
+    batcher.Flush(start + 1900ms, show);
+    CHECK(toasts.size() == 1);
+    batcher.Flush(start + 2s, show);
+    CHECK(toasts.size() == 2);
+    CHECK(toasts[1].tag == toasts[0].tag);
+    CHECK(toasts[1].xml.find(L"<text>3 application errors</text><text>third</text>"sv) != std::wstring::npos);
+
+    // the burst goes on while windows bring errors and ends with a quiet one
+    batcher.Add(L"fourth"sv, start + 3s, show);
+    batcher.Flush(start + 4s, show);
+    CHECK(toasts.size() == 3 && toasts[2].tag == toasts[0].tag);
+    CHECK(toasts[2].xml.find(L"<text>4 application errors</text><text>fourth</text>"sv) != std::wstring::npos);
+    batcher.Flush(start + 6s, show);
+    CHECK(toasts.size() == 3);
+    batcher.Add(L"next"sv, start + 7s, show);
+    CHECK(toasts.size() == 4 && toasts[3].tag != toasts[0].tag);
+
+    batcher.Add(L"pending"sv, start + 8s, show);
+    batcher.Drain(show);
+    CHECK(toasts.size() == 5 && toasts[4].xml.find(L"<text>2 application errors</text>"sv) != std::wstring::npos);
+}
+
+// A lone message shows as it is however long, messages posted while a dialog is open fold into the next one up to
+// its size and are only counted beyond it, and closing wakes a waiting dialog thread.
+void TestMessageBoxQueue()
+{
+    MessageBoxQueue queue;
+    std::wstring message;
+    std::wstring lone(10'000, L'x');
+    queue.Post(lone);
+    CHECK(queue.Wait(message) && message == lone);
+
+    constexpr std::size_t posted = 1'000;
+    for (std::size_t i = 0; i != posted; ++i)
+    {
+        queue.Post(L"error "s + std::to_wstring(i));
+    }
+    CHECK(queue.Wait(message));
+    CHECK(message.starts_with(L"1000 application errors occurred while the previous message was open:\n\n"
+                              L"error 0\nerror 1\n"sv));
+    CHECK(message.ends_with(L" more not shown.\n"sv));
+    CHECK(message.size() < 4096 + 128);
+
+    std::jthread dialog([&queue] {
+        std::wstring message;
+        while (queue.Wait(message))
+        {
+            CHECK(message == L"from the parser"sv);
+        }
+    });
+    queue.Post(L"from the parser"sv);
+    queue.Close();
+    dialog.join();
+    CHECK(queue.Closed());
+    CHECK(!queue.Wait(message));
+}
+
+#ifdef _WIN32
+// Accepts one connection on a listening socket and reads it to the end.
+std::string Receive(const LoopbackSocket &listener)
+{
+    std::string stream;
+    auto client = ::accept(listener.Get(), nullptr, nullptr);
+    if (client == INVALID_SOCKET)
+    {
+        return stream;
+    }
+    char buffer[4096];
+    for (int received; (received = ::recv(client, buffer, sizeof(buffer), 0)) > 0;)
+    {
+        stream.append(buffer, static_cast<std::size_t>(received));
+    }
+    ::closesocket(client);
+    return stream;
+}
+
+// Batches for a TCP receiver that is down go to the spool, which the next run sends ahead of its own batch as
+// octet-counted syslog messages, and -compress frames each batch behind its compressed and original sizes.
+void TestForwarderLoopback()
+{
+    auto spool = std::filesystem::temp_directory_path() / L"apperrnotitool_test.spool";
+    std::filesystem::remove(spool);
+    EventArena arena;
+    arena.content.assign(GenerateCorpus(1).front());
+    ParseEventLog(arena.content, arena.eventLog);
+    EventOutput output(arena);
+    output.Reset(&arena.eventLog);
+    std::atomic<std::uint64_t> dropped{};
+    Clock::time_point now{};
+
+    wchar_t name[256];
+    auto size = static_cast<DWORD>(std::size(name));
+    std::wstring host;
+    if (::GetComputerNameExW(ComputerNameDnsHostname, name, &size))
+    {
+        host.assign(name, size);
+    }
+    std::wstring message;
+    FormatSyslog(output.Event(), output.Fields(), output.MinimalText(), host, message);
+    std::string syslog;
+    AppendUtf8(message, syslog);
+    auto framed = std::to_string(syslog.size()) + ' ' + syslog;
+
+    std::wstring closedPort;
+    {
+        LoopbackSocket closed(true);
+        closedPort = closed.Port();
+    }
+    {
+        Forwarder forwarder({true, L"127.0.0.1"s, closedPort}, false, false, spool, dropped);
+        forwarder.Add(output, now);
+        forwarder.Add(output, now);
+        forwarder.Flush(now);
+    }
+    std::error_code error;
+    CHECK(std::filesystem::file_size(spool, error) == 4 + 2 * framed.size());
+
+    LoopbackSocket receiver(true);
+    {
+        Forwarder forwarder({true, L"127.0.0.1"s, receiver.Port()}, false, false, spool, dropped);
+        forwarder.Add(output, now);
+        forwarder.Flush(now);
+    }
+    CHECK(Receive(receiver) == framed + framed + framed);
+    CHECK(!std::filesystem::exists(spool));
+
+    output.Reset(&arena.eventLog, PrintStyle::jsonl);
+    std::string lines;
+    AppendUtf8(output.Text(), lines);
+    lines += lines;
+    {
+        Forwarder forwarder({true, L"127.0.0.1"s, receiver.Port()}, true, true, spool, dropped);
+        forwarder.Add(output, now);
+        forwarder.Add(output, now);
+        forwarder.Flush(now);
+    }
+    auto stream = Receive(receiver);
+    auto image = std::as_bytes(std::span(stream));
+    CHECK(stream.size() > 8 && Peek(image, 0) == stream.size() - 8 && Peek(image, 4) == lines.size());
+    DECOMPRESSOR_HANDLE decompressor{};
+    std::string decompressed(lines.size(), '\0');
+    SIZE_T decompressedSize{};
+    CHECK(::CreateDecompressor(COMPRESS_ALGORITHM_MSZIP | COMPRESS_RAW, nullptr, &decompressor));
+    CHECK(stream.size() > 8 && ::Decompress(decompressor, stream.data() + 8, stream.size() - 8, decompressed.data(),
+                                            decompressed.size(), &decompressedSize));
+    ::CloseDecompressor(decompressor);
+    CHECK(decompressedSize == lines.size() && decompressed == lines);
+    CHECK(dropped == 0);
+}
+#endif
+
+} // namespace
+
+#if defined(__GNUC__) && !defined(__clang__)
+// NB: GCC takes the free in operator delete for a mismatch with the replaced operator new
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+// Counts the heap allocations of each thread, which the tool itself never does.
+void *operator new(std::size_t size)
+{
+    ++bizwen::allocations;
+    bizwen::allocatedBytes += size;
+    if (auto p = std::malloc(size == 0 ? 1 : size))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+int main()
+{
+#ifdef _WIN32
+    WSADATA data;
+    if (::WSAStartup(MAKEWORD(2, 2), &data) != 0)
+    {
+        return 1;
+    }
+#endif
+
+    TestDecodeXmlText();
+    TestParseEventLog();
+    TestFieldNames();
+    TestEventFilter();
+    TestEventValues();
+    TestJsonEscaping();
+    TestBinaryRecords();
+    TestTranscoders();
+    TestArenaAllocations();
+    TestFaultCoalescer();
+    TestTokenBucket();
+    TestSinkLimiter();
+    TestRollingLog();
+    TestIncidentCorrelator();
+    TestRelatedQuery();
+    TestModuleIndex();
+    TestToastBatcher();
+    TestMessageBoxQueue();
+    TestPipelineStress();
+    TestEventBatches();
+    TestEventRecords();
+    TestParallelIngest();
+    TestReadyQueue();
+    TestReadChannels();
+    TestHistory();
+#ifdef _WIN32
+    TestBackfillSource();
+    TestForwarderLoopback();
+
+    ::WSACleanup();
+#endif
+    if (failures != 0)
+    {
+        std::fprintf(stderr, "%d checks failed\n", failures.load());
+        return 1;
+    }
+    std::fprintf(stderr, "all checks passed\n");
+    return 0;
+}